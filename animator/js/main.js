@@ -6,14 +6,19 @@ let frame = 0;
 let timeout;
 let images = [];
 let imagemeta = [];
-let framesdir, regions, gridsize, timeslots, framerate;
+let framesdir, regions, gridsize, timeslots, framerate, displayLength;
 let isLoading = false;
 
-const $ = selector => document.querySelector(selector);
+// Layout of frame streams (see src/utils/framestream.h).
+const FRAME_STREAM_MAGIC = 'POOLFRM1';
+const FRAME_STREAM_HEADER_LENGTH = 40;
+const FRAME_STREAM_INDEX_LENGTH = 16;
+const FRAME_TYPE_DELTA = 1;
+const FRAME_LARGE = 255;
 
-function initializeGpujs(regions, gridsize) {
-    const length = Math.floor(Math.sqrt(regions)) * gridsize;
+const $ = selector => document.querySelector(selector);
 
+function initializeGpujs(length) {
     kernel = gpu.createKernel(
         function(imageData, size, bitmapMax) {
             var y = 3 * (size - this.thread.y - 1) * size;
@@ -30,8 +35,8 @@ function initializeGpujs(regions, gridsize) {
     );
 
     const canvas = kernel.getCanvas();
-    canvas.width = gridsize * Math.sqrt(regions);
-    canvas.height = gridsize * Math.sqrt(regions);
+    canvas.width = displayLength;
+    canvas.height = displayLength;
     $('.canvas-container').appendChild(canvas);
 }
 
@@ -50,15 +55,20 @@ function start() {
     if (timeout) clearTimeout(timeout);
     frame = 0;
 
-    // Set up kernel and canvas.
-    initializeGpujs(regions, gridsize);
-
     // Preload all images via AJAX.
     console.log('Loading all images...');
     $('.loading-container').style.display = 'block';
 
-    loadImages(function() {
+    // A path to a single file is loaded as a frame stream, rather than a directory of PPMs.
+    const load = framesdir.endsWith('.bin') ? loadFrameStream : loadImages;
+
+    load(function() {
         console.log('Loaded!');
+
+        // Set up kernel and canvas.
+        displayLength = gridsize * Math.sqrt(regions);
+        initializeGpujs(imagemeta[0]);
+
         $('.loading-container').style.display = 'none';
         $('.canvas-container').style.display = 'block';
 
@@ -115,12 +125,110 @@ function loadImages(callback) {
     }
 }
 
+function loadFrameStream(callback) {
+    images = [];
+
+    // Reset progress bar.
+    $('progress').innerHTML = '0%';
+    document.querySelector('progress').value = 0;
+
+    // Prevent cached XHRs by appending current timestamp to request.
+    const date = new Date().getTime();
+
+    const xhr = new XMLHttpRequest();
+    xhr.open('GET', `${framesdir}?r=${date}`, true);
+    xhr.responseType = 'arraybuffer';
+
+    xhr.onprogress = function(e) {
+        if (!e.lengthComputable) return;
+
+        // Update progress bar.
+        const percentLoaded = Math.round(e.loaded / e.total * 100);
+        $('progress').innerHTML = `${percentLoaded}%`;
+        $('progress').value = percentLoaded;
+    };
+
+    xhr.onload = function(e) {
+        if (xhr.readyState !== xhr.DONE || xhr.status !== 200) return;
+
+        const view = new DataView(xhr.response);
+        const bytes = new Uint8Array(xhr.response);
+        const magic = String.fromCharCode(...bytes.slice(0, FRAME_STREAM_MAGIC.length));
+        if (magic !== FRAME_STREAM_MAGIC) {
+            console.error('Not a frame stream:', framesdir);
+            isLoading = false;
+            return;
+        }
+
+        const width = view.getUint32(8, true);
+        const height = view.getUint32(12, true);
+        const numFrames = view.getUint32(24, true);
+        const indexOffset = view.getUint32(32, true) + view.getUint32(36, true) * 2 ** 32;
+        imagemeta = [width, height, 255];
+        timeslots = numFrames;
+
+        console.log('Frames:', numFrames, `(${width}x${height})`);
+
+        let pixels = new Uint8Array(width * height);
+        for (let i = 0; i < numFrames; i++) {
+            const entry = indexOffset + i * FRAME_STREAM_INDEX_LENGTH;
+            const offset = view.getUint32(entry, true) + view.getUint32(entry + 4, true) * 2 ** 32;
+            const length = view.getUint32(entry + 8, true);
+
+            pixels = decodeFrame(bytes.subarray(offset, offset + length), pixels);
+            images[i] = toImageData(pixels);
+        }
+
+        isLoading = false;
+        callback();
+    };
+
+    xhr.send();
+}
+
+function decodeFrame(frame, previous) {
+    const pixels = new Uint8Array(previous.length);
+    const isDelta = frame[0] === FRAME_TYPE_DELTA;
+
+    // Each run is a varint of its length, followed by its value.
+    let p = 1;
+    let i = 0;
+    while (p < frame.length) {
+        let run = 0;
+        let shift = 0;
+        let byte;
+        do {
+            byte = frame[p++];
+            run += (byte & 0x7f) * 2 ** shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        const value = frame[p++];
+        for (const end = i + run; i < end; i++) pixels[i] = isDelta ? previous[i] ^ value : value;
+    }
+
+    return pixels;
+}
+
+function toImageData(pixels) {
+    // Large particles are drawn in blue, and small particles in red.
+    const imageData = new Array(3 * pixels.length);
+    for (let i = 0; i < pixels.length; i++) {
+        const large = pixels[i] === FRAME_LARGE;
+        imageData[3 * i + 0] = large ? 0 : pixels[i];
+        imageData[3 * i + 1] = 0;
+        imageData[3 * i + 2] = large ? 255 : 0;
+    }
+
+    return imageData;
+}
+
 function nextFrame(imageData, size, bitmapMax) {
     kernel(imageData, size, bitmapMax);
 
     const canvas = kernel.getCanvas();
-    canvas.width = gridsize * Math.sqrt(regions);
-    canvas.height = gridsize * Math.sqrt(regions);
+    canvas.width = displayLength;
+    canvas.height = displayLength;
 }
 
 function stop(e) {
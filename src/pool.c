@@ -1,24 +1,39 @@
 /**
  * pool.c
  * 
- * For the parallel version of the program, the number of regions
- * will be taken from the number of processes (as indicated through
- * the -np flag), as expected.
+ * For the parallel version of the program, the pool has PoolLength x PoolLength
+ * regions as given by the spec (or roughly a region for each process, if it is
+ * not given), regardless of the number of processes (as indicated through the -np flag).
+ *
+ * Each region is split into sub-regions (at least as many as the SUB_REGIONS
+ * environment variable along each side), and each process (i.e. rank) computes
+ * a set of sub-regions, which starts as a rectangular block of the pool and may
+ * be migrated between processes to even out the computation time of each process.
  */
 
 #include <assert.h>
+#include <math.h>
 #include <mpi.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "simulation/health.h"
+#include "simulation/multipole.h"
 #include "simulation/nbody.h"
+#include "utils/benchmark.h"
+#include "utils/checkpoint.h"
 #include "utils/common.h"
+#include "utils/decomposition.h"
 #include "utils/env.h"
+#include "utils/framestream.h"
 #include "utils/heatmap.h"
 #include "utils/log.h"
 #include "utils/multiproc.h"
+#include "utils/particlefile.h"
 #include "utils/particles.h"
+#include "utils/pyramid.h"
 #include "utils/regions.h"
 #include "utils/spec.h"
 #include "utils/timer.h"
@@ -26,35 +41,538 @@
 #define PROG "pool"
 #define TIMEBUF_LENGTH 10
 #define MASTER_ID 0
+#define TAG_MIGRATE 1
+#define TAG_HALO 2
+#define TAG_FRAME 3
+#define TAG_FRAME_END 4
+#define MAX_PENDING_FRAMES 4
+#define STOP_CHECK_INTERVAL 16
 
 // Stores the specifications for the program.
 Spec spec;
 
+// Stores the assignment of regions to processes.
+Decomposition decomp;
+
+// Regions that this process is computing for, in ascending order.
+int *my_regions;
+int num_my_regions;
+
+// Whether this process is computing for each region, indexed by region ID.
+char *my_region_flags;
+
+// Whether each region lies within the near horizon of the region being computed (so that its particles are summed
+// exactly), or beyond it but within the horizon (so that its multipole summary is used instead), indexed by region ID.
+char *near_regions;
+char *far_regions;
+
+// Whether each region is needed by each process for the horizon duplication,
+// indexed by region ID * number of processes + process ID.
+char *halo_plan;
+
+// Whether each process has regions adjacent to this process' regions, indexed by process ID.
+char *migration_peers;
+
+// Computation time spent on each region since the last rebalancing, indexed by region ID.
+long long *region_costs;
+
+// Number of iterations between each rebalancing of regions. Disabled if not positive.
+int rebalance_interval = 0;
+
 // Store the total computation and communication time for all iterations.
 long long comm_sum = 0;
 long long comp_sum = 0;
 
+// File that the benchmark is written to (if any), and the timings and counts of each time slot of this process,
+// which are summarised in the report.
+char *benchmark_file = NULL;
+BenchmarkFormat benchmark_format = BENCHMARK_FORMAT_JSON;
+Benchmark benchmark = { 0 };
+
+// Checks the synchronised particles for numerical corruption every few time slots (if enabled).
+HealthMonitor health = { 0 };
+
 // Custom MPI datatype to store our Particle struct.
 MPI_Datatype mpi_particle_type;
 
+// Max distance of regions (of the spec) whose particles are computed exactly.
+// Regions beyond this distance only contribute their multipole summaries.
+// Multipole summaries are disabled if this is negative.
+int multipole_horizon = -1;
+
+// Multipole summaries for all regions, indexed by region ID.
+Multipole *multipoles = NULL;
+
+// If non-zero, processes only synchronise with their neighbours instead of globally.
+int neighbour_sync = 0;
+
+// If non-zero, regions are assigned using orthogonal recursive bisection instead of the process grid.
+int orb_decomposition = 0;
+
+// If non-zero, halos of processes on the same node are read in place from shared memory windows,
+// instead of being copied through messages.
+int shared_halos = 0;
+
+// Communicator of all processes on the same node, and the rank of each process within it (or -1).
+MPI_Comm node_comm;
+int *node_ranks;
+
+// If non-zero, halos for processes on other nodes are aggregated through the leader of each node,
+// instead of being sent directly between each pair of processes.
+int hierarchical_halos = 0;
+
+// Communicator between the leaders of each node, and the node of each process.
+MPI_Comm leader_comm;
+int *node_ids;
+int num_nodes;
+
+// Shared memory window, where each process on the node publishes the particles of its regions.
+MPI_Win shared_win = MPI_WIN_NULL;
+Particle *shared_base;
+int shared_capacity = 0;
+
+// Order in which the blocks of the process grid are assigned to processes.
+RegionOrder region_order = REGION_ORDER_ROW_MAJOR;
+const char *region_order_names[] = { "row-major", "hilbert", "cart" };
+
+// Format of the output heatmap (debug frames are always P3).
+OutputFormat output_format = OUTPUT_FORMAT_P3;
+
+// Communicator of all compute processes, which excludes the frame writers.
+MPI_Comm compute_comm;
+
+// Number of dedicated processes that write debug frames, which are the last processes in MPI_COMM_WORLD.
+int frame_writers = 0;
+
+// Format of the debug frames, which are only generated for every frame_decimation-th time slot.
+FrameFormat frame_format = FRAME_FORMAT_PPM;
+int frame_decimation = 1;
+int frame_downsample = 1;
+FrameStream *frame_stream = NULL;
+
+// Persistent tile of each region that this process is in charge of, which is updated for each debug frame.
+IncrementalCanvas *region_canvases = NULL;
+
+// Debug frames that are still being sent to the frame writers, and their buffers of particles.
+MPI_Request frame_requests[MAX_PENDING_FRAMES];
+Particle *frame_buffers[MAX_PENDING_FRAMES];
+
+// File that checkpoints are written to, the number of time slots between checkpoints,
+// and the checkpoint which is being written in the background (if any).
+char *checkpoint_file = NULL;
+int checkpoint_interval = 0;
+Checkpoint *checkpoint = NULL;
+
+// File of the checkpoint that the simulation is restarted from (if any).
+char *restart_file = NULL;
+
+// File of the initial particles, which replace the particles generated from the spec (if any).
+char *particle_file = NULL;
+
+// Set when a signal asks this process to checkpoint and stop the simulation, which is agreed upon
+// by all processes through a reduction that is started a time slot before each check, and completes
+// during the computation of that time slot.
+volatile sig_atomic_t stop_signalled = 0;
+int local_stop = 0;
+int global_stop = 0;
+MPI_Request stop_request = MPI_REQUEST_NULL;
+
+// Number of time slots between checks of whether any process was asked to stop.
+int stop_check_interval = 1;
+
+// If non-zero, the simulation was stopped before the last time slot.
+int stopped = 0;
+
+// If non-zero, regions were reassigned since the last synchronisation, so particles can be
+// handed over to any process, and must be synchronised globally.
+int reassigned = 0;
+
 /**
- * Initialize arrays of particles and generate the initial particles
- * to be located entirely in the region ID corresponding to the current process ID.
+ * Returns the max distance of regions whose particles need to be duplicated to each process.
  */
-Particle **init_particles(int **sizes)
+int get_halo_horizon()
+{
+    // Regions beyond the near horizon only need to send their multipole summaries.
+    if (multipole_horizon >= 0 && multipole_horizon < spec.Horizon) return multipole_horizon;
+
+    return spec.Horizon;
+}
+
+/**
+ * Recomputes the regions that this process is computing for, as well as the processes
+ * that it needs to communicate with, after the assignment of regions has changed.
+ */
+void update_assignment()
+{
+    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+
+    num_my_regions = get_owned_regions(decomp, my_proc, my_regions);
+    for (int region = 0; region < num_regions; region++) my_region_flags[region] = decomp.owners[region] == my_proc ? REGION_COMPUTED : 0;
+
+    // A region is needed by a process if it is within the horizon of any of the process' regions.
+    memset(halo_plan, 0, num_regions * num_cores);
+    for (int sender = 0; sender < num_regions; sender++) {
+        for (int receiver = 0; receiver < num_regions; receiver++) {
+            if (decomp.owners[sender] == decomp.owners[receiver]) continue;
+            if (get_spec_region_dist(spec, decomp, sender, receiver) > get_halo_horizon()) continue;
+            halo_plan[sender * num_cores + decomp.owners[receiver]] = 1;
+        }
+    }
+
+    // Particles can move into any adjacent region (of the spec) within a single time step,
+    // i.e. by up to its number of sub-regions along each axis.
+    memset(migration_peers, 0, num_cores);
+    for (int i = 0; i < num_my_regions; i++)
+        for (int region = 0; region < num_regions; region++)
+            if (get_wrapped_region_dist(my_regions[i], region, spec) <= decomp.sub_regions) migration_peers[decomp.owners[region]] = 1;
+    migration_peers[my_proc] = 0;
+}
+
+/**
+ * Gets the list of regions of the sender process that the receiver process needs
+ * for the horizon duplication. Returns the number of regions written to the regions array.
+ */
+int get_halo_regions(int sender, int receiver, int *regions)
+{
+    int n = 0;
+    for (int region = 0; region < decomp.num_regions; region++)
+        if (decomp.owners[region] == sender && halo_plan[region * get_num_cores() + receiver]) regions[n++] = region;
+
+    return n;
+}
+
+/**
+ * Copies the particles of this process' regions into its segment of the shared memory window,
+ * so that other processes on the same node can read them in place.
+ */
+void publish_shared_regions(int *total_sizes, Particle **particles)
+{
+    int count = 0;
+    for (int i = 0; i < num_my_regions; i++) count += total_sizes[my_regions[i]];
+
+    // Allocating the window is collective, so all processes on the node grow it together.
+    int max_count;
+    MPI_Allreduce(&count, &max_count, 1, MPI_INT, MPI_MAX, node_comm);
+    if (shared_win == MPI_WIN_NULL || max_count > shared_capacity) {
+        if (shared_win != MPI_WIN_NULL) {
+            MPI_Win_unlock_all(shared_win);
+            MPI_Win_free(&shared_win);
+        }
+
+        shared_capacity = 2 * max_count;
+        LL_MPI("Allocating shared window for %d particles.", shared_capacity);
+        MPI_Win_allocate_shared(shared_capacity * sizeof(Particle), sizeof(Particle), MPI_INFO_NULL, node_comm, &shared_base, &shared_win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_win);
+    }
+
+    // No process is still reading the previous snapshot, since all processes must have
+    // completed the previous time step before the total sizes could be reduced.
+    for (int i = 0, offset = 0; i < num_my_regions; offset += total_sizes[my_regions[i]], i++)
+        memcpy(&shared_base[offset], particles[my_regions[i]], total_sizes[my_regions[i]] * sizeof(Particle));
+
+    // Make the snapshot visible to all other processes on the node.
+    MPI_Win_sync(shared_win);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(shared_win);
+}
+
+/**
+ * Points the arrays of the given regions directly at the segment of the shared memory window
+ * of the process computing for them, which must be on the same node. These regions are flagged
+ * as read-only, and must be detached before the arrays are deallocated.
+ */
+void attach_shared_regions(int sender, int n, int *regions, int *total_sizes, Particle **particles)
+{
+    MPI_Aint segment_size;
+    int disp_unit;
+    Particle *segment;
+    MPI_Win_shared_query(shared_win, node_ranks[sender], &segment_size, &disp_unit, &segment);
+
+    // The segment holds the particles of the regions of the sender, in ascending order.
+    int *owned = malloc(decomp.num_regions * sizeof(int));
+    int num_owned = get_owned_regions(decomp, sender, owned);
+    for (int i = 0; i < n; i++) {
+        int offset = 0;
+        for (int j = 0; j < num_owned && owned[j] < regions[i]; j++) offset += total_sizes[owned[j]];
+
+        free(particles[regions[i]]);
+        particles[regions[i]] = &segment[offset];
+        my_region_flags[regions[i]] |= REGION_READ_ONLY;
+    }
+
+    free(owned);
+}
+
+/**
+ * Detaches the arrays of regions which point into the shared memory window, so that they are not freed.
+ */
+void detach_shared_regions(Particle **particles)
+{
+    for (int region = 0; region < decomp.num_regions; region++) {
+        if (!(my_region_flags[region] & REGION_READ_ONLY)) continue;
+        particles[region] = NULL;
+        my_region_flags[region] &= ~REGION_READ_ONLY;
+    }
+}
+
+/**
+ * Duplicates the final particles to horizon processes on other nodes, aggregated through the leader
+ * of each node. Each region is only sent once to each node that needs it, regardless of how many
+ * processes on that node need it, so there is only a single message between each pair of nodes.
+ */
+void exchange_node_halos(int *total_sizes, Particle **particles, int *offsets, int *sizes)
 {
     int num_cores = get_num_cores();
-    int region_id = get_process_id();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int my_node = node_ids[my_proc];
+    int node_size, node_rank, count;
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_rank(node_comm, &node_rank);
+
+    // Find the nodes that need each region, i.e. the nodes of the processes within its horizon.
+    char *node_needs = calloc(num_regions * num_nodes, 1);
+    char *needed = calloc(num_regions, 1);
+    for (int region = 0; region < num_regions; region++) {
+        for (int proc = 0; proc < num_cores; proc++) {
+            int node = node_ids[proc];
+            if (!halo_plan[region * num_cores + proc] || node == node_ids[decomp.owners[region]]) continue;
+            node_needs[region * num_nodes + node] = 1;
+            needed[region] = 1;
+        }
+    }
+
+    // Processes on this node, in the order of their rank within the node.
+    int *local_procs = malloc(node_size * sizeof(int));
+    for (int proc = 0; proc < num_cores; proc++)
+        if (node_ranks[proc] >= 0) local_procs[node_ranks[proc]] = proc;
+
+    int *regions = malloc(num_regions * sizeof(int));
+    int *counts = calloc(node_size > num_nodes ? node_size : num_nodes, sizeof(int));
+    int *displs = calloc(node_size > num_nodes ? node_size : num_nodes, sizeof(int));
+
+    /// Step 4a: Gather the regions needed by other nodes at the leader of this node.
+    // Each process contributes its own regions in ascending order, so the leader knows where each region is.
+    int *region_offsets = calloc(num_regions, sizeof(int));
+    int gathered_count = 0;
+    for (int i = 0; i < node_size; i++) {
+        displs[i] = gathered_count;
+        for (int region = 0; region < num_regions; region++) {
+            if (decomp.owners[region] != local_procs[i] || !needed[region]) continue;
+            region_offsets[region] = gathered_count;
+            gathered_count += total_sizes[region];
+        }
+        counts[i] = gathered_count - displs[i];
+    }
+
+    int n = 0;
+    for (int i = 0; i < num_my_regions; i++)
+        if (needed[my_regions[i]]) regions[n++] = my_regions[i];
+    Particle *send_buf = pack_regions(n, regions, total_sizes, particles, &count);
+    Particle *gathered = node_rank == 0 ? malloc(gathered_count * sizeof(Particle)) : NULL;
+    MPI_Gatherv(send_buf, count, mpi_particle_type, gathered, counts, displs, mpi_particle_type, 0, node_comm);
+    if (n != 1) free(send_buf);
+
+    /// Step 4b: Exchange the regions needed by each node between the leaders of each node.
+    // All processes know the sizes of all regions, so the leaders can compute the counts without communicating.
+    Particle *scatter_buf = NULL;
+    if (node_rank == 0) {
+        int *send_counts = calloc(num_nodes, sizeof(int));
+        int *send_displs = calloc(num_nodes, sizeof(int));
+        int *recv_counts = calloc(num_nodes, sizeof(int));
+        int *recv_displs = calloc(num_nodes, sizeof(int));
+        int send_count = 0, recv_count = 0;
+        for (int node = 0; node < num_nodes; node++) {
+            send_displs[node] = send_count;
+            recv_displs[node] = recv_count;
+            for (int region = 0; region < num_regions; region++) {
+                int owner_node = node_ids[decomp.owners[region]];
+                if (owner_node == my_node && node_needs[region * num_nodes + node]) send_count += total_sizes[region];
+                if (owner_node == node && node_needs[region * num_nodes + my_node]) recv_count += total_sizes[region];
+            }
+            send_counts[node] = send_count - send_displs[node];
+            recv_counts[node] = recv_count - recv_displs[node];
+        }
+
+        Particle *send_all = malloc(send_count * sizeof(Particle));
+        for (int node = 0, offset = 0; node < num_nodes; node++) {
+            for (int region = 0; region < num_regions; region++) {
+                if (node_ids[decomp.owners[region]] != my_node || !node_needs[region * num_nodes + node]) continue;
+                memcpy(&send_all[offset], &gathered[region_offsets[region]], total_sizes[region] * sizeof(Particle));
+                offset += total_sizes[region];
+            }
+        }
+
+        // Received regions are also in ascending order within each node.
+        Particle *recv_all = malloc(recv_count * sizeof(Particle));
+        LL_MPI2("Exchanging %d particles between node leaders (receiving %d)", send_count, recv_count);
+        MPI_Alltoallv(send_all, send_counts, send_displs, mpi_particle_type, recv_all, recv_counts, recv_displs, mpi_particle_type, leader_comm);
+        for (int node = 0; node < num_nodes; node++) {
+            int offset = recv_displs[node];
+            for (int region = 0; region < num_regions; region++) {
+                if (node_ids[decomp.owners[region]] != node || !node_needs[region * num_nodes + my_node]) continue;
+                region_offsets[region] = offset;
+                offset += total_sizes[region];
+            }
+        }
+
+        /// Step 4c: Pack the regions needed by each process on this node, to be scattered.
+        int scatter_count = 0;
+        for (int i = 0; i < node_size; i++) {
+            for (int region = 0; region < num_regions; region++) {
+                if (node_ids[decomp.owners[region]] == my_node || !halo_plan[region * num_cores + local_procs[i]]) continue;
+                scatter_count += total_sizes[region];
+            }
+        }
+
+        scatter_buf = malloc(scatter_count * sizeof(Particle));
+        for (int i = 0, offset = 0; i < node_size; i++) {
+            for (int region = 0; region < num_regions; region++) {
+                if (node_ids[decomp.owners[region]] == my_node || !halo_plan[region * num_cores + local_procs[i]]) continue;
+                memcpy(&scatter_buf[offset], &recv_all[region_offsets[region]], total_sizes[region] * sizeof(Particle));
+                offset += total_sizes[region];
+            }
+        }
+
+        free(send_all);
+        free(recv_all);
+        free(send_counts);
+        free(send_displs);
+        free(recv_counts);
+        free(recv_displs);
+    }
+
+    /// Step 4d: Scatter the regions from other nodes to the processes on this node which need them.
+    int scatter_count = 0;
+    for (int i = 0; i < node_size; i++) {
+        displs[i] = scatter_count;
+        for (int region = 0; region < num_regions; region++) {
+            if (node_ids[decomp.owners[region]] == my_node || !halo_plan[region * num_cores + local_procs[i]]) continue;
+            scatter_count += total_sizes[region];
+        }
+        counts[i] = scatter_count - displs[i];
+    }
+
+    count = counts[node_rank];
+    Particle *recv_buf = malloc(count * sizeof(Particle));
+    MPI_Scatterv(scatter_buf, counts, displs, mpi_particle_type, recv_buf, count, mpi_particle_type, 0, node_comm);
+    unpack_regions(count, recv_buf, particles, offsets);
+    for (int region = 0; region < num_regions; region++)
+        if (node_ids[decomp.owners[region]] != my_node && halo_plan[region * num_cores + my_proc]) sizes[region] = total_sizes[region];
+
+    free(recv_buf);
+    free(scatter_buf);
+    free(gathered);
+    free(region_offsets);
+    free(counts);
+    free(displs);
+    free(regions);
+    free(local_procs);
+    free(node_needs);
+    free(needed);
+}
+
+/**
+ * Initialize arrays of particles and generate an equal share of the initial particles
+ * of the pool on the current process ID.
+ */
+Particle **init_particles(int **sizes)
+{
+    // Allocate space for the array sizes.
+    *sizes = (int *)calloc(decomp.num_regions, sizeof(int));
+
+    // Particles are generated independently of the decomposition, so they can lie in the regions of any process,
+    // and must be handed over to their owners by a global synchronisation.
+    reassigned = 1;
+
+    // Generate this process' share of the particles.
+    return generate_process_particles(spec, decomp, get_process_id(), *sizes, 1);
+}
+
+/**
+ * Returns the header of a checkpoint for the current decomposition.
+ */
+CheckpointHeader get_checkpoint_header(int time_slot)
+{
+    CheckpointHeader header = {
+        .canvas_length = spec.GridSize * spec.PoolLength,
+        .grid_size = spec.GridSize,
+        .num_regions = decomp.num_regions,
+        .time_slot = time_slot,
+    };
+
+    return header;
+}
 
-    // Allocate space for particles and their array sizes.
-    *sizes = (int *)calloc(num_cores, sizeof(int));
-    Particle **particles = allocate_particles(*sizes, num_cores);
+/**
+ * Loads the particles from a checkpoint, and bins them into their regions. If the checkpoint has different
+ * regions, the particles are handed over to the processes in charge of their regions during the first
+ * synchronisation.
+ *
+ * Returns the particles indexed by region ID, and the number of time slots that were completed.
+ */
+Particle **restart_particles(int **sizes, int *time_slot)
+{
+    int n;
+    Particle *particles = read_checkpoint(compute_comm, restart_file, get_checkpoint_header(0), num_my_regions, my_regions, mpi_particle_type, time_slot, &n);
+
+    // Normalize each particle wrt its region in this decomposition.
+    for (int i = 0; i < n; i++) {
+        particles[i].region = get_denorm_particle_region(particles[i], spec);
+        particles[i].x = norm_region(particles[i].x, spec);
+        particles[i].y = norm_region(particles[i].y, spec);
+    }
 
-    // Generate particles for __this region only__.
-    particles[region_id] = generate_particles(region_id, spec);
-    (*sizes)[region_id] = spec.TotalNumberOfParticles;
+    *sizes = (int *)calloc(decomp.num_regions, sizeof(int));
+    Particle **particles_by_region = reallocate_for_region(spec, *sizes, n, particles, decomp.num_regions);
+    free(particles);
 
-    return particles;
+    // Particles can be in regions of any process.
+    reassigned = 1;
+
+    return particles_by_region;
+}
+
+/**
+ * Loads the initial particles from a particle file, and bins them into their regions. Each process reads
+ * an equal share of the file, and the particles are handed over to the processes in charge of their regions
+ * during the first synchronisation.
+ */
+Particle **import_particles(int **sizes)
+{
+    int n;
+    Particle *particles = read_particle_file(compute_comm, particle_file, spec.GridSize * spec.PoolLength, &n);
+
+    // Normalize each particle wrt its region in this decomposition.
+    long double max_radius = 0;
+    for (int i = 0; i < n; i++) {
+        particles[i].region = get_denorm_particle_region(particles[i], spec);
+        particles[i].x = norm_region(particles[i].x, spec);
+        particles[i].y = norm_region(particles[i].y, spec);
+        if (particles[i].radius > max_radius) max_radius = particles[i].radius;
+    }
+
+    // The spec describes the particles of the file instead, so that the bounds on the number of particles
+    // and the margins of canvases hold for them.
+    long long total = n;
+    MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_LONG_LONG, MPI_SUM, compute_comm);
+    MPI_Allreduce(MPI_IN_PLACE, &max_radius, 1, MPI_LONG_DOUBLE, MPI_MAX, compute_comm);
+    spec.NumberOfLargeParticles = 0;
+    spec.NumberOfSmallParticles = (total + decomp.num_regions - 1) / decomp.num_regions;
+    spec.TotalNumberOfParticles = spec.NumberOfSmallParticles;
+    spec.SmallParticleRadius = max_radius;
+    if (is_master()) LL_NOTICE("Imported %lld particle(s) from %s.", total, particle_file);
+
+    *sizes = (int *)calloc(decomp.num_regions, sizeof(int));
+    Particle **particles_by_region = reallocate_for_region(spec, *sizes, n, particles, decomp.num_regions);
+    free(particles);
+
+    // Particles can be in regions of any process.
+    reassigned = 1;
+
+    return particles_by_region;
 }
 
 /**
@@ -69,147 +587,496 @@ Particle **init_particles(int **sizes)
 Particle **sync_particles(int *sizes, Particle **particles)
 {
     int num_cores = get_num_cores();
-    int my_region = get_process_id();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int *regions = malloc(num_regions * sizeof(int));
+    int count;
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+    long long lap = wall_clock_time();
 
     /// This processor needs to send the particles it computed to other processors.
-    /// Other processors needs to receive the particles for its region, as well as for the horizon regions.
+    /// Other processors needs to receive the particles for its regions, as well as for the horizon regions.
     LL_MPI("%s", "Synchronising particles...");
 
     /// Step 1: Determine the total number of particles located in each region across all processes.
 
     // Initialize an array to store the total sizes for all regions.
-    int *total_sizes = calloc(num_cores, sizeof(int));
+    int *total_sizes = calloc(num_regions, sizeof(int));
 
     // This will sum up all items in the sizes array across all processes.
     // Note that the process doesn't necessarily need to know the size of every other region,
     // but since the data being sent is small enough we can afford to use Allreduce.
-    print_ints(LOG_LEVEL_MPI, "Region sizes that I am sending", num_cores, sizes);
-    MPI_Allreduce(sizes, total_sizes, num_cores, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-    print_ints(LOG_LEVEL_MPI, "Total region sizes across all processes", num_cores, total_sizes);
+    print_ints(LOG_LEVEL_MPI, "Region sizes that I am sending", num_regions, sizes);
+    MPI_Allreduce(sizes, total_sizes, num_regions, MPI_INT, MPI_SUM, compute_comm);
+    print_ints(LOG_LEVEL_MPI, "Total region sizes across all processes", num_regions, total_sizes);
 
     // Allocate space in the final_particles array, based on the sizes we calculated earlier.
-    Particle **final_particles = allocate_particles(total_sizes, num_cores);
+    Particle **final_particles = allocate_particles(total_sizes, num_regions);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_SIZES, lap);
 
-    /// Step 2: Send the particles that should belong to a particular region to that process.
+    /// Step 2: Send the particles that should belong to a particular region to the process computing for it.
 
-    // Whatever this processor computed for its own region, we can keep.
-    memcpy(final_particles[my_region], particles[my_region], sizes[my_region] * sizeof(Particle));
+    // Whatever this processor computed for its own regions, we can keep.
+    int *offsets = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        memcpy(final_particles[region], particles[region], sizes[region] * sizeof(Particle));
+        offsets[region] = sizes[region];
+    }
 
     // Each process can receive particles (for the same region) from __any__ process.
     // This is because a process can compute a particle that ends up in a different process.
-    int receive_offset = sizes[my_region];
-    for (int region = 0; region < num_cores; region++) {
-        // Loop through all regions __in order__, and see if it is this processor's turn to be sending particles.
+    for (int proc = 0; proc < num_cores; proc++) {
+        // Loop through all processes __in order__, and see if it is this processor's turn to be sending particles.
 
-        if (region == my_region) {
-            /// My turn: Send to all regions in order.
+        if (proc == my_proc) {
+            /// My turn: Send to all processes in order.
 
-            // Loop through all regions to send to.
+            // Loop through all processes to send to.
             for (int dest = 0; dest < num_cores; dest++) {
                 // Don't need to send to yourself.
-                if (dest == my_region) continue;
+                if (dest == my_proc) continue;
+
+                // Gather the particles that __belong to the regions of the process__.
+                int n = get_owned_regions(decomp, dest, regions);
+                Particle *buf = pack_regions(n, regions, sizes, particles, &count);
 
                 // First send the size of the subarray we are going to send.
-                mpi_send(&sizes[dest], 1, MPI_INT, dest, 0, MPI_COMM_WORLD);
-                LL_MPI2("About to send %d particles to process %d.", sizes[dest], dest);
+                mpi_send(&count, 1, MPI_INT, dest, 0, compute_comm);
+                LL_MPI2("About to send %d particles to process %d.", count, dest);
 
-                // Now we can send the array of particles that __belongs to the process' region__.
-                mpi_send(particles[dest], sizes[dest], mpi_particle_type, dest, 0, MPI_COMM_WORLD);
+                // Now we can send the array of particles.
+                mpi_send(buf, count, mpi_particle_type, dest, 0, compute_comm);
+                benchmark.current.counters[COUNTER_MIGRATED_PARTICLES] += count;
+                if (n != 1) free(buf);
             }
         } else {
-            /// Not my turn: Receive from other regions in order.
+            /// Not my turn: Receive from other processes in order.
 
             // First receive the size of the subarray we are going to receive.
-            int subarray_recv_size;
-            mpi_recv(&subarray_recv_size, 1, MPI_INT, region, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            LL_MPI2("About to receive %d particles from process %d.", subarray_recv_size, region);
-
-            // Receive the particles from the other process that __belongs to my process' region__.
-            mpi_recv(&final_particles[my_region][receive_offset], subarray_recv_size, mpi_particle_type, region, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            // Increment the size received so far.
-            receive_offset += subarray_recv_size;
+            mpi_recv(&count, 1, MPI_INT, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+            LL_MPI2("About to receive %d particles from process %d.", count, proc);
+
+            // Receive the particles from the other process that __belong to my process' regions__.
+            // If there is only a single region, we can receive directly into its array.
+            if (num_my_regions == 1) {
+                int region = my_regions[0];
+                mpi_recv(&final_particles[region][offsets[region]], count, mpi_particle_type, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+                offsets[region] += count;
+            } else {
+                Particle *buf = malloc(count * sizeof(Particle));
+                mpi_recv(buf, count, mpi_particle_type, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+                unpack_regions(count, buf, final_particles, offsets);
+                free(buf);
+            }
         }
     }
 
     // Debug logging.
-    print_particle_ids(LOG_LEVEL_MPI, "Final IDs for my region", total_sizes[my_region], final_particles[my_region]);
+    for (int i = 0; i < num_my_regions; i++)
+        print_particle_ids(LOG_LEVEL_MPI, "Final IDs for my region", total_sizes[my_regions[i]], final_particles[my_regions[i]]);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_MIGRATE, lap);
 
-    /// Step 3: Truncate the sizes for all regions except the one that received all particles from.
-    for (int region = 0; region < num_cores; region++) {
-        if (region != my_region)
+    /// Step 3: Truncate the sizes for all regions except the ones that received all particles from.
+    for (int region = 0; region < num_regions; region++) {
+        if (decomp.owners[region] != my_proc)
             sizes[region] = 0;
         else
             sizes[region] = total_sizes[region];
     }
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_TRUNCATE, lap);
 
     /// Step 4: Duplicate the final particles to other horizon processes which will need it.
+    if (shared_halos) publish_shared_regions(total_sizes, final_particles);
+
     for (int receiver = 0; receiver < num_cores; receiver++) {
         for (int sender = 0; sender < num_cores; sender++) {
             if (sender == receiver) continue;
-            if (my_region != sender && my_region != receiver) continue;
-
-            // Check the horizon distance between any two pairs of regions.
-            int horizon_dist = get_horizon_dist(spec.PoolLength, sender, receiver);
-            assert(horizon_dist >= 0);
-            if (horizon_dist > spec.Horizon) continue;
+            if (my_proc != sender && my_proc != receiver) continue;
+
+            // Find the regions of the sender within the horizon of any of the receiver's regions.
+            int n = get_halo_regions(sender, receiver, regions);
+            if (n == 0) continue;
+
+            // Processes on other nodes receive the particles through their node leaders instead.
+            if (hierarchical_halos && (node_ranks[sender] < 0 || node_ranks[receiver] < 0)) continue;
+
+            // Processes on the same node read the particles in place from the shared window instead.
+            if (shared_halos && node_ranks[sender] >= 0 && node_ranks[receiver] >= 0) {
+                if (receiver == my_proc) {
+                    attach_shared_regions(sender, n, regions, total_sizes, final_particles);
+                    for (int i = 0; i < n; i++) sizes[regions[i]] = total_sizes[regions[i]];
+                }
+                continue;
+            }
 
             // Send the particles.
-            if (sender == my_region) {
-                LL_MPI2("Sending %d particles to %d", sizes[my_region], receiver);
-                mpi_send(final_particles[my_region], sizes[my_region], mpi_particle_type, receiver, 0, MPI_COMM_WORLD);
-            } else if (receiver == my_region) {
-                LL_MPI2("Receiving %d particles from %d", total_sizes[my_region], sender);
-                mpi_recv(final_particles[sender], total_sizes[sender], mpi_particle_type, sender, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if (sender == my_proc) {
+                Particle *buf = pack_regions(n, regions, sizes, final_particles, &count);
+                LL_MPI2("Sending %d particles to %d", count, receiver);
+                mpi_send(buf, count, mpi_particle_type, receiver, 0, compute_comm);
+                if (n != 1) free(buf);
+            } else if (receiver == my_proc) {
+                if (n == 1) {
+                    LL_MPI2("Receiving %d particles from %d", total_sizes[regions[0]], sender);
+                    mpi_recv(final_particles[regions[0]], total_sizes[regions[0]], mpi_particle_type, sender, 0, compute_comm, MPI_STATUS_IGNORE);
+                } else {
+                    count = 0;
+                    for (int i = 0; i < n; i++) count += total_sizes[regions[i]];
+                    LL_MPI2("Receiving %d particles from %d", count, sender);
+
+                    Particle *buf = malloc(count * sizeof(Particle));
+                    mpi_recv(buf, count, mpi_particle_type, sender, 0, compute_comm, MPI_STATUS_IGNORE);
+                    unpack_regions(count, buf, final_particles, offsets);
+                    free(buf);
+                }
+
+                // Update the sizes as well.
+                for (int i = 0; i < n; i++) sizes[regions[i]] = total_sizes[regions[i]];
             }
-
-            // Update the size as well.
-            sizes[sender] = total_sizes[sender];
         }
     }
 
+    if (hierarchical_halos) exchange_node_halos(total_sizes, final_particles, offsets, sizes);
+    lap_benchmark_phase(&benchmark, PHASE_SYNC_HALO, lap);
+
     /// Complete!
 
     if (is_master()) LL_VERBOSE("Particle synchronisation is complete between %d processes.", num_cores);
-    print_ints(LOG_LEVEL_MPI, "Final region sizes for this process", num_cores, sizes);
-    print_particles(LOG_LEVEL_MPI, "Particles in my region after synchronisation", sizes[my_region], final_particles[my_region]);
+    print_ints(LOG_LEVEL_MPI, "Final region sizes for this process", num_regions, sizes);
+    for (int i = 0; i < num_my_regions; i++)
+        print_particles(LOG_LEVEL_MPI, "Particles in my region after synchronisation", sizes[my_regions[i]], final_particles[my_regions[i]]);
 
     // Free unused buffers.
+    free(regions);
+    free(offsets);
     free(total_sizes);
-    deallocate_particles(particles, num_cores);
+    deallocate_particles(particles, num_regions);
+
+    return final_particles;
+}
+
+/**
+ * Synchronises particles with neighbouring processes only.
+ *
+ * Unlike sync_particles, no global collectives are used: particles can only migrate to
+ * adjacent regions within a single time step, and the size of each incoming array is
+ * determined by probing the message instead. As such, each process can proceed as soon
+ * as its neighbours have sent their particles for this time step.
+ *
+ * @param sizes         Sizes of array of particles to send, corresponding to each region.
+ * @param particles     2-D array of particles, indexed by region ID.
+ *                      This array should only contain the particles computed by this processor.
+ * @return              2-D array of particles, indexed by region ID.
+ *                      This array should contain the updated particles after synchronisation.
+ */
+Particle **sync_particles_neighbours(int *sizes, Particle **particles)
+{
+    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int *regions = malloc(num_regions * sizeof(int));
+    MPI_Status status;
+    int count;
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+    long long lap = wall_clock_time();
+
+    LL_MPI("%s", "Synchronising particles with neighbours...");
+
+    // Keep track of all non-blocking sends (and their buffers), which must complete before the send buffers are freed.
+    MPI_Request *requests = malloc(2 * num_cores * sizeof(MPI_Request));
+    Particle **send_bufs = calloc(2 * num_cores, sizeof(Particle *));
+    int num_requests = 0;
+
+    /// Step 1: Send the particles that moved into an adjacent region to the process computing for it.
+    for (int region = 0; region < num_regions; region++) {
+        // Particles which moved further than an adjacent region cannot be received by anyone.
+        int owner = decomp.owners[region];
+        if (owner == my_proc || migration_peers[owner] || sizes[region] == 0) continue;
+        LL_ERROR("%d particles moved into region %d, which is too far from the regions of process %d!", sizes[region], region, my_proc);
+        flush_log();
+        MPI_Abort(compute_comm, EXIT_FAILURE);
+    }
+
+    for (int dest = 0; dest < num_cores; dest++) {
+        if (!migration_peers[dest]) continue;
+
+        int n = get_owned_regions(decomp, dest, regions);
+        Particle *buf = pack_regions(n, regions, sizes, particles, &count);
+        if (n != 1) send_bufs[num_requests] = buf;
+
+        LL_MPI2("Sending %d migrated particles to %d", count, dest);
+        MPI_Isend(buf, count, mpi_particle_type, dest, TAG_MIGRATE, compute_comm, &requests[num_requests++]);
+        benchmark.current.counters[COUNTER_MIGRATED_PARTICLES] += count;
+    }
+
+    // Whatever this processor computed for its own regions, we can keep.
+    Particle **final_particles = calloc(num_regions, sizeof(Particle *));
+    int *final_sizes = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < num_my_regions; i++)
+        append_regions(sizes[my_regions[i]], particles[my_regions[i]], num_regions, final_particles, final_sizes);
+
+    // Receive the particles that moved into my regions from each adjacent process.
+    for (int source = 0; source < num_cores; source++) {
+        if (!migration_peers[source]) continue;
+
+        mpi_probe(source, TAG_MIGRATE, compute_comm, &status);
+        MPI_Get_count(&status, mpi_particle_type, &count);
+        LL_MPI2("Receiving %d migrated particles from %d", count, source);
+
+        Particle *buf = malloc(count * sizeof(Particle));
+        mpi_recv(buf, count, mpi_particle_type, source, TAG_MIGRATE, compute_comm, MPI_STATUS_IGNORE);
+        append_regions(count, buf, num_regions, final_particles, final_sizes);
+        free(buf);
+    }
+
+    for (int i = 0; i < num_my_regions; i++)
+        print_particle_ids(LOG_LEVEL_MPI, "Final IDs for my region", final_sizes[my_regions[i]], final_particles[my_regions[i]]);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_MIGRATE, lap);
+
+    /// Step 2: Truncate the sizes for all regions except my own.
+    memcpy(sizes, final_sizes, num_regions * sizeof(int));
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_TRUNCATE, lap);
+
+    /// Step 3: Duplicate the final particles to other horizon processes which will need it.
+    for (int receiver = 0; receiver < num_cores; receiver++) {
+        if (receiver == my_proc) continue;
+
+        int n = get_halo_regions(my_proc, receiver, regions);
+        if (n == 0) continue;
+
+        Particle *buf = pack_regions(n, regions, sizes, final_particles, &count);
+        if (n != 1) send_bufs[num_requests] = buf;
+
+        LL_MPI2("Sending %d particles to %d", count, receiver);
+        MPI_Isend(buf, count, mpi_particle_type, receiver, TAG_HALO, compute_comm, &requests[num_requests++]);
+    }
+
+    for (int sender = 0; sender < num_cores; sender++) {
+        if (sender == my_proc || get_halo_regions(sender, my_proc, regions) == 0) continue;
+
+        mpi_probe(sender, TAG_HALO, compute_comm, &status);
+        MPI_Get_count(&status, mpi_particle_type, &count);
+        LL_MPI2("Receiving %d particles from %d", count, sender);
+
+        Particle *buf = malloc(count * sizeof(Particle));
+        mpi_recv(buf, count, mpi_particle_type, sender, TAG_HALO, compute_comm, MPI_STATUS_IGNORE);
+        append_regions(count, buf, num_regions, final_particles, sizes);
+        free(buf);
+    }
+
+    /// Complete!
+    mpi_waitall(num_requests, requests, MPI_STATUSES_IGNORE);
+    lap_benchmark_phase(&benchmark, PHASE_SYNC_HALO, lap);
+
+    print_ints(LOG_LEVEL_MPI, "Final region sizes for this process", num_regions, sizes);
+    for (int i = 0; i < num_my_regions; i++)
+        print_particles(LOG_LEVEL_MPI, "Particles in my region after synchronisation", sizes[my_regions[i]], final_particles[my_regions[i]]);
+
+    // Free unused buffers.
+    for (int i = 0; i < num_requests; i++) free(send_bufs[i]);
+    free(send_bufs);
+    free(requests);
+    free(regions);
+    free(final_sizes);
+    deallocate_particles(particles, num_regions);
 
     return final_particles;
 }
 
+/**
+ * Synchronises the multipole summaries of all regions with all other processes.
+ * Assumes that particles are already distributed across processes into their own regions.
+ *
+ * This is a global reduction, even with NEIGHBOUR_SYNC: the far field needs the summaries of all regions
+ * within the horizon, which usually spans most processes, so a single reduction is cheaper than exchanging
+ * them over the neighbour topology.
+ */
+void sync_multipoles(int *sizes, Particle **particles_by_region)
+{
+    int num_regions = decomp.num_regions;
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+
+    // Only summarise the regions that this process is in charge of.
+    // Since moments are taken about the origin, summing up all summaries gives the summary for every region.
+    Multipole *my_multipoles = calloc(num_regions, sizeof(Multipole));
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        my_multipoles[region] = compute_multipole(spec, sizes[region], particles_by_region[region], region);
+    }
+    MPI_Allreduce(my_multipoles, multipoles, num_regions * MULTIPOLE_FIELD_COUNT, MPI_LONG_DOUBLE, MPI_SUM, compute_comm);
+    LL_MPI("%s", "Multipole summaries synchronised.");
+
+    free(my_multipoles);
+}
+
+/**
+ * Marks the regions within the near horizon of the given region, whose particles exert a force on its particles,
+ * and the regions beyond it (but within the horizon), whose multipole summaries are used instead.
+ * Returns the number of particles in the near regions.
+ */
+long long mark_horizon_regions(int *sizes, int region_id)
+{
+    long long total = 0;
+    for (int region = 0; region < decomp.num_regions; region++) {
+        int dist = get_spec_region_dist(spec, decomp, region, region_id);
+        near_regions[region] = dist <= get_halo_horizon();
+        far_regions[region] = !near_regions[region] && dist <= spec.Horizon;
+        if (near_regions[region]) total += sizes[region];
+    }
+
+    return total;
+}
+
+/**
+ * Counts the particles and the pairs of particles whose collisions are checked in this time step,
+ * from the sizes of all regions after synchronisation.
+ */
+void count_interactions(int *sizes)
+{
+    long long *counters = benchmark.current.counters;
+    long long total = 0;
+    for (int region = 0; region < decomp.num_regions; region++) total += sizes[region];
+
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        long long size = sizes[region];
+        counters[COUNTER_PARTICLES] += size;
+
+        // Collisions are checked once per pair within the region, and are not checked against
+        // lower regions that this process computes, which have checked them already.
+        long long others = total - size;
+        for (int j = 0; j < num_my_regions; j++) others -= my_regions[j] < region ? sizes[my_regions[j]] : 0;
+        counters[COUNTER_COLLISION_CHECKS] += size * (size - 1) / 2 + size * others;
+    }
+    counters[COUNTER_HALO_PARTICLES] = total - counters[COUNTER_PARTICLES];
+}
+
 /**
  * Runs a single time step.
  */
 Particle **execute_time_step(int *sizes, Particle **particles_by_region)
 {
-    int num_cores = get_num_cores();
-    int region_id = get_process_id();
+    int num_regions = decomp.num_regions;
     long double dt = spec.TimeStep;
-
-    // Compute the new velocities for all particles in the region that this process is computing for,
-    // taking particles in other regions as part of the computation.
-    update_velocity(dt, spec, sizes, particles_by_region, num_cores, region_id);
+    long long start;
+    BENCHMARK_SCOPE(&benchmark, PHASE_COMPUTE);
+    long long lap = wall_clock_time();
+    count_interactions(sizes);
+
+    // Compute the new velocities for all particles in the regions that this process is computing for,
+    // taking particles in other regions within the horizon (of each region) as part of the computation.
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        start = wall_clock_time();
+        long long near_total = mark_horizon_regions(sizes, region);
+        benchmark.current.counters[COUNTER_GRAVITY_INTERACTIONS] += sizes[region] * (near_total - 1);
+        update_velocity(dt, spec, sizes, particles_by_region, num_regions, region, near_regions);
+
+        // Compute the far-field velocities using the summaries of regions beyond the near horizon.
+        if (multipole_horizon >= 0)
+            update_velocity_multipole(dt, spec, sizes[region], particles_by_region[region], region, multipoles, num_regions, far_regions);
+        region_costs[region] += wall_clock_time() - start;
+    }
+    lap = lap_benchmark_phase(&benchmark, PHASE_VELOCITY, lap);
 
     // Handle collisions for all particles, updating the velocity (direction) if necessary.
-    handle_collisions(spec, sizes, particles_by_region, num_cores, region_id);
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        start = wall_clock_time();
+        benchmark.current.counters[COUNTER_COLLISIONS] += handle_collisions(spec, sizes, particles_by_region, num_regions, region, my_region_flags);
+        region_costs[region] += wall_clock_time() - start;
+    }
+    lap = lap_benchmark_phase(&benchmark, PHASE_COLLISIONS, lap);
 
     // Handle collisions of particles against the walls of the pool.
-    handle_wall_collisions(spec, sizes[region_id], particles_by_region[region_id], region_id);
+    for (int i = 0; i < num_my_regions; i++)
+        benchmark.current.counters[COUNTER_WALL_COLLISIONS] += handle_wall_collisions(spec, sizes[my_regions[i]], particles_by_region[my_regions[i]], my_regions[i]);
+    lap = lap_benchmark_phase(&benchmark, PHASE_WALLS, lap);
 
-    // Update the position for all particles in the region that this process is computing for.
-    update_position(dt, spec, sizes[region_id], particles_by_region[region_id], region_id);
+    // Update the position for all particles in the regions that this process is computing for.
+    for (int i = 0; i < num_my_regions; i++)
+        update_position(dt, spec, sizes[my_regions[i]], particles_by_region[my_regions[i]], my_regions[i]);
+    lap = lap_benchmark_phase(&benchmark, PHASE_POSITION, lap);
 
     // Reallocate the particles in their correct regions in the 2-D array.
-    Particle **updated_particles = reallocate_for_region(spec, sizes, sizes[region_id], particles_by_region[region_id], num_cores);
-    deallocate_particles(particles_by_region, num_cores);
+    int *updated_sizes = calloc(num_regions, sizeof(int));
+    Particle **updated_particles = reallocate_for_regions(spec, updated_sizes, num_my_regions, my_regions, sizes, particles_by_region, num_regions);
+    memcpy(sizes, updated_sizes, num_regions * sizeof(int));
+    detach_shared_regions(particles_by_region);
+    deallocate_particles(particles_by_region, num_regions);
+    free(updated_sizes);
+    lap_benchmark_phase(&benchmark, PHASE_REALLOCATE, lap);
 
     return updated_particles;
 }
 
+/**
+ * Reassigns regions to processes according to their computation time since the last rebalancing.
+ * The particles of each region are only migrated to their new process during the next synchronisation.
+ */
+void rebalance()
+{
+    int num_regions = decomp.num_regions;
+
+    // Each region is only computed by a single process, so the sum is the cost of each region.
+    long long *costs = malloc(num_regions * sizeof(long long));
+    MPI_Allreduce(region_costs, costs, num_regions, MPI_LONG_LONG_INT, MPI_SUM, compute_comm);
+
+    // All processes will compute the same assignment from the same costs.
+    int moved = orb_decomposition ? rebalance_regions_orb(spec, &decomp, costs) : rebalance_regions(spec, &decomp, costs);
+    update_assignment();
+    memset(region_costs, 0, num_regions * sizeof(long long));
+    if (moved > 0) reassigned = 1;
+
+    if (is_master()) LL_VERBOSE("Rebalanced regions; %d region(s) were reassigned to a different process.", moved);
+    LL_VERBOSE2("Process %d is now computing %d region(s).", get_process_id(), num_my_regions);
+
+    free(costs);
+}
+
+/**
+ * Reassigns the blocks of the process grid to processes according to the region order,
+ * so that neighbouring blocks are assigned to processes on the same node.
+ */
+void reorder_blocks()
+{
+    int *block_ranks = malloc(decomp.num_procs * sizeof(int));
+    if (region_order == REGION_ORDER_HILBERT)
+        get_hilbert_block_ranks(decomp, block_ranks);
+    else
+        mpi_get_cart_block_ranks(decomp.procs_x, decomp.procs_y, block_ranks);
+
+    order_blocks(spec, &decomp, block_ranks);
+    if (is_master()) print_ints(LOG_LEVEL_VERBOSE, "Process assigned to each block", decomp.num_procs, decomp.block_ranks);
+
+    free(block_ranks);
+}
+
+/**
+ * Reassigns regions to processes using orthogonal recursive bisection, according to the number
+ * of particles in each region. Used to find the initial assignment before any costs are measured.
+ */
+void bisect_initial_regions(int *sizes)
+{
+    int num_regions = decomp.num_regions;
+
+    // Particles generated by each process may lie in any region, so sum them up across all processes.
+    int *counts = malloc(num_regions * sizeof(int));
+    long long *costs = malloc(num_regions * sizeof(long long));
+    MPI_Allreduce(sizes, counts, num_regions, MPI_INT, MPI_SUM, compute_comm);
+    for (int region = 0; region < num_regions; region++) costs[region] = counts[region];
+
+    int moved = rebalance_regions_orb(spec, &decomp, costs);
+    update_assignment();
+    if (moved > 0) reassigned = 1;
+
+    if (is_master()) LL_VERBOSE("Bisected regions by particle count; %d region(s) were reassigned to a different process.", moved);
+
+    free(counts);
+    free(costs);
+}
+
 /**
  * Collates timings for all processes, calculates the average
  * and generates a report.
@@ -220,22 +1087,30 @@ void collate_timings(char *reportfile)
     long long all_comm_sum, all_comp_sum, all_comm_max, all_comp_max, all_comm_min, all_comp_min;
 
     // Get the sum, max and min of the total communication and computation time for all processes.
-    MPI_Reduce(&comm_sum, &all_comm_sum, 1, MPI_LONG_LONG_INT, MPI_SUM, MASTER_ID, MPI_COMM_WORLD);
-    MPI_Reduce(&comm_sum, &all_comm_max, 1, MPI_LONG_LONG_INT, MPI_MAX, MASTER_ID, MPI_COMM_WORLD);
-    MPI_Reduce(&comm_sum, &all_comm_min, 1, MPI_LONG_LONG_INT, MPI_MIN, MASTER_ID, MPI_COMM_WORLD);
-    MPI_Reduce(&comp_sum, &all_comp_sum, 1, MPI_LONG_LONG_INT, MPI_SUM, MASTER_ID, MPI_COMM_WORLD);
-    MPI_Reduce(&comp_sum, &all_comp_max, 1, MPI_LONG_LONG_INT, MPI_MAX, MASTER_ID, MPI_COMM_WORLD);
-    MPI_Reduce(&comp_sum, &all_comp_min, 1, MPI_LONG_LONG_INT, MPI_MIN, MASTER_ID, MPI_COMM_WORLD);
+    MPI_Reduce(&comm_sum, &all_comm_sum, 1, MPI_LONG_LONG_INT, MPI_SUM, MASTER_ID, compute_comm);
+    MPI_Reduce(&comm_sum, &all_comm_max, 1, MPI_LONG_LONG_INT, MPI_MAX, MASTER_ID, compute_comm);
+    MPI_Reduce(&comm_sum, &all_comm_min, 1, MPI_LONG_LONG_INT, MPI_MIN, MASTER_ID, compute_comm);
+    MPI_Reduce(&comp_sum, &all_comp_sum, 1, MPI_LONG_LONG_INT, MPI_SUM, MASTER_ID, compute_comm);
+    MPI_Reduce(&comp_sum, &all_comp_max, 1, MPI_LONG_LONG_INT, MPI_MAX, MASTER_ID, compute_comm);
+    MPI_Reduce(&comp_sum, &all_comp_min, 1, MPI_LONG_LONG_INT, MPI_MIN, MASTER_ID, compute_comm);
+
+    // Summarise the time of each phase over all time slots.
+    BenchmarkSummary summaries[NUM_BENCHMARK_PHASES];
+    summarise_benchmark(compute_comm, &benchmark, summaries);
+    char p50[TIMEBUF_LENGTH], p90[TIMEBUF_LENGTH], p99[TIMEBUF_LENGTH], max[TIMEBUF_LENGTH];
 
     // Print the report on the master process.
     if (is_master()) {
         LL_SUCCESS("%s", "============================");
         LL_SUCCESS("%s", "    Pool Simulator Report   ");
         LL_SUCCESS("%s", "============================");
-        LL_SUCCESS("Number of regions:    %d", get_num_cores());
+        LL_SUCCESS("Number of regions:    %d", decomp.pool_length * decomp.pool_length);
+        if (decomp.sub_regions > 1) LL_SUCCESS("Sub-regions:          %d", decomp.num_regions);
         LL_SUCCESS("Number of iterations: %d", spec.TimeSlots);
         LL_SUCCESS("Particles per region: %d", spec.TotalNumberOfParticles);
-        LL_SUCCESS("Horizon:              %d", spec.Horizon);
+        LL_SUCCESS("Horizon:              %d", decomp.horizon);
+        if (multipole_horizon >= 0) LL_SUCCESS("Multipole horizon:    %d", multipole_horizon);
+        if (region_order != REGION_ORDER_ROW_MAJOR) LL_SUCCESS("Region order:         %s", region_order_names[region_order]);
         LL_SUCCESS("%s", "============================");
         LL_SUCCESS("%s", "Communication time:");
         format_time(timebuf, TIMEBUF_LENGTH, all_comm_sum);
@@ -257,6 +1132,16 @@ void collate_timings(char *reportfile)
         format_time(timebuf, TIMEBUF_LENGTH, all_comp_min);
         LL_SUCCESS("+ Min: %s seconds", timebuf);
         LL_SUCCESS("%s", "============================");
+        LL_SUCCESS("%s", "Phase time per iteration (slowest process, in seconds) and imbalance (max / mean):");
+        LL_SUCCESS("%-14s %10s %10s %10s %10s %9s", "Phase", "p50", "p90", "p99", "Max", "Imbalance");
+        for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) {
+            format_time(p50, TIMEBUF_LENGTH, summaries[p].p50);
+            format_time(p90, TIMEBUF_LENGTH, summaries[p].p90);
+            format_time(p99, TIMEBUF_LENGTH, summaries[p].p99);
+            format_time(max, TIMEBUF_LENGTH, summaries[p].max);
+            LL_SUCCESS("%-14s %10s %10s %10s %10s %9.2f", benchmark_phase_names[p], p50, p90, p99, max, summaries[p].imbalance);
+        }
+        LL_SUCCESS("%s", "============================");
 
         // Write the report to a file if filename was specified.
         if (reportfile != NULL) {
@@ -269,10 +1154,13 @@ void collate_timings(char *reportfile)
             fprintf(fp, "%s\n", "============================");
             fprintf(fp, "%s\n", "    Pool Simulator Report   ");
             fprintf(fp, "%s\n", "============================");
-            fprintf(fp, "Number of regions:    %d\n", get_num_cores());
+            fprintf(fp, "Number of regions:    %d\n", decomp.pool_length * decomp.pool_length);
+            if (decomp.sub_regions > 1) fprintf(fp, "Sub-regions:          %d\n", decomp.num_regions);
             fprintf(fp, "Number of iterations: %d\n", spec.TimeSlots);
             fprintf(fp, "Particles per region: %d\n", spec.TotalNumberOfParticles);
-            fprintf(fp, "Horizon:              %d\n", spec.Horizon);
+            fprintf(fp, "Horizon:              %d\n", decomp.horizon);
+            if (multipole_horizon >= 0) fprintf(fp, "Multipole horizon:    %d\n", multipole_horizon);
+            if (region_order != REGION_ORDER_ROW_MAJOR) fprintf(fp, "Region order:         %s\n", region_order_names[region_order]);
             fprintf(fp, "%s\n", "============================");
             fprintf(fp, "%s\n", "Communication time:");
             format_time(timebuf, TIMEBUF_LENGTH, all_comm_sum);
@@ -294,6 +1182,16 @@ void collate_timings(char *reportfile)
             format_time(timebuf, TIMEBUF_LENGTH, all_comp_min);
             fprintf(fp, "+ Min: %s seconds\n", timebuf);
             fprintf(fp, "%s\n", "============================");
+            fprintf(fp, "%s\n", "Phase time per iteration (slowest process, in seconds) and imbalance (max / mean):");
+            fprintf(fp, "%-14s %10s %10s %10s %10s %9s\n", "Phase", "p50", "p90", "p99", "Max", "Imbalance");
+            for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) {
+                format_time(p50, TIMEBUF_LENGTH, summaries[p].p50);
+                format_time(p90, TIMEBUF_LENGTH, summaries[p].p90);
+                format_time(p99, TIMEBUF_LENGTH, summaries[p].p99);
+                format_time(max, TIMEBUF_LENGTH, summaries[p].max);
+                fprintf(fp, "%-14s %10s %10s %10s %10s %9.2f\n", benchmark_phase_names[p], p50, p90, p99, max, summaries[p].imbalance);
+            }
+            fprintf(fp, "%s\n", "============================");
 
             LL_SUCCESS("Pool simulator report was saved to %s.", reportfile);
 
@@ -303,71 +1201,344 @@ void collate_timings(char *reportfile)
 }
 
 /**
- * Generates and collates canvases from all processes into the
- * master process, so that we can generate a PPM heatmap.
- * 
- * Assumes that particles are already distributed across processes
- * into their own regions already.
+ * Gathers the tiles of all processes on the master process, which merges them into a canvas
+ * of the entire pool. Other processes get an empty canvas.
  */
-void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *outputfile)
+Canvas gather_canvas(Canvas *tiles)
 {
     int num_cores = get_num_cores();
-    int region_id = get_process_id();
     int canvas_length = spec.GridSize * spec.PoolLength;
 
-    // Bail early if we have no output filename.
-    if (outputfile == NULL) return;
+    // Pack the tiles into a single buffer.
+    int count = 0;
+    for (int i = 0; i < num_my_regions; i++) count += pack_canvas_rows(tiles[i], 0, canvas_length, NULL);
+    int *buf = malloc(count * sizeof(int));
+    for (int i = 0, offset = 0; i < num_my_regions; i++) offset += pack_canvas_rows(tiles[i], 0, canvas_length, &buf[offset]);
+
+    // Gather the tiles of all processes on the master process.
+    int *counts = NULL, *displs = NULL, *all_tiles = NULL, total = 0;
+    if (is_master()) {
+        counts = malloc(num_cores * sizeof(int));
+        displs = malloc(num_cores * sizeof(int));
+    }
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, MASTER_ID, compute_comm);
+    if (is_master()) {
+        for (int proc = 0; proc < num_cores; proc++) {
+            displs[proc] = total;
+            total += counts[proc];
+        }
+        all_tiles = malloc(total * sizeof(int));
+    }
+    MPI_Gatherv(buf, count, MPI_INT, all_tiles, counts, displs, MPI_INT, MASTER_ID, compute_comm);
+
+    // Merge the tiles into a canvas of the entire pool, combining their overlapping margins.
+    Canvas canvas = { 0 };
+    if (is_master()) {
+        LL_VERBOSE("%s", "All canvases sent to master!");
+        canvas = allocate_canvas(0, 0, canvas_length, canvas_length);
+        merge_packed_canvases(canvas, total, all_tiles);
+    }
+
+    // Free memory.
+    free(buf);
+    free(counts);
+    free(displs);
+    free(all_tiles);
+
+    return canvas;
+}
+
+/**
+ * Writes a binary (P6) heatmap in parallel with MPI-IO.
+ *
+ * The rows of the image are split into equal bands, one per process. The rows of each tile are
+ * sent to the processes whose bands they overlap, so that each process can merge and encode
+ * its own band, and write it directly into the shared file after the header.
+ */
+void write_binary_heatmap(Canvas *tiles, char *outputfile)
+{
+    int num_cores = get_num_cores();
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    int my_proc = get_process_id();
+    int y0 = (long long)canvas_length * my_proc / num_cores;
+    int y1 = (long long)canvas_length * (my_proc + 1) / num_cores;
+
+    // Pack the rows of each tile for the band of each process.
+    int *send_counts = calloc(num_cores, sizeof(int));
+    int *send_displs = malloc(num_cores * sizeof(int));
+    int *recv_counts = malloc(num_cores * sizeof(int));
+    int *recv_displs = malloc(num_cores * sizeof(int));
+    int send_total = 0, recv_total = 0;
+    for (int proc = 0; proc < num_cores; proc++) {
+        int band_y0 = (long long)canvas_length * proc / num_cores;
+        int band_y1 = (long long)canvas_length * (proc + 1) / num_cores;
+        for (int i = 0; i < num_my_regions; i++) send_counts[proc] += pack_canvas_rows(tiles[i], band_y0, band_y1, NULL);
+        send_displs[proc] = send_total;
+        send_total += send_counts[proc];
+    }
+
+    int *send_buf = malloc(send_total * sizeof(int));
+    for (int proc = 0; proc < num_cores; proc++) {
+        int band_y0 = (long long)canvas_length * proc / num_cores;
+        int band_y1 = (long long)canvas_length * (proc + 1) / num_cores;
+        for (int i = 0, offset = send_displs[proc]; i < num_my_regions; i++)
+            offset += pack_canvas_rows(tiles[i], band_y0, band_y1, &send_buf[offset]);
+    }
+
+    // Exchange the rows of the tiles, so that each process receives all rows within its band.
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, compute_comm);
+    for (int proc = 0; proc < num_cores; proc++) {
+        recv_displs[proc] = recv_total;
+        recv_total += recv_counts[proc];
+    }
+    int *recv_buf = malloc(recv_total * sizeof(int));
+    MPI_Alltoallv(send_buf, send_counts, send_displs, MPI_INT, recv_buf, recv_counts, recv_displs, MPI_INT, compute_comm);
+
+    // Merge and encode the band.
+    Canvas band = allocate_canvas(0, y0, canvas_length, y1 - y0);
+    merge_packed_canvases(band, recv_total, recv_buf);
+    unsigned char *pixels = malloc(3 * (size_t)band.width * band.height);
+    encode_pixels(band, 0, band.height, pixels);
+
+    // Write the header on the master process, and the band of each process after it.
+    char header[64];
+    int header_length = format_binary_header(header, canvas_length, canvas_length);
+    // The open may only fail on some processes, which must not leave the others waiting in the collective writes.
+    MPI_File fh;
+    if (MPI_File_open(compute_comm, outputfile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        LL_ERROR("Could not open %s for writing!", outputfile);
+        flush_log();
+        MPI_Abort(compute_comm, EXIT_FAILURE);
+    }
+    MPI_File_set_size(fh, header_length + 3 * (MPI_Offset)canvas_length * canvas_length);
+    if (is_master()) MPI_File_write_at(fh, 0, header, header_length, MPI_CHAR, MPI_STATUS_IGNORE);
+
+    // Write the band as a count of rows, since the number of bytes of a band can overflow an int on large canvases.
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(3 * canvas_length, MPI_UNSIGNED_CHAR, &row_type);
+    MPI_Type_commit(&row_type);
+    MPI_Offset offset = header_length + 3 * (MPI_Offset)canvas_length * y0;
+    MPI_File_write_at_all(fh, offset, pixels, band.height, row_type, MPI_STATUS_IGNORE);
+    MPI_Type_free(&row_type);
+    MPI_File_close(&fh);
+
+    if (is_master()) LL_SUCCESS("Successfully written image to %s.", outputfile);
+
+    // Free memory.
+    free_canvas(band);
+    free(pixels);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(send_buf);
+    free(recv_buf);
+}
+
+/**
+ * Returns the process in charge of a tile of the pyramid, which is the owner of the region at the centre
+ * of its top-left tile at full resolution, so that most tiles are built from the regions of the same process.
+ */
+int get_pyramid_tile_owner(int level, int tx, int ty)
+{
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    int x = fmin(canvas_length - 1, (tx << level) * PYRAMID_TILE_SIZE + PYRAMID_TILE_SIZE / 2);
+    int y = fmin(canvas_length - 1, (ty << level) * PYRAMID_TILE_SIZE + PYRAMID_TILE_SIZE / 2);
+
+    return decomp.owners[get_denorm_region(x, y, spec)];
+}
 
-    // Allocate space for a 3-D array.
-    int ***collated = malloc(num_cores * sizeof(int **));
-    for (int region = 0; region < num_cores; region++) {
-        collated[region] = malloc(canvas_length * sizeof(int *));
-        for (int y = 0; y < canvas_length; y++)
-            collated[region][y] = malloc(canvas_length * sizeof(int));
-    }
-
-    // Generate canvas in the region that this process is in charge of.
-    print_particles(LOG_LEVEL_DEBUG, "Generating canvas for my region", sizes[region_id], particles_by_region[region_id]);
-    int **canvas = generate_region_canvas(spec, sizes[region_id], particles_by_region[region_id], region_id);
-    LL_VERBOSE("Canvas generated for region %d.", region_id);
-
-    // Copy canvas for the master region first.
-    if (is_master())
-        for (int i = 0; i < canvas_length; i++)
-            for (int j = 0; j < canvas_length; j++)
-                collated[region_id][i][j] = canvas[i][j];
-
-    // Send all canvases to the master process.
-    for (int region = 0; region < num_cores; region++) {
-        // Send each row of the canvas separately.
-        for (int y = 0; y < canvas_length; y++) {
-            // Don't send/receive to/from self.
-            if (is_master() && region == MASTER_ID) continue;
-
-            // Only the P-th process should be sending to master.
-            if (region == region_id)
-                mpi_send(canvas[y], canvas_length, MPI_INT, MASTER_ID, 0, MPI_COMM_WORLD);
-
-            // Handle receiving from P processes.
-            if (is_master())
-                mpi_recv(collated[region][y], canvas_length, MPI_INT, region, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+/**
+ * Clips a canvas to the tiles of a level of the pyramid that it overlaps, and packs each part for the
+ * process in charge of its tile. If buf is NULL, the number of ints for each process is added to counts.
+ * Otherwise, each part is packed at the offset of its process, which is advanced past it.
+ */
+void pack_pyramid_parts(Canvas canvas, int level, int *counts, int *offsets, int *buf)
+{
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    int max_tile = get_pyramid_tiles(canvas_length, level) - 1;
+    if (canvas.width <= 0 || canvas.height <= 0) return;
+
+    for (int ty = canvas.y / PYRAMID_TILE_SIZE; ty <= fmin(max_tile, (canvas.y + canvas.height - 1) / PYRAMID_TILE_SIZE); ty++) {
+        for (int tx = canvas.x / PYRAMID_TILE_SIZE; tx <= fmin(max_tile, (canvas.x + canvas.width - 1) / PYRAMID_TILE_SIZE); tx++) {
+            int owner = get_pyramid_tile_owner(level, tx, ty);
+            int x0 = tx * PYRAMID_TILE_SIZE;
+            int y0 = ty * PYRAMID_TILE_SIZE;
+            if (buf == NULL)
+                counts[owner] += pack_canvas_rect(canvas, x0, y0, x0 + PYRAMID_TILE_SIZE, y0 + PYRAMID_TILE_SIZE, NULL);
+            else
+                offsets[owner] += pack_canvas_rect(canvas, x0, y0, x0 + PYRAMID_TILE_SIZE, y0 + PYRAMID_TILE_SIZE, &buf[offsets[owner]]);
         }
     }
+}
+
+/**
+ * Writes a tiled zoom pyramid of the heatmap in parallel.
+ *
+ * Each tile of each level is built and written by a single process. At the first level, the tiles of each
+ * region are clipped to the pyramid tiles, and sent to the process in charge of each pyramid tile. Each
+ * downsampled level is then built by reduction: each process downsamples its own tiles of the level
+ * below, and sends them to the process in charge of the tile that covers them, which is usually itself.
+ */
+void write_pyramid(Canvas *tiles, char *outputdir)
+{
+    int num_cores = get_num_cores();
+    int my_proc = get_process_id();
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    int levels = get_pyramid_levels(canvas_length);
+
+    if (is_master()) create_pyramid(outputdir, canvas_length);
+    MPI_Barrier(compute_comm);
+
+    // Canvases to be sent to the processes in charge of the tiles of each level.
+    Canvas *sources = tiles;
+    int num_sources = num_my_regions;
+
+    int *send_counts = malloc(num_cores * sizeof(int));
+    int *send_displs = malloc(num_cores * sizeof(int));
+    int *recv_counts = malloc(num_cores * sizeof(int));
+    int *recv_displs = malloc(num_cores * sizeof(int));
+    int *offsets = malloc(num_cores * sizeof(int));
+
+    for (int level = 0; level < levels; level++) {
+        int num_tiles = get_pyramid_tiles(canvas_length, level);
+
+        // Pack the parts of each canvas for the process in charge of each tile.
+        int send_total = 0, recv_total = 0;
+        memset(send_counts, 0, num_cores * sizeof(int));
+        for (int i = 0; i < num_sources; i++) pack_pyramid_parts(sources[i], level, send_counts, NULL, NULL);
+        for (int proc = 0; proc < num_cores; proc++) {
+            send_displs[proc] = offsets[proc] = send_total;
+            send_total += send_counts[proc];
+        }
+        int *send_buf = malloc(send_total * sizeof(int));
+        for (int i = 0; i < num_sources; i++) pack_pyramid_parts(sources[i], level, NULL, offsets, send_buf);
+
+        // Exchange the parts, so that each process receives all parts of its tiles.
+        MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, compute_comm);
+        for (int proc = 0; proc < num_cores; proc++) {
+            recv_displs[proc] = recv_total;
+            recv_total += recv_counts[proc];
+        }
+        int *recv_buf = malloc(recv_total * sizeof(int));
+        MPI_Alltoallv(send_buf, send_counts, send_displs, MPI_INT, recv_buf, recv_counts, recv_displs, MPI_INT, compute_comm);
 
-    if (is_master()) LL_VERBOSE("%s", "All canvases sent to master!");
+        if (level > 0) {
+            for (int i = 0; i < num_sources; i++) free_canvas(sources[i]);
+            free(sources);
+        }
 
-    // Generate the heatmap.
-    if (is_master()) generate_heatmap(spec, num_cores, collated, outputfile);
+        // Merge the parts of each of my tiles, write them, and downsample them for the next level.
+        sources = malloc(num_tiles * num_tiles * sizeof(Canvas));
+        num_sources = 0;
+        for (int ty = 0; ty < num_tiles; ty++) {
+            for (int tx = 0; tx < num_tiles; tx++) {
+                if (get_pyramid_tile_owner(level, tx, ty) != my_proc) continue;
+
+                Canvas tile = allocate_pyramid_tile(canvas_length, level, tx, ty);
+                merge_packed_canvases(tile, recv_total, recv_buf);
+                write_pyramid_tile(outputdir, level, tx, ty, tile);
+                if (level + 1 < levels) sources[num_sources++] = downsample_canvas(tile);
+                free_canvas(tile);
+            }
+        }
+
+        free(send_buf);
+        free(recv_buf);
+    }
+
+    MPI_Barrier(compute_comm);
+    if (is_master()) LL_SUCCESS("Successfully written %d level(s) of tiles to %s.", levels, outputdir);
 
     // Free memory.
-    for (int region = 0; region < num_cores; region++) {
-        for (int y = 0; y < canvas_length; y++)
-            free(collated[region][y]);
-        free(collated[region]);
+    free(sources);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(offsets);
+}
+
+/**
+ * Generates a tile for each region that this process is in charge of, including a margin for particles
+ * that are drawn over the edges of the region.
+ */
+Canvas *generate_tiles(int *sizes, Particle **particles_by_region)
+{
+    int margin = get_canvas_margin(spec);
+    Canvas *tiles = malloc(num_my_regions * sizeof(Canvas));
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        print_particles(LOG_LEVEL_DEBUG, "Generating canvas for my region", sizes[region], particles_by_region[region]);
+        tiles[i] = generate_region_canvas(spec, sizes[region], particles_by_region[region], region, margin);
+        LL_VERBOSE("Canvas generated for region %d.", region);
+    }
+
+    return tiles;
+}
+
+/**
+ * Updates the persistent tile of each region that this process is in charge of for a debug frame,
+ * and frees the tiles of regions that have been reassigned to other processes.
+ * Returns the tiles in the same order as my_regions, which are still owned by region_canvases.
+ */
+Canvas *update_region_canvases(int *sizes, Particle **particles_by_region)
+{
+    int margin = get_canvas_margin(spec);
+    if (region_canvases == NULL) region_canvases = calloc(decomp.num_regions, sizeof(IncrementalCanvas));
+
+    for (int region = 0; region < decomp.num_regions; region++) {
+        IncrementalCanvas *ic = &region_canvases[region];
+        if (decomp.owners[region] != get_process_id()) {
+            if (ic->canvas.cells != NULL) free_incremental_canvas(*ic);
+            *ic = (IncrementalCanvas){ 0 };
+            continue;
+        }
+
+        if (ic->canvas.cells == NULL) *ic = allocate_incremental_canvas(allocate_region_canvas(spec, region, margin));
+        update_incremental_canvas(spec, ic, sizes[region], particles_by_region[region]);
+    }
+
+    Canvas *tiles = malloc(num_my_regions * sizeof(Canvas));
+    for (int i = 0; i < num_my_regions; i++) tiles[i] = region_canvases[my_regions[i]].canvas;
+
+    return tiles;
+}
+
+/**
+ * Frees the tiles of this process.
+ */
+void free_tiles(Canvas *tiles)
+{
+    for (int i = 0; i < num_my_regions; i++) free_canvas(tiles[i]);
+    free(tiles);
+}
+
+/**
+ * Generates and collates canvases from all processes into the
+ * master process, so that we can generate a PPM heatmap.
+ * 
+ * Assumes that particles are already distributed across processes
+ * into their own regions already.
+ */
+void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *outputfile, OutputFormat format)
+{
+    // Bail early if we have no output filename.
+    if (outputfile == NULL) return;
+
+    Canvas *tiles = generate_tiles(sizes, particles_by_region);
+
+    if (format == OUTPUT_FORMAT_P6) {
+        write_binary_heatmap(tiles, outputfile);
+    } else if (format == OUTPUT_FORMAT_TILES) {
+        write_pyramid(tiles, outputfile);
+    } else {
+        Canvas canvas = gather_canvas(tiles);
+        if (is_master()) generate_heatmap(canvas, outputfile);
+        free_canvas(canvas);
     }
 
-    free(collated);
-    free(canvas);
+    free_tiles(tiles);
 }
 
 /**
@@ -377,40 +1548,280 @@ void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *
  */
 void generate_debug_frame(int frame_id, int *sizes, Particle **particles, char *framesdir)
 {
-    int outputdir_len = strlen(framesdir);
-    char *outputfile = malloc(outputdir_len + 20);
-    sprintf(outputfile, "%s/%d.ppm", framesdir, frame_id);
+    // Append the frame to the frame stream on the master process.
+    // Only redraw the particles that have moved since the last frame.
+    Canvas *tiles = update_region_canvases(sizes, particles);
+    Canvas canvas = gather_canvas(tiles);
+
+    if (is_master() && frame_format == FRAME_FORMAT_STREAM) {
+        write_frame_stream(frame_stream, frame_id, canvas);
+    } else if (is_master()) {
+        char *outputfile = malloc(strlen(framesdir) + 20);
+        sprintf(outputfile, "%s/%d.ppm", framesdir, frame_id);
+        generate_heatmap(canvas, outputfile);
+        free(outputfile);
+    }
 
-    FILE *fp = fopen(outputfile, "w");
-    if (fp == NULL) {
-        LL_ERROR("Could not open %s for writing debug frame to!", outputfile);
-        exit(EXIT_FAILURE);
+    free_canvas(canvas);
+    free(tiles);
+}
+
+/**
+ * Opens the frame stream in the frames directory.
+ */
+void open_debug_frame_stream(char *framesdir)
+{
+    char *outputfile = malloc(strlen(framesdir) + 20);
+    sprintf(outputfile, "%s/frames.bin", framesdir);
+    frame_stream = open_frame_stream(outputfile, spec.GridSize * spec.PoolLength, frame_downsample, frame_decimation);
+    free(outputfile);
+}
+
+/**
+ * Returns the frame writer of the n-th debug frame.
+ * Frames are spread across all frame writers, except for a frame stream, which is written by the first one.
+ */
+int get_frame_writer(int frame_index)
+{
+    return frame_format == FRAME_FORMAT_STREAM ? 0 : frame_index % frame_writers;
+}
+
+/**
+ * Posts the particles of all regions of this process to the frame writer of a debug frame,
+ * without waiting for the frame to be written.
+ *
+ * At most MAX_PENDING_FRAMES frames are in flight at a time. Frames are sent in synchronous mode,
+ * so that when all of them are still waiting to be received, a slow frame writer holds back the
+ * simulation rather than letting an unbounded number of frames build up in buffers.
+ */
+void post_debug_frame(int frame_index, int *sizes, Particle **particles_by_region)
+{
+    int slot = frame_index % MAX_PENDING_FRAMES;
+    int writer = get_num_cores() + get_frame_writer(frame_index);
+
+    // Wait for the frame previously posted from this slot to be received.
+    MPI_Wait(&frame_requests[slot], MPI_STATUS_IGNORE);
+    free(frame_buffers[slot]);
+
+    // Copy the particles of all regions that this process is in charge of into a single buffer.
+    int count = 0;
+    for (int i = 0; i < num_my_regions; i++) count += sizes[my_regions[i]];
+    frame_buffers[slot] = malloc(count * sizeof(Particle));
+    for (int i = 0, offset = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        memcpy(&frame_buffers[slot][offset], particles_by_region[region], sizes[region] * sizeof(Particle));
+        offset += sizes[region];
+    }
+
+    MPI_Issend(frame_buffers[slot], count, mpi_particle_type, writer, TAG_FRAME, MPI_COMM_WORLD, &frame_requests[slot]);
+}
+
+/**
+ * Waits for all debug frames to be received, and tells the frame writers that there are no more frames.
+ */
+void finish_debug_frames()
+{
+    MPI_Waitall(MAX_PENDING_FRAMES, frame_requests, MPI_STATUSES_IGNORE);
+    for (int slot = 0; slot < MAX_PENDING_FRAMES; slot++) free(frame_buffers[slot]);
+
+    for (int writer = 0; writer < frame_writers; writer++)
+        MPI_Send(NULL, 0, mpi_particle_type, get_num_cores() + writer, TAG_FRAME_END, MPI_COMM_WORLD);
+}
+
+/**
+ * Main method for frame writers, which draw and write their debug frames from the particles
+ * posted by all compute processes, until there are no more frames.
+ */
+void write_debug_frames(char *specfile, char *framesdir)
+{
+    int num_cores = get_num_cores();
+    int writer = get_process_id() - num_cores;
+
+    // Lay out the regions in the same way as the compute processes.
+    spec = read_spec_file(specfile, MPI_COMM_WORLD);
+    decomp = decompose_spec(&spec, num_cores, getenv_sub_regions());
+    int canvas_length = spec.GridSize * spec.PoolLength;
+
+    if (frame_format == FRAME_FORMAT_STREAM && writer == 0) open_debug_frame_stream(framesdir);
+
+    char *outputfile = malloc(strlen(framesdir) + 20);
+    int stride = frame_format == FRAME_FORMAT_STREAM ? 1 : frame_writers;
+
+    // After a restart, frames are only posted from the first time slot after the checkpoint.
+    int first_frame = 0;
+    if (restart_file != NULL) first_frame = (read_checkpoint_header(restart_file).time_slot + frame_decimation - 1) / frame_decimation;
+
+    // Only redraw the particles that have moved since the last frame of this frame writer.
+    IncrementalCanvas frame_canvas = allocate_incremental_canvas(allocate_canvas(0, 0, canvas_length, canvas_length));
+    Particle *particles = NULL;
+    int capacity = 0;
+
+    for (int frame_index = first_frame + (writer - first_frame % stride + stride) % stride, done = 0; !done; frame_index += stride) {
+        // Receive the particles from each process.
+        // Each process posts its frames in order, so the next message from each process belongs to this frame.
+        int num_particles = 0;
+        for (int proc = 0; proc < num_cores; proc++) {
+            MPI_Status status;
+            int count;
+            MPI_Probe(proc, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, mpi_particle_type, &count);
+            if (num_particles + count > capacity) {
+                capacity = num_particles + count;
+                particles = realloc(particles, capacity * sizeof(Particle));
+            }
+            MPI_Recv(&particles[num_particles], count, mpi_particle_type, proc, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            num_particles += count;
+
+            if (status.MPI_TAG == TAG_FRAME_END) done = 1;
+        }
+        if (done) continue;
+
+        update_incremental_canvas(spec, &frame_canvas, num_particles, particles);
+
+        // Debug frames are only generated for every frame_decimation-th time slot.
+        int frame_id = frame_index * frame_decimation;
+        if (frame_format == FRAME_FORMAT_STREAM) {
+            write_frame_stream(frame_stream, frame_id, frame_canvas.canvas);
+        } else {
+            sprintf(outputfile, "%s/%d.ppm", framesdir, frame_id);
+            generate_heatmap(frame_canvas.canvas, outputfile);
+        }
     }
 
-    collate_generate_heatmap(sizes, particles, outputfile);
+    if (frame_stream != NULL) close_frame_stream(frame_stream);
+    free_incremental_canvas(frame_canvas);
+    free(outputfile);
+    free(particles);
+}
+
+/**
+ * Signal handler which asks the simulation to checkpoint and stop.
+ */
+void handle_stop_signal(int signum)
+{
+    (void)signum;
+    stop_signalled = 1;
+}
+
+/**
+ * Starts writing a checkpoint of the synchronised particles of the regions that this process is in charge of
+ * in the background, after waiting for the previous checkpoint to be written.
+ *
+ * The particles are staged into a separate buffer with absolute coordinates, so that the simulation
+ * can carry on while the checkpoint is written, and restart with any decomposition of the pool.
+ */
+void write_checkpoint(int time_slot, int *sizes, Particle **particles_by_region)
+{
+    if (checkpoint != NULL) finish_checkpoint(checkpoint);
+
+    int count = 0;
+    for (int i = 0; i < num_my_regions; i++) count += sizes[my_regions[i]];
+
+    Particle *staged = malloc(count * sizeof(Particle));
+    for (int i = 0, offset = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        for (int j = 0; j < sizes[region]; j++) {
+            Particle p = particles_by_region[region][j];
+            p.x = denorm_region_x(p.x, region, spec);
+            p.y = denorm_region_y(p.y, region, spec);
+            staged[offset++] = p;
+        }
+    }
+
+    checkpoint = start_checkpoint(compute_comm, checkpoint_file, get_checkpoint_header(time_slot), num_my_regions, my_regions, sizes, staged, mpi_particle_type);
+}
+
+/**
+ * Checks the health of the particles in my regions together with all other processes,
+ * and stops the simulation if they are corrupted.
+ */
+void check_particle_health(int time_slot, int *sizes, Particle **particles_by_region)
+{
+    HealthSample sample = { 0 };
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        sample_health(spec, sizes[region], particles_by_region[region], region, &sample);
+
+        // The potential energy is computed against the same regions as the velocity, so it does not depend on the decomposition.
+        if (health.energy_drift > 0) {
+            mark_horizon_regions(sizes, region);
+            sample_potential_energy(spec, sizes, particles_by_region, decomp.num_regions, region, near_regions, &sample);
+        }
+    }
+    if (!check_health(compute_comm, &health, time_slot, sample)) {
+        flush_log();
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
  * Runs the simulation according to the provided specifications.
  */
-Particle **run_simulation(int *sizes, Particle **particles_by_region, char *framesdir)
+Particle **run_simulation(int *sizes, Particle **particles_by_region, int first_time_slot, char *framesdir)
 {
     long long start, end;
     char timebuf[TIMEBUF_LENGTH];
-    int region_id = get_process_id();
+    int my_proc = get_process_id();
+
+    // Choose between synchronising with all processes, or with neighbouring processes only.
+    Particle **(*sync)(int *, Particle **) = neighbour_sync ? sync_particles_neighbours : sync_particles;
+
+    for (int i = first_time_slot; i < spec.TimeSlots; i++) {
+        start_benchmark_record(&benchmark, i, my_proc);
 
-    for (int i = 0; i < spec.TimeSlots; i++) {
         // Synchronise particles, such that we send all particles that we computed,
         // and receive updated particles for all regions.
+        // After regions are reassigned, their particles may need to be handed over to any process.
         start = wall_clock_time();
-        particles_by_region = sync_particles(sizes, particles_by_region);
+        particles_by_region = reassigned ? sync_particles(sizes, particles_by_region) : sync(sizes, particles_by_region);
+        reassigned = 0;
+        if (multipole_horizon >= 0) sync_multipoles(sizes, particles_by_region);
         end = wall_clock_time();
         comm_sum += end - start;
         format_time(timebuf, TIMEBUF_LENGTH, end - start);
         LL_VERBOSE("Communication time for iteration %4.0d: %s seconds", i + 1, timebuf);
 
+        // Periodically check the synchronised particles, instead of checking every interaction.
+        if (health.interval > 0 && i % health.interval == 0) check_particle_health(i, sizes, particles_by_region);
+
+        if (checkpoint_file != NULL) {
+            // Find out whether any process was asked to stop, if the reduction was started in the previous time slot,
+            // so that the reduction overlaps with the computation of the previous time slot.
+            int stop = 0;
+            if (stop_request != MPI_REQUEST_NULL) {
+                MPI_Wait(&stop_request, MPI_STATUS_IGNORE);
+                stop = global_stop;
+            }
+
+            // Start the reduction for the next check, which only happens every few time slots.
+            if ((i + 1) % stop_check_interval == 0) {
+                local_stop = stop_signalled;
+                MPI_Iallreduce(&local_stop, &global_stop, 1, MPI_INT, MPI_MAX, compute_comm, &stop_request);
+            }
+
+            // Periodically checkpoint the synchronised particles (except for the time slot that was restarted from).
+            if (stop || (checkpoint_interval > 0 && i % checkpoint_interval == 0 && i > first_time_slot))
+                write_checkpoint(i, sizes, particles_by_region);
+            else if (checkpoint != NULL)
+                test_checkpoint(checkpoint);
+
+            if (stop) {
+                if (is_master()) LL_NOTICE("Simulation stopped at time slot %d.", i);
+                stopped = 1;
+
+                // The job may be killed soon after it was signalled, so write out the pending log messages now.
+                flush_log();
+                break;
+            }
+        }
+
         // If debugging of frames is enabled, generate a frame and save it to the frames directory.
-        if (framesdir != NULL) generate_debug_frame(i, sizes, particles_by_region, framesdir);
+        if (framesdir != NULL && i % frame_decimation == 0) {
+            if (frame_writers > 0)
+                post_debug_frame(i / frame_decimation, sizes, particles_by_region);
+            else
+                generate_debug_frame(i, sizes, particles_by_region, framesdir);
+        }
 
         // Execute time step.
         start = wall_clock_time();
@@ -420,22 +1831,40 @@ Particle **run_simulation(int *sizes, Particle **particles_by_region, char *fram
         format_time(timebuf, TIMEBUF_LENGTH, end - start);
         LL_VERBOSE("Computation time for iteration %4.0d: %s seconds", i + 1, timebuf);
 
+        // Periodically reassign regions to even out the computation time of each process.
+        if (rebalance_interval > 0 && (i + 1) % rebalance_interval == 0) {
+            start = wall_clock_time();
+            rebalance();
+            comm_sum += wall_clock_time() - start;
+        }
+
         // Wait for all processes to complete computation before proceeding.
-        MPI_Barrier(MPI_COMM_WORLD);
+        // Not required when synchronising with neighbours, since each process waits for its neighbours' particles.
+        if (!neighbour_sync) MPI_Barrier(compute_comm);
+        end_benchmark_record(&benchmark);
     }
 
-    // Synchronise particles one more time.
-    particles_by_region = sync_particles(sizes, particles_by_region);
-    MPI_Barrier(MPI_COMM_WORLD);
+    // Wait for the last checkpoint to be written.
+    MPI_Wait(&stop_request, MPI_STATUS_IGNORE);
+    if (checkpoint != NULL) finish_checkpoint(checkpoint);
+    checkpoint = NULL;
+
+    if (framesdir != NULL && frame_writers > 0) finish_debug_frames();
+
+    // Synchronise particles one more time (unless the simulation was stopped, in which case they are already synchronised).
+    if (!stopped) particles_by_region = reassigned ? sync_particles(sizes, particles_by_region) : sync(sizes, particles_by_region);
+    reassigned = 0;
+    if (health.interval > 0 && !stopped) check_particle_health(spec.TimeSlots, sizes, particles_by_region);
+    MPI_Barrier(compute_comm);
 
     // Get total and average timing for all iterations.
-    LL_VERBOSE("Computation time for region %d:", region_id);
+    LL_VERBOSE("Computation time for process %d (%d region(s)):", my_proc, num_my_regions);
     format_time(timebuf, TIMEBUF_LENGTH, comp_sum);
     LL_VERBOSE("+ Total: %s seconds", timebuf);
     format_time(timebuf, TIMEBUF_LENGTH, comp_sum / spec.TimeSlots);
     LL_VERBOSE("+ Average: %s seconds", timebuf);
 
-    LL_VERBOSE("Communication time for region %d:", region_id);
+    LL_VERBOSE("Communication time for process %d:", my_proc);
     format_time(timebuf, TIMEBUF_LENGTH, comm_sum);
     LL_VERBOSE("+ Total: %s seconds", timebuf);
     format_time(timebuf, TIMEBUF_LENGTH, comm_sum / spec.TimeSlots);
@@ -451,32 +1880,80 @@ void start(char *specfile, char *outputfile, char *reportfile, char *framesdir)
 {
     int *sizes;
     Particle **particles_by_region;
-    int region_id = get_process_id();
 
-    if (is_master()) LL_NOTICE("Starting %s with %d region(s) on %d processor(s)...", PROG, get_num_cores(), get_num_cores());
+    if (is_master()) LL_NOTICE("Starting %s on %d processor(s)...", PROG, get_num_cores());
 
-    // Read the specification file into a struct (in parallel).
-    spec = read_spec_file(region_id, specfile);
+    // Read the specification file on the master process, which is broadcast to all processes (including frame writers).
+    spec = read_spec_file(specfile, MPI_COMM_WORLD);
 
     // Debug print all read-in values.
     if (is_master()) print_spec(spec);
-    if (is_master()) print_canvas_info(spec);
 
-    // Initialize arrays and generate particles.
-    particles_by_region = init_particles(&sizes);
-    MPI_Barrier(MPI_COMM_WORLD);
+    // Lay out the processes in a grid, and split the region of each process into sub-regions.
+    decomp = decompose_spec(&spec, get_num_cores(), getenv_sub_regions());
+    if (is_master()) print_canvas_info(spec, decomp);
+    if (region_order != REGION_ORDER_ROW_MAJOR) reorder_blocks();
+    my_regions = malloc(decomp.num_regions * sizeof(int));
+    my_region_flags = malloc(decomp.num_regions);
+    near_regions = malloc(decomp.num_regions);
+    far_regions = malloc(decomp.num_regions);
+    halo_plan = malloc(decomp.num_regions * get_num_cores());
+    migration_peers = malloc(get_num_cores());
+    region_costs = calloc(decomp.num_regions, sizeof(long long));
+    update_assignment();
+
+    // Find the processes on the same node, which can share their halos in place,
+    // or aggregate their halos for processes on other nodes.
+    if (shared_halos || hierarchical_halos) {
+        node_ranks = malloc(get_num_cores() * sizeof(int));
+        mpi_init_node_comm(&node_comm, node_ranks);
+    }
+    if (hierarchical_halos) {
+        node_ids = malloc(get_num_cores() * sizeof(int));
+        num_nodes = mpi_init_leader_comm(node_comm, &leader_comm, node_ids);
+        if (is_master()) LL_VERBOSE("Aggregating halos between %d node(s).", num_nodes);
+    }
+
+    // Allocate space for the multipole summaries of all regions.
+    if (multipole_horizon >= 0) multipoles = calloc(decomp.num_regions, sizeof(Multipole));
+
+    // Initialize arrays and generate particles, or load them from a checkpoint or particle file.
+    int first_time_slot = 0;
+    if (restart_file != NULL)
+        particles_by_region = restart_particles(&sizes, &first_time_slot);
+    else if (particle_file != NULL)
+        particles_by_region = import_particles(&sizes);
+    else
+        particles_by_region = init_particles(&sizes);
+    if (orb_decomposition) bisect_initial_regions(sizes);
+    MPI_Barrier(compute_comm);
 
     // Run the simulation only in the region assigned.
+    if (is_master() && restart_file != NULL) LL_NOTICE("Restarting from %s after time slot %d.", restart_file, first_time_slot);
     if (is_master()) LL_NOTICE("Simulation is starting on %d core(s).", get_num_cores());
-    particles_by_region = run_simulation(sizes, particles_by_region, framesdir);
-    MPI_Barrier(MPI_COMM_WORLD);
+    if (framesdir != NULL && frame_format == FRAME_FORMAT_STREAM && frame_writers == 0 && is_master()) open_debug_frame_stream(framesdir);
+    particles_by_region = run_simulation(sizes, particles_by_region, first_time_slot, framesdir);
+    if (frame_stream != NULL) close_frame_stream(frame_stream);
+    MPI_Barrier(compute_comm);
     if (is_master()) LL_NOTICE("%s", "Simulation completed!");
 
     // Collate timings from all processes to generate a report.
     collate_timings(reportfile);
-
-    // Collate particles and generate the heatmap on the master process.
-    collate_generate_heatmap(sizes, particles_by_region, outputfile);
+    if (benchmark_file != NULL) write_benchmark(compute_comm, &benchmark, benchmark_file, benchmark_format);
+
+    // Collate particles and generate the heatmap on the master process,
+    // unless the simulation was stopped, in which case it can be restarted from the checkpoint.
+    if (!stopped)
+        collate_generate_heatmap(sizes, particles_by_region, outputfile, output_format);
+    else if (is_master())
+        LL_NOTICE("Restart from %s with RESTART_FILE to complete the simulation.", checkpoint_file);
+
+    // Release the shared window, which may still be referenced by the final particles.
+    if (shared_win != MPI_WIN_NULL) {
+        detach_shared_regions(particles_by_region);
+        MPI_Win_unlock_all(shared_win);
+        MPI_Win_free(&shared_win);
+    }
 }
 
 int main(int argc, char **argv)
@@ -484,6 +1961,48 @@ int main(int argc, char **argv)
     multiproc_init(argc, argv);
     set_log_level_env();
     mpi_init_particle(&mpi_particle_type);
+    multipole_horizon = getenv_multipole_horizon();
+    neighbour_sync = getenv_neighbour_sync();
+    orb_decomposition = getenv_orb_decomposition();
+    shared_halos = getenv_shared_halos();
+    region_order = getenv_region_order();
+    hierarchical_halos = getenv_hierarchical_halos();
+    output_format = getenv_output_format();
+    frame_writers = getenv_frame_writers();
+    frame_format = getenv_frame_format();
+    frame_decimation = getenv_frame_decimation();
+    frame_downsample = getenv_frame_downsample();
+    rebalance_interval = getenv_rebalance_interval();
+    checkpoint_file = getenv_checkpoint_file();
+    checkpoint_interval = getenv_checkpoint_interval();
+    restart_file = getenv_restart_file();
+    particle_file = getenv_particle_file();
+    benchmark_file = getenv_benchmark_file();
+    benchmark_format = getenv_benchmark_format();
+    health = create_health_monitor_env();
+
+    // Shared halos are only published by the global synchronisation, which NEIGHBOUR_SYNC replaces.
+    if (neighbour_sync && shared_halos) {
+        if (is_master()) LL_NOTICE("%s", "SHARED_HALOS is ignored with NEIGHBOUR_SYNC, which copies all halos through messages.");
+        shared_halos = 0;
+    }
+
+    // Likewise, halos for other nodes are only aggregated by the global synchronisation.
+    if (neighbour_sync && hierarchical_halos) {
+        if (is_master()) LL_NOTICE("%s", "HIERARCHICAL_HALOS is ignored with NEIGHBOUR_SYNC, which sends halos directly between neighbours.");
+        hierarchical_halos = 0;
+    }
+
+    // Checkpoint and stop the simulation when asked to terminate (e.g. before the walltime of a job).
+    // mpirun forwards SIGUSR1 to all processes, while batch systems usually send SIGTERM to each process.
+    if (checkpoint_file != NULL) {
+        signal(SIGTERM, handle_stop_signal);
+        signal(SIGUSR1, handle_stop_signal);
+    }
+
+    // Processes are synchronised globally at every time slot anyway, unless they only synchronise with their neighbours,
+    // in which case they only agree to stop at the time slots which write a checkpoint (which synchronise globally).
+    if (neighbour_sync) stop_check_interval = checkpoint_interval > 0 ? checkpoint_interval : STOP_CHECK_INTERVAL;
 
     // Parse arguments
     check_arguments(argc, PROG);
@@ -494,8 +2013,17 @@ int main(int argc, char **argv)
     char *framesdir = NULL;
     if (argc == 5) framesdir = argv[4];
 
+    // Split off the frame writers, which only write debug frames.
+    if (framesdir == NULL) frame_writers = 0;
+    int is_frame_writer = mpi_split_frame_writers(frame_writers);
+    compute_comm = get_compute_comm();
+    for (int slot = 0; slot < MAX_PENDING_FRAMES; slot++) frame_requests[slot] = MPI_REQUEST_NULL;
+
     // Start the main method!
-    start(specfile, outputfile, reportfile, framesdir);
+    if (is_frame_writer)
+        write_debug_frames(specfile, framesdir);
+    else
+        start(specfile, outputfile, reportfile, framesdir);
 
     multiproc_finalize();
     return 0;
@@ -0,0 +1,552 @@
+/**
+ * poolbench.c
+ *
+ * Microbenchmarks of the simulation kernels on synthetic particles, so that optimisations
+ * can be evaluated in isolation, without running the entire simulation with mpirun.
+ *
+ * Each kernel is run over sets of particles of varying number, density and radius,
+ * which are spread uniformly over a small pool of regions. Every variant of a kernel
+ * is warmed up, and then timed over repeated runs until enough time has passed.
+ * The median run is reported per operation of the kernel (e.g. per interaction),
+ * and as the number of particles per second, with the variants of each kernel side by side.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulation/multipole.h"
+#include "simulation/nbody.h"
+#include "utils/heatmap.h"
+#include "utils/log.h"
+#include "utils/particles.h"
+#include "utils/random.h"
+#include "utils/regions.h"
+#include "utils/timer.h"
+
+#define PROG "poolbench"
+
+// Length of the pool of regions that the particles are spread over.
+#define BENCH_POOL_LENGTH 2
+
+// Length of the pool of regions whose distances are measured.
+#define BENCH_HORIZON_POOL_LENGTH 64
+
+// Each variant is timed for at least this long (in nanoseconds) and this many runs, up to a max number of runs.
+#define BENCH_MIN_TIME 200000000LL
+#define BENCH_MIN_RUNS 3
+#define BENCH_MAX_RUNS 100
+
+#define BENCH_SEED 3211
+
+// Numbers of particles, densities (particles per unit area) and radii of the particle sets.
+static const int default_sizes[] = { 256, 1024, 4096 };
+static const double densities[] = { 0.05, 0.5 };
+static const double radii[] = { 0.5, 2.0 };
+
+/**
+ * Set of synthetic particles that the kernels are run over, which is never modified.
+ */
+typedef struct bench_set_t {
+    Spec spec;
+    int n;
+    double density;
+    int num_regions;
+
+    // Particles in a single array, with their region IDs, and binned into their regions.
+    Particle *particles;
+    int *sizes;
+    Particle **particles_by_region;
+} BenchSet;
+
+/**
+ * Variant of a kernel, which runs the kernel once over a set and returns the time taken (in nanoseconds),
+ * excluding any setup such as copying the particles that the kernel modifies.
+ */
+typedef struct bench_variant_t {
+    const char *kernel;
+    const char *variant;
+
+    // Unit of the operations of the kernel, which is the same for all variants of the kernel.
+    const char *unit;
+    long long (*count)(BenchSet *set);
+    long long (*run)(BenchSet *set);
+} BenchVariant;
+
+// Sink for the results of kernels which have no side effects, so that they are not optimised away.
+volatile long double bench_sink;
+
+/**
+ * Generates a set of particles which are spread uniformly over the pool, with random velocities.
+ */
+BenchSet create_bench_set(int n, double density, double radius)
+{
+    BenchSet set = { .n = n, .density = density, .num_regions = BENCH_POOL_LENGTH * BENCH_POOL_LENGTH };
+
+    // Size the regions so that the particles have the given density.
+    set.spec = (Spec){
+        .TimeSlots = 1,
+        .TimeStep = 0.01,
+        .Horizon = BENCH_POOL_LENGTH,
+        .GridSize = fmax(1, ceil(sqrt(n / density) / BENCH_POOL_LENGTH)),
+        .NumberOfSmallParticles = n,
+        .SmallParticleMass = 1,
+        .SmallParticleRadius = radius,
+        .PoolLength = BENCH_POOL_LENGTH,
+        .TotalNumberOfParticles = n,
+        .Seed = BENCH_SEED,
+    };
+    int canvas_length = set.spec.GridSize * set.spec.PoolLength;
+
+    set.particles = malloc(n * sizeof(Particle));
+    for (int i = 0; i < n; i++) {
+        double u[4];
+        random_uniforms(BENCH_SEED, RANDOM_STREAM_PARTICLES, i, 0, u);
+        Particle p = {
+            .id = i,
+            .size = SMALL,
+            .mass = set.spec.SmallParticleMass,
+            .radius = radius,
+            .x = u[0] * canvas_length,
+            .y = u[1] * canvas_length,
+            .vx = u[2] - 0.5,
+            .vy = u[3] - 0.5,
+        };
+        p.region = get_denorm_particle_region(p, set.spec);
+        p.x = norm_region(p.x, set.spec);
+        p.y = norm_region(p.y, set.spec);
+        set.particles[i] = p;
+    }
+
+    set.sizes = malloc(set.num_regions * sizeof(int));
+    set.particles_by_region = reallocate_for_region(set.spec, set.sizes, n, set.particles, set.num_regions);
+
+    return set;
+}
+
+/**
+ * Frees a set of particles.
+ */
+void free_bench_set(BenchSet set)
+{
+    deallocate_particles(set.particles_by_region, set.num_regions);
+    free(set.sizes);
+    free(set.particles);
+}
+
+/**
+ * Copies the particles of a set by region, for kernels which modify them.
+ */
+Particle **copy_bench_particles(BenchSet *set)
+{
+    Particle **particles = allocate_particles(set->sizes, set->num_regions);
+    for (int i = 0; i < set->num_regions; i++)
+        memcpy(particles[i], set->particles_by_region[i], set->sizes[i] * sizeof(Particle));
+
+    return particles;
+}
+
+/**
+ * Counts the particles of a set, for kernels which process each particle once.
+ */
+long long count_particles(BenchSet *set)
+{
+    return set->n;
+}
+
+/**
+ * Counts the coordinates of all particles of a set.
+ */
+long long count_coordinates(BenchSet *set)
+{
+    return 2LL * set->n;
+}
+
+/**
+ * Counts the interactions of each particle of a set with every other particle.
+ */
+long long count_interactions(BenchSet *set)
+{
+    return (long long)set->n * (set->n - 1);
+}
+
+/**
+ * Counts the pairs of particles of a set.
+ */
+long long count_pairs(BenchSet *set)
+{
+    return (long long)set->n * (set->n - 1) / 2;
+}
+
+/**
+ * Computes the velocities of all particles exactly, against all other particles.
+ */
+long long run_velocity_exact(BenchSet *set)
+{
+    Particle **particles = copy_bench_particles(set);
+
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->num_regions; i++)
+        update_velocity(set->spec.TimeStep, set->spec, set->sizes, particles, set->num_regions, i, NULL);
+    long long elapsed = wall_clock_time() - start;
+
+    deallocate_particles(particles, set->num_regions);
+    return elapsed;
+}
+
+/**
+ * Computes the velocities of all particles exactly against their own region,
+ * and against the multipole summaries of all other regions (i.e. MULTIPOLE_HORIZON=0).
+ */
+long long run_velocity_multipole(BenchSet *set)
+{
+    Particle **particles = copy_bench_particles(set);
+    char *near_regions = malloc(set->num_regions);
+    char *far_regions = malloc(set->num_regions);
+    Multipole *multipoles = malloc(set->num_regions * sizeof(Multipole));
+
+    long long elapsed = 0;
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->num_regions; i++)
+        multipoles[i] = compute_multipole(set->spec, set->sizes[i], particles[i], i);
+    elapsed += wall_clock_time() - start;
+
+    for (int i = 0; i < set->num_regions; i++) {
+        // Only the region itself is computed exactly, and all other regions (within the horizon) are summarised.
+        for (int j = 0; j < set->num_regions; j++) {
+            near_regions[j] = j == i;
+            far_regions[j] = j != i;
+        }
+
+        start = wall_clock_time();
+        update_velocity(set->spec.TimeStep, set->spec, set->sizes, particles, set->num_regions, i, near_regions);
+        update_velocity_multipole(set->spec.TimeStep, set->spec, set->sizes[i], particles[i], i, multipoles, set->num_regions, far_regions);
+        elapsed += wall_clock_time() - start;
+    }
+
+    free(multipoles);
+    free(far_regions);
+    free(near_regions);
+    deallocate_particles(particles, set->num_regions);
+    return elapsed;
+}
+
+/**
+ * Handles the collisions of each region against all regions, as by a process computing a single region,
+ * which checks the pairs across two regions from both regions.
+ */
+long long run_collisions_all(BenchSet *set)
+{
+    Particle **particles = copy_bench_particles(set);
+
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->num_regions; i++)
+        handle_collisions(set->spec, set->sizes, particles, set->num_regions, i, NULL);
+    long long elapsed = wall_clock_time() - start;
+
+    deallocate_particles(particles, set->num_regions);
+    return elapsed;
+}
+
+/**
+ * Handles the collisions of each region, as by a process computing all regions,
+ * which checks the pairs across two regions only once.
+ */
+long long run_collisions_computed(BenchSet *set)
+{
+    Particle **particles = copy_bench_particles(set);
+    char *flags = malloc(set->num_regions);
+    memset(flags, REGION_COMPUTED, set->num_regions);
+
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->num_regions; i++)
+        handle_collisions(set->spec, set->sizes, particles, set->num_regions, i, flags);
+    long long elapsed = wall_clock_time() - start;
+
+    free(flags);
+    deallocate_particles(particles, set->num_regions);
+    return elapsed;
+}
+
+/**
+ * Reallocates the particles from a single array into their regions.
+ */
+long long run_reallocate_region(BenchSet *set)
+{
+    int *sizes = malloc(set->num_regions * sizeof(int));
+
+    long long start = wall_clock_time();
+    Particle **particles = reallocate_for_region(set->spec, sizes, set->n, set->particles, set->num_regions);
+    long long elapsed = wall_clock_time() - start;
+
+    deallocate_particles(particles, set->num_regions);
+    free(sizes);
+    return elapsed;
+}
+
+/**
+ * Reallocates the particles from the arrays of all regions into their regions.
+ */
+long long run_reallocate_regions(BenchSet *set)
+{
+    int *sizes = malloc(set->num_regions * sizeof(int));
+    int *regions = malloc(set->num_regions * sizeof(int));
+    for (int i = 0; i < set->num_regions; i++) regions[i] = i;
+
+    long long start = wall_clock_time();
+    Particle **particles = reallocate_for_regions(set->spec, sizes, set->num_regions, regions, set->sizes, set->particles_by_region, set->num_regions);
+    long long elapsed = wall_clock_time() - start;
+
+    deallocate_particles(particles, set->num_regions);
+    free(regions);
+    free(sizes);
+    return elapsed;
+}
+
+/**
+ * Generates the tile canvas of each region, drawing a precomputed span for each row of a particle.
+ */
+long long run_canvas_stamp(BenchSet *set)
+{
+    int margin = get_canvas_margin(set->spec);
+    long long elapsed = 0;
+
+    for (int i = 0; i < set->num_regions; i++) {
+        long long start = wall_clock_time();
+        Canvas canvas = generate_region_canvas(set->spec, set->sizes[i], set->particles_by_region[i], i, margin);
+        elapsed += wall_clock_time() - start;
+        free_canvas(canvas);
+    }
+
+    return elapsed;
+}
+
+/**
+ * Generates the tile canvas of each region, testing every pixel in the bounding box of a particle.
+ */
+long long run_canvas_scan(BenchSet *set)
+{
+    int margin = get_canvas_margin(set->spec);
+    long long elapsed = 0;
+
+    for (int i = 0; i < set->num_regions; i++) {
+        long long start = wall_clock_time();
+        Canvas canvas = allocate_region_canvas(set->spec, i, margin);
+        draw_particles_scan(set->spec, canvas, set->sizes[i], set->particles_by_region[i], i);
+        elapsed += wall_clock_time() - start;
+        free_canvas(canvas);
+    }
+
+    return elapsed;
+}
+
+/**
+ * Finds the distance between a pair of regions for each particle, by enumerating the rings around a region.
+ */
+long long run_horizon_enumerate(BenchSet *set)
+{
+    int num_regions = BENCH_HORIZON_POOL_LENGTH * BENCH_HORIZON_POOL_LENGTH;
+    long long sum = 0;
+
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->n; i++)
+        sum += get_horizon_dist(BENCH_HORIZON_POOL_LENGTH, i % num_regions, (i * 7919) % num_regions);
+    long long elapsed = wall_clock_time() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+/**
+ * Finds the distance between a pair of regions for each particle, from their coordinates (wrapping around the pool).
+ */
+long long run_horizon_wrapped(BenchSet *set)
+{
+    int num_regions = BENCH_HORIZON_POOL_LENGTH * BENCH_HORIZON_POOL_LENGTH;
+    Spec spec = { .PoolLength = BENCH_HORIZON_POOL_LENGTH };
+    long long sum = 0;
+
+    long long start = wall_clock_time();
+    for (int i = 0; i < set->n; i++)
+        sum += get_wrapped_region_dist(i % num_regions, (i * 7919) % num_regions, spec);
+    long long elapsed = wall_clock_time() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+/**
+ * Wraps a coordinate around the pool with a single floating-point remainder, as a candidate for wrap_around.
+ */
+long double wrap_around_fmod(long double coord, int max_coord)
+{
+    coord = fmodl(coord, max_coord);
+    return coord < 0 ? coord + max_coord : coord;
+}
+
+/**
+ * Wraps the coordinates of each particle around the pool after moving a whole region, with the given function.
+ */
+long long run_wrap(BenchSet *set, long double (*wrap)(long double, int))
+{
+    Spec spec = set->spec;
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    long double sum = 0;
+
+    long long start = wall_clock_time();
+    for (int region = 0; region < set->num_regions; region++) {
+        for (int i = 0; i < set->sizes[region]; i++) {
+            Particle p = set->particles_by_region[region][i];
+            sum += wrap(denorm_region_x(p.x, region, spec) + p.vx * 2 * spec.GridSize, canvas_length);
+            sum += wrap(denorm_region_y(p.y, region, spec) + p.vy * 2 * spec.GridSize, canvas_length);
+        }
+    }
+    long long elapsed = wall_clock_time() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+/**
+ * Wraps the coordinates of each particle with wrap_around.
+ */
+long long run_wrap_loop(BenchSet *set)
+{
+    return run_wrap(set, wrap_around);
+}
+
+/**
+ * Wraps the coordinates of each particle with wrap_around_fmod.
+ */
+long long run_wrap_fmod(BenchSet *set)
+{
+    return run_wrap(set, wrap_around_fmod);
+}
+
+// Variants of each kernel, in the order that they are reported.
+static const BenchVariant variants[] = {
+    { "velocity", "exact", "interaction", count_interactions, run_velocity_exact },
+    { "velocity", "multipole", "interaction", count_interactions, run_velocity_multipole },
+    { "collisions", "all", "pair", count_pairs, run_collisions_all },
+    { "collisions", "computed", "pair", count_pairs, run_collisions_computed },
+    { "reallocate", "region", "particle", count_particles, run_reallocate_region },
+    { "reallocate", "regions", "particle", count_particles, run_reallocate_regions },
+    { "canvas", "stamp", "particle", count_particles, run_canvas_stamp },
+    { "canvas", "scan", "particle", count_particles, run_canvas_scan },
+    { "horizon", "enumerate", "pair", count_particles, run_horizon_enumerate },
+    { "horizon", "wrapped", "pair", count_particles, run_horizon_wrapped },
+    { "wrap", "loop", "coordinate", count_coordinates, run_wrap_loop },
+    { "wrap", "fmod", "coordinate", count_coordinates, run_wrap_fmod },
+};
+
+#define NUM_VARIANTS (int)(sizeof(variants) / sizeof(BenchVariant))
+
+/**
+ * Comparator which orders times in ascending order.
+ */
+int compare_run_times(const void *a, const void *b)
+{
+    long long t1 = *(const long long *)a, t2 = *(const long long *)b;
+    return (t1 > t2) - (t1 < t2);
+}
+
+/**
+ * Warms up a variant, and then times it over repeated runs. Returns the median time of a run.
+ */
+long long measure_variant(const BenchVariant *variant, BenchSet *set, int *num_runs)
+{
+    long long times[BENCH_MAX_RUNS];
+    long long total = 0;
+    int n = 0;
+
+    variant->run(set);
+    while (n < BENCH_MAX_RUNS && (n < BENCH_MIN_RUNS || total < BENCH_MIN_TIME)) {
+        times[n] = variant->run(set);
+        total += times[n++];
+    }
+
+    qsort(times, n, sizeof(long long), compare_run_times);
+    *num_runs = n;
+    return times[n / 2];
+}
+
+/**
+ * Returns 1 if a kernel has any variants.
+ */
+int is_kernel(const char *kernel)
+{
+    for (int i = 0; i < NUM_VARIANTS; i++)
+        if (strcmp(kernel, variants[i].kernel) == 0) return 1;
+
+    return 0;
+}
+
+/**
+ * Runs the variants of a kernel (or of all kernels, if NULL) over a set of particles.
+ */
+void run_variants(const char *kernel, BenchSet *set)
+{
+    for (int i = 0; i < NUM_VARIANTS; i++) {
+        const BenchVariant *variant = &variants[i];
+        if (kernel != NULL && strcmp(kernel, variant->kernel) != 0) continue;
+
+        int num_runs;
+        long long median = measure_variant(variant, set, &num_runs);
+        long long ops = variant->count(set);
+        printf("%-10s  %-9s  %6d  %7.3f  %6.2Lf  %4d  %12.2f  %-11s  %14.0f\n",
+            variant->kernel,
+            variant->variant,
+            set->n,
+            set->density,
+            set->spec.SmallParticleRadius,
+            num_runs,
+            ops > 0 ? (double)median / ops : 0.0,
+            variant->unit,
+            median > 0 ? set->n * 1e9 / median : 0.0);
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    set_log_level_env();
+
+    // Parse arguments: an optional kernel, followed by the numbers of particles.
+    const char *kernel = NULL;
+    int arg = 1;
+    if (argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9')) kernel = argv[arg++];
+    if (kernel != NULL && !is_kernel(kernel)) {
+        LL_ERROR("Unknown kernel %s!", kernel);
+        exit(EXIT_FAILURE);
+    }
+
+    int num_sizes = argc - arg;
+    int *sizes = malloc((num_sizes > 0 ? num_sizes : (int)(sizeof(default_sizes) / sizeof(int))) * sizeof(int));
+    for (int i = 0; i < num_sizes; i++) {
+        sizes[i] = atoi(argv[arg + i]);
+        if (sizes[i] < 2) {
+            LL("Usage: %s [kernel] [number of particles...]", PROG);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_sizes == 0) {
+        num_sizes = sizeof(default_sizes) / sizeof(int);
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+
+    printf("%-10s  %-9s  %6s  %7s  %6s  %4s  %12s  %-11s  %14s\n", "kernel", "variant", "n", "density", "radius", "runs", "ns/op", "op", "particles/s");
+
+    for (int i = 0; i < num_sizes; i++) {
+        for (int d = 0; d < (int)(sizeof(densities) / sizeof(double)); d++) {
+            for (int r = 0; r < (int)(sizeof(radii) / sizeof(double)); r++) {
+                BenchSet set = create_bench_set(sizes[i], densities[d], radii[r]);
+                run_variants(kernel, &set);
+                free_bench_set(set);
+            }
+        }
+    }
+
+    free(sizes);
+    return 0;
+}
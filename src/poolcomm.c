@@ -0,0 +1,594 @@
+/**
+ * poolcomm.c
+ *
+ * Benchmark of the communication of particles between processes, which replays the exchange patterns
+ * of the synchronisation of pool on synthetic particles, without computing any time steps.
+ * It tells apart the time spent waiting for other processes (latency), transferring messages (bandwidth),
+ * and packing and copying particles (serialisation), for the number of processes it is run on.
+ *
+ * Each strategy is run for every Horizon and number of particles per region, where a fixed fraction of
+ * the particles of each region has moved into its adjacent regions. The timings of each run are written
+ * in the same format as BENCHMARK_FILE, to a file per strategy, number of processes, Horizon and payload
+ * in the output directory:
+ *
+ *   roundrobin     sync_particles: every process sends to every other process in turn, and then
+ *                  duplicates the halos pair by pair.
+ *   neighbour      sync_particles_neighbours: non-blocking sends to adjacent and horizon processes only.
+ *   alltoallv      Migration and halo duplication as a single MPI_Alltoallv each.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/benchmark.h"
+#include "utils/decomposition.h"
+#include "utils/env.h"
+#include "utils/log.h"
+#include "utils/multiproc.h"
+#include "utils/particles.h"
+#include "utils/regions.h"
+#include "utils/timer.h"
+
+#define PROG "poolcomm"
+#define TAG_MIGRATE 1
+#define TAG_HALO 2
+
+// Number of runs of each configuration which are discarded, followed by the runs which are recorded.
+#define COMM_WARMUP_RUNS 3
+#define COMM_RUNS 20
+
+// Fraction of the particles of each region which have moved into its adjacent regions.
+#define COMM_MIGRATION_FRACTION 0.05
+
+// Length of a region before it is split into sub-regions, which only affects the coordinates of the particles.
+#define COMM_GRID_SIZE 100
+
+// Horizons and numbers of particles per region of each configuration.
+static const int horizons[] = { 0, 1, 2 };
+static const int payloads[] = { 16, 256, 4096 };
+
+/**
+ * Exchange strategies.
+ */
+typedef enum comm_strategy_t {
+    STRATEGY_ROUND_ROBIN,
+    STRATEGY_NEIGHBOUR,
+    STRATEGY_ALLTOALLV,
+    NUM_STRATEGIES,
+} CommStrategy;
+
+static const char *strategy_names[NUM_STRATEGIES] = { "roundrobin", "neighbour", "alltoallv" };
+
+// Specification and decomposition of the current configuration.
+Spec spec;
+Decomposition decomp;
+
+// Custom MPI datatype to store our Particle struct.
+MPI_Datatype mpi_particle_type;
+
+// Communicator of all processes.
+MPI_Comm compute_comm;
+
+// Timings and counts of each run of the current configuration.
+Benchmark benchmark = { 0 };
+
+// Regions that this process is computing for, and the processes that it exchanges particles with
+// (in the same way as pool).
+int *my_regions;
+int num_my_regions;
+char *halo_plan;
+char *migration_peers;
+
+/**
+ * Decomposes the pool for a Horizon, and plans the exchanges of this process in the same way as pool.
+ */
+void plan_exchange(int horizon)
+{
+    int num_cores = get_num_cores();
+    int my_proc = get_process_id();
+
+    spec = (Spec){ .GridSize = COMM_GRID_SIZE, .Horizon = horizon };
+    decomp = decompose_spec(&spec, num_cores, getenv_sub_regions());
+    int num_regions = decomp.num_regions;
+
+    my_regions = malloc(num_regions * sizeof(int));
+    num_my_regions = get_owned_regions(decomp, my_proc, my_regions);
+
+    // A region is needed by a process if it is within the horizon of any of the process' regions.
+    halo_plan = calloc(num_regions * num_cores, 1);
+    for (int sender = 0; sender < num_regions; sender++) {
+        for (int receiver = 0; receiver < num_regions; receiver++) {
+            if (decomp.owners[sender] == decomp.owners[receiver]) continue;
+            if (get_spec_region_dist(spec, decomp, sender, receiver) > spec.Horizon) continue;
+            halo_plan[sender * num_cores + decomp.owners[receiver]] = 1;
+        }
+    }
+
+    // Particles can move into any adjacent region (of the spec) within a single time step,
+    // i.e. by up to its number of sub-regions along each axis.
+    migration_peers = calloc(num_cores, 1);
+    for (int i = 0; i < num_my_regions; i++)
+        for (int region = 0; region < num_regions; region++)
+            if (get_wrapped_region_dist(my_regions[i], region, spec) <= decomp.sub_regions) migration_peers[decomp.owners[region]] = 1;
+    migration_peers[my_proc] = 0;
+}
+
+/**
+ * Frees the plan of the current configuration.
+ */
+void free_exchange()
+{
+    free(decomp.block_ranks);
+    free(decomp.owners);
+    free(my_regions);
+    free(halo_plan);
+    free(migration_peers);
+}
+
+/**
+ * Gets the list of regions of the sender process that the receiver process needs
+ * for the horizon duplication. Returns the number of regions written to the regions array.
+ */
+int get_halo_regions(int sender, int receiver, int *regions)
+{
+    int n = 0;
+    for (int region = 0; region < decomp.num_regions; region++)
+        if (decomp.owners[region] == sender && halo_plan[region * get_num_cores() + receiver]) regions[n++] = region;
+
+    return n;
+}
+
+/**
+ * Generates the particles of my regions after a time step, where a fraction of the particles of each region
+ * has moved evenly into its 8 adjacent regions (wrapping around the pool).
+ */
+Particle **generate_exchange_particles(int payload, int *sizes)
+{
+    int num_regions = decomp.num_regions;
+    int moved = payload * COMM_MIGRATION_FRACTION / 8;
+    int id = get_process_id() * num_regions * payload;
+
+    for (int region = 0; region < num_regions; region++) sizes[region] = 0;
+    for (int i = 0; i < num_my_regions; i++) {
+        int x = get_region_x(my_regions[i], spec);
+        int y = get_region_y(my_regions[i], spec);
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int region = ((y + dy + spec.PoolLength) % spec.PoolLength) * spec.PoolLength + (x + dx + spec.PoolLength) % spec.PoolLength;
+                sizes[region] += dx == 0 && dy == 0 ? payload - 8 * moved : moved;
+            }
+        }
+    }
+
+    Particle **particles = allocate_particles(sizes, num_regions);
+    for (int region = 0; region < num_regions; region++) {
+        for (int i = 0; i < sizes[region]; i++) {
+            particles[region][i] = (Particle){
+                .id = id++,
+                .region = region,
+                .size = SMALL,
+                .mass = 1,
+                .radius = 1,
+                .x = spec.GridSize / 2.0,
+                .y = spec.GridSize / 2.0,
+            };
+        }
+    }
+
+    return particles;
+}
+
+/**
+ * Replays sync_particles: the sizes of all regions are summed up across all processes, every process sends
+ * the particles that moved into the regions of every other process in turn, and the halos are duplicated
+ * pair by pair.
+ */
+Particle **sync_round_robin(int *sizes, Particle **particles)
+{
+    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int *regions = malloc(num_regions * sizeof(int));
+    int count;
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+    long long lap = wall_clock_time();
+
+    /// Step 1: Determine the total number of particles located in each region across all processes.
+    int *total_sizes = calloc(num_regions, sizeof(int));
+    MPI_Allreduce(sizes, total_sizes, num_regions, MPI_INT, MPI_SUM, compute_comm);
+    Particle **final_particles = allocate_particles(total_sizes, num_regions);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_SIZES, lap);
+
+    /// Step 2: Send the particles that should belong to a particular region to the process computing for it.
+    int *offsets = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        memcpy(final_particles[region], particles[region], sizes[region] * sizeof(Particle));
+        offsets[region] = sizes[region];
+    }
+
+    for (int proc = 0; proc < num_cores; proc++) {
+        if (proc == my_proc) {
+            for (int dest = 0; dest < num_cores; dest++) {
+                if (dest == my_proc) continue;
+
+                int n = get_owned_regions(decomp, dest, regions);
+                Particle *buf = pack_regions(n, regions, sizes, particles, &count);
+                mpi_send(&count, 1, MPI_INT, dest, 0, compute_comm);
+                mpi_send(buf, count, mpi_particle_type, dest, 0, compute_comm);
+                benchmark.current.counters[COUNTER_MIGRATED_PARTICLES] += count;
+                if (n != 1) free(buf);
+            }
+        } else {
+            mpi_recv(&count, 1, MPI_INT, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+            if (num_my_regions == 1) {
+                int region = my_regions[0];
+                mpi_recv(&final_particles[region][offsets[region]], count, mpi_particle_type, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+                offsets[region] += count;
+            } else {
+                Particle *buf = malloc(count * sizeof(Particle));
+                mpi_recv(buf, count, mpi_particle_type, proc, 0, compute_comm, MPI_STATUS_IGNORE);
+                unpack_regions(count, buf, final_particles, offsets);
+                free(buf);
+            }
+        }
+    }
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_MIGRATE, lap);
+
+    /// Step 3: Truncate the sizes for all regions except the ones that received all particles from.
+    for (int region = 0; region < num_regions; region++) sizes[region] = decomp.owners[region] == my_proc ? total_sizes[region] : 0;
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_TRUNCATE, lap);
+
+    /// Step 4: Duplicate the final particles to other horizon processes which will need it.
+    for (int receiver = 0; receiver < num_cores; receiver++) {
+        for (int sender = 0; sender < num_cores; sender++) {
+            if (sender == receiver) continue;
+            if (my_proc != sender && my_proc != receiver) continue;
+
+            int n = get_halo_regions(sender, receiver, regions);
+            if (n == 0) continue;
+
+            if (sender == my_proc) {
+                Particle *buf = pack_regions(n, regions, sizes, final_particles, &count);
+                mpi_send(buf, count, mpi_particle_type, receiver, 0, compute_comm);
+                if (n != 1) free(buf);
+            } else {
+                if (n == 1) {
+                    mpi_recv(final_particles[regions[0]], total_sizes[regions[0]], mpi_particle_type, sender, 0, compute_comm, MPI_STATUS_IGNORE);
+                } else {
+                    count = 0;
+                    for (int i = 0; i < n; i++) count += total_sizes[regions[i]];
+
+                    Particle *buf = malloc(count * sizeof(Particle));
+                    mpi_recv(buf, count, mpi_particle_type, sender, 0, compute_comm, MPI_STATUS_IGNORE);
+                    unpack_regions(count, buf, final_particles, offsets);
+                    free(buf);
+                }
+
+                for (int i = 0; i < n; i++) {
+                    sizes[regions[i]] = total_sizes[regions[i]];
+                    benchmark.current.counters[COUNTER_HALO_PARTICLES] += total_sizes[regions[i]];
+                }
+            }
+        }
+    }
+    lap_benchmark_phase(&benchmark, PHASE_SYNC_HALO, lap);
+
+    free(regions);
+    free(offsets);
+    free(total_sizes);
+    deallocate_particles(particles, num_regions);
+
+    return final_particles;
+}
+
+/**
+ * Replays sync_particles_neighbours: the particles that moved into adjacent regions are only sent to the
+ * processes of those regions, and the halos are sent to the processes within the horizon, without blocking.
+ */
+Particle **sync_neighbours(int *sizes, Particle **particles)
+{
+    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int *regions = malloc(num_regions * sizeof(int));
+    MPI_Status status;
+    int count;
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+    long long lap = wall_clock_time();
+
+    MPI_Request *requests = malloc(2 * num_cores * sizeof(MPI_Request));
+    Particle **send_bufs = calloc(2 * num_cores, sizeof(Particle *));
+    int num_requests = 0;
+
+    /// Step 1: Send the particles that moved into an adjacent region to the process computing for it.
+    for (int dest = 0; dest < num_cores; dest++) {
+        if (!migration_peers[dest]) continue;
+
+        int n = get_owned_regions(decomp, dest, regions);
+        Particle *buf = pack_regions(n, regions, sizes, particles, &count);
+        if (n != 1) send_bufs[num_requests] = buf;
+
+        MPI_Isend(buf, count, mpi_particle_type, dest, TAG_MIGRATE, compute_comm, &requests[num_requests++]);
+        benchmark.current.counters[COUNTER_MIGRATED_PARTICLES] += count;
+    }
+
+    Particle **final_particles = calloc(num_regions, sizeof(Particle *));
+    int *final_sizes = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < num_my_regions; i++)
+        append_regions(sizes[my_regions[i]], particles[my_regions[i]], num_regions, final_particles, final_sizes);
+
+    for (int source = 0; source < num_cores; source++) {
+        if (!migration_peers[source]) continue;
+
+        mpi_probe(source, TAG_MIGRATE, compute_comm, &status);
+        MPI_Get_count(&status, mpi_particle_type, &count);
+
+        Particle *buf = malloc(count * sizeof(Particle));
+        mpi_recv(buf, count, mpi_particle_type, source, TAG_MIGRATE, compute_comm, MPI_STATUS_IGNORE);
+        append_regions(count, buf, num_regions, final_particles, final_sizes);
+        free(buf);
+    }
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_MIGRATE, lap);
+
+    /// Step 2: Truncate the sizes for all regions except my own.
+    memcpy(sizes, final_sizes, num_regions * sizeof(int));
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_TRUNCATE, lap);
+
+    /// Step 3: Duplicate the final particles to other horizon processes which will need it.
+    for (int receiver = 0; receiver < num_cores; receiver++) {
+        if (receiver == my_proc) continue;
+
+        int n = get_halo_regions(my_proc, receiver, regions);
+        if (n == 0) continue;
+
+        Particle *buf = pack_regions(n, regions, sizes, final_particles, &count);
+        if (n != 1) send_bufs[num_requests] = buf;
+        MPI_Isend(buf, count, mpi_particle_type, receiver, TAG_HALO, compute_comm, &requests[num_requests++]);
+    }
+
+    for (int sender = 0; sender < num_cores; sender++) {
+        if (sender == my_proc || get_halo_regions(sender, my_proc, regions) == 0) continue;
+
+        mpi_probe(sender, TAG_HALO, compute_comm, &status);
+        MPI_Get_count(&status, mpi_particle_type, &count);
+
+        Particle *buf = malloc(count * sizeof(Particle));
+        mpi_recv(buf, count, mpi_particle_type, sender, TAG_HALO, compute_comm, MPI_STATUS_IGNORE);
+        append_regions(count, buf, num_regions, final_particles, sizes);
+        benchmark.current.counters[COUNTER_HALO_PARTICLES] += count;
+        free(buf);
+    }
+
+    mpi_waitall(num_requests, requests, MPI_STATUSES_IGNORE);
+    lap_benchmark_phase(&benchmark, PHASE_SYNC_HALO, lap);
+
+    for (int i = 0; i < num_requests; i++) free(send_bufs[i]);
+    free(send_bufs);
+    free(requests);
+    free(regions);
+    free(final_sizes);
+    deallocate_particles(particles, num_regions);
+
+    return final_particles;
+}
+
+/**
+ * Packs the particles of the regions that each process needs into a single buffer, ordered by process,
+ * for MPI_Alltoallv. Returns the buffer, and the count and displacement of each process.
+ */
+Particle *pack_processes(int *sizes, Particle **particles, int (*get_regions)(int, int *), int *counts, int *displs)
+{
+    int num_cores = get_num_cores();
+    int *regions = malloc(decomp.num_regions * sizeof(int));
+
+    int total = 0;
+    for (int proc = 0; proc < num_cores; proc++) {
+        int n = get_regions(proc, regions);
+        counts[proc] = 0;
+        for (int i = 0; i < n; i++) counts[proc] += sizes[regions[i]];
+        displs[proc] = total;
+        total += counts[proc];
+    }
+
+    Particle *buf = malloc(total * sizeof(Particle));
+    for (int proc = 0; proc < num_cores; proc++) {
+        int n = get_regions(proc, regions);
+        for (int i = 0, offset = displs[proc]; i < n; offset += sizes[regions[i]], i++)
+            memcpy(&buf[offset], particles[regions[i]], sizes[regions[i]] * sizeof(Particle));
+    }
+
+    free(regions);
+    return buf;
+}
+
+/**
+ * Gets the regions of a process that this process migrates particles into.
+ */
+int get_migration_regions(int proc, int *regions)
+{
+    return proc == get_process_id() ? 0 : get_owned_regions(decomp, proc, regions);
+}
+
+/**
+ * Gets the regions of this process that a process needs for the horizon duplication.
+ */
+int get_my_halo_regions(int proc, int *regions)
+{
+    return proc == get_process_id() ? 0 : get_halo_regions(get_process_id(), proc, regions);
+}
+
+/**
+ * Exchanges the particles with a single MPI_Alltoallv for the migration, and another for the halo duplication,
+ * after summing up the sizes of all regions across all processes (in the same way as sync_particles).
+ */
+Particle **sync_alltoallv(int *sizes, Particle **particles)
+{
+    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
+    int my_proc = get_process_id();
+    int *regions = malloc(num_regions * sizeof(int));
+    int *send_counts = malloc(num_cores * sizeof(int));
+    int *send_displs = malloc(num_cores * sizeof(int));
+    int *recv_counts = malloc(num_cores * sizeof(int));
+    int *recv_displs = malloc(num_cores * sizeof(int));
+    BENCHMARK_SCOPE(&benchmark, PHASE_SYNC);
+    long long lap = wall_clock_time();
+
+    /// Step 1: Determine the total number of particles located in each region across all processes.
+    int *total_sizes = calloc(num_regions, sizeof(int));
+    MPI_Allreduce(sizes, total_sizes, num_regions, MPI_INT, MPI_SUM, compute_comm);
+    Particle **final_particles = allocate_particles(total_sizes, num_regions);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_SIZES, lap);
+
+    /// Step 2: Send the particles that moved into the regions of other processes in a single exchange.
+    int *offsets = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < num_my_regions; i++) {
+        int region = my_regions[i];
+        memcpy(final_particles[region], particles[region], sizes[region] * sizeof(Particle));
+        offsets[region] = sizes[region];
+    }
+
+    Particle *send_buf = pack_processes(sizes, particles, get_migration_regions, send_counts, send_displs);
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, compute_comm);
+    int count = 0;
+    for (int proc = 0; proc < num_cores; proc++) {
+        recv_displs[proc] = count;
+        count += recv_counts[proc];
+        benchmark.current.counters[COUNTER_MIGRATED_PARTICLES] += send_counts[proc];
+    }
+
+    Particle *recv_buf = malloc(count * sizeof(Particle));
+    MPI_Alltoallv(send_buf, send_counts, send_displs, mpi_particle_type, recv_buf, recv_counts, recv_displs, mpi_particle_type, compute_comm);
+    unpack_regions(count, recv_buf, final_particles, offsets);
+    free(send_buf);
+    free(recv_buf);
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_MIGRATE, lap);
+
+    /// Step 3: Truncate the sizes for all regions except my own.
+    for (int region = 0; region < num_regions; region++) sizes[region] = decomp.owners[region] == my_proc ? total_sizes[region] : 0;
+    lap = lap_benchmark_phase(&benchmark, PHASE_SYNC_TRUNCATE, lap);
+
+    /// Step 4: Duplicate the final particles to all horizon processes in a single exchange.
+    // The number of particles from each process is known from the total sizes of its regions.
+    send_buf = pack_processes(sizes, final_particles, get_my_halo_regions, send_counts, send_displs);
+    count = 0;
+    for (int proc = 0; proc < num_cores; proc++) {
+        int n = proc == my_proc ? 0 : get_halo_regions(proc, my_proc, regions);
+        recv_counts[proc] = 0;
+        for (int i = 0; i < n; i++) {
+            recv_counts[proc] += total_sizes[regions[i]];
+            sizes[regions[i]] = total_sizes[regions[i]];
+        }
+        recv_displs[proc] = count;
+        count += recv_counts[proc];
+    }
+    benchmark.current.counters[COUNTER_HALO_PARTICLES] += count;
+
+    recv_buf = malloc(count * sizeof(Particle));
+    MPI_Alltoallv(send_buf, send_counts, send_displs, mpi_particle_type, recv_buf, recv_counts, recv_displs, mpi_particle_type, compute_comm);
+    unpack_regions(count, recv_buf, final_particles, offsets);
+    free(send_buf);
+    free(recv_buf);
+    lap_benchmark_phase(&benchmark, PHASE_SYNC_HALO, lap);
+
+    free(regions);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(offsets);
+    free(total_sizes);
+    deallocate_particles(particles, num_regions);
+
+    return final_particles;
+}
+
+/**
+ * Runs a strategy for a configuration, and writes the timings of each run to a file in the output directory.
+ */
+void run_configuration(CommStrategy strategy, int horizon, int payload, char *outputdir, BenchmarkFormat format)
+{
+    Particle **(*sync)(int *, Particle **) = strategy == STRATEGY_ROUND_ROBIN ? sync_round_robin
+        : strategy == STRATEGY_NEIGHBOUR                                      ? sync_neighbours
+                                                                              : sync_alltoallv;
+    plan_exchange(horizon);
+    int *sizes = malloc(decomp.num_regions * sizeof(int));
+
+    benchmark.num_records = 0;
+    for (int run = 0; run < COMM_WARMUP_RUNS + COMM_RUNS; run++) {
+        Particle **particles = generate_exchange_particles(payload, sizes);
+
+        // Start all processes together, as after the barrier at the end of each time slot of pool.
+        MPI_Barrier(compute_comm);
+        start_benchmark_record(&benchmark, run - COMM_WARMUP_RUNS, get_process_id());
+        particles = sync(sizes, particles);
+        for (int i = 0; i < num_my_regions; i++) benchmark.current.counters[COUNTER_PARTICLES] += sizes[my_regions[i]];
+        end_benchmark_record(&benchmark);
+
+        deallocate_particles(particles, decomp.num_regions);
+        if (run < COMM_WARMUP_RUNS) benchmark.num_records = 0;
+    }
+
+    char benchmarkfile[4096];
+    snprintf(benchmarkfile, sizeof(benchmarkfile), "%s/%s-np%d-h%d-n%d.%s", outputdir, strategy_names[strategy], get_num_cores(), horizon, payload, format == BENCHMARK_FORMAT_CSV ? "csv" : "json");
+    write_benchmark(compute_comm, &benchmark, benchmarkfile, format);
+
+    // Summarise the exchange, as the time of the slowest process in the median run.
+    BenchmarkSummary summaries[NUM_BENCHMARK_PHASES];
+    summarise_benchmark(compute_comm, &benchmark, summaries);
+    if (is_master()) {
+        LL_NOTICE("%-10s  np %3d  horizon %d  payload %5d:  sync %9.1f us (sizes %9.1f, migrate %9.1f, halo %9.1f; wait %9.1f, transfer %9.1f)",
+            strategy_names[strategy],
+            get_num_cores(),
+            horizon,
+            payload,
+            summaries[PHASE_SYNC].p50 / 1e3,
+            summaries[PHASE_SYNC_SIZES].p50 / 1e3,
+            summaries[PHASE_SYNC_MIGRATE].p50 / 1e3,
+            summaries[PHASE_SYNC_HALO].p50 / 1e3,
+            summaries[PHASE_MPI_WAIT].p50 / 1e3,
+            summaries[PHASE_MPI_TRANSFER].p50 / 1e3);
+    }
+
+    free(sizes);
+    free_exchange();
+}
+
+int main(int argc, char **argv)
+{
+    multiproc_init(argc, argv);
+    set_log_level_env();
+    mpi_init_particle(&mpi_particle_type);
+    compute_comm = get_compute_comm();
+    BenchmarkFormat format = getenv_benchmark_format();
+
+    // Parse arguments: the output directory, optionally followed by a single strategy.
+    if (argc < 2) {
+        if (is_master()) LL("Usage: mpirun -np processors %s outputdir [roundrobin|neighbour|alltoallv]", PROG);
+        multiproc_finalize();
+        exit(EXIT_FAILURE);
+    }
+    char *outputdir = argv[1];
+    int only = -1;
+    for (int s = 0; argc > 2 && s < NUM_STRATEGIES; s++)
+        if (strcmp(argv[2], strategy_names[s]) == 0) only = s;
+    if (argc > 2 && only < 0) {
+        if (is_master()) LL_ERROR("Unknown strategy %s!", argv[2]);
+        multiproc_finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    for (int s = 0; s < NUM_STRATEGIES; s++) {
+        if (only >= 0 && s != only) continue;
+        for (int h = 0; h < (int)(sizeof(horizons) / sizeof(int)); h++)
+            for (int p = 0; p < (int)(sizeof(payloads) / sizeof(int)); p++)
+                run_configuration(s, horizons[h], payloads[p], outputdir, format);
+    }
+
+    free(benchmark.records);
+    multiproc_finalize();
+    return 0;
+}
@@ -4,58 +4,125 @@
  * For the sequential version of the program, we will run the 
  * entire procedure on a single process, although the number of
  * cores (supplied by the -np flag) will be used to determine the
- * number of regions that should be computed.
+ * number of regions that should be computed, laid out in the same
+ * process grid as the parallel version.
  */
 
 #include <assert.h>
 #include <mpi.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "simulation/health.h"
 #include "simulation/nbody.h"
 #include "utils/common.h"
+#include "utils/decomposition.h"
 #include "utils/env.h"
+#include "utils/framestream.h"
 #include "utils/heatmap.h"
 #include "utils/log.h"
 #include "utils/multiproc.h"
 #include "utils/particles.h"
+#include "utils/pyramid.h"
 #include "utils/regions.h"
 #include "utils/spec.h"
 #include "utils/timer.h"
 
 #define PROG "poolseq"
 #define TIMEBUF_LENGTH 10
+#define MAX_PENDING_FRAMES 4
 
 // Stores the specifications for the program.
 Spec spec;
 
+// Stores the decomposition of regions in the process grid.
+Decomposition decomp;
+
+// Format of the output heatmap (debug frames are always P3).
+OutputFormat output_format = OUTPUT_FORMAT_P3;
+
+// Debug frame waiting to be written, with a copy of the particles of all regions.
+typedef struct frame_t {
+    int frame_id;
+    int n;
+    Particle *particles;
+} Frame;
+
+// Format of the debug frames, which are only generated for every frame_decimation-th time slot.
+FrameFormat frame_format = FRAME_FORMAT_PPM;
+int frame_decimation = 1;
+int frame_downsample = 1;
+FrameStream *frame_stream = NULL;
+
+// Canvas of the entire pool, which is updated for each debug frame.
+IncrementalCanvas frame_canvas;
+
+// Number of background threads that write debug frames.
+int frame_writers = 0;
+pthread_t *frame_threads;
+char *frame_dir;
+
+// Bounded queue of debug frames waiting to be written by the frame writer threads.
+Frame frame_queue[MAX_PENDING_FRAMES];
+int frame_head = 0;
+int num_pending_frames = 0;
+int frames_finished = 0;
+pthread_mutex_t frame_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t frame_posted = PTHREAD_COND_INITIALIZER;
+pthread_cond_t frame_taken = PTHREAD_COND_INITIALIZER;
+
 // Store the total computation and communication time for all iterations.
 long long comp_sum = 0;
 
+// Checks the particles for numerical corruption every few time slots (if enabled).
+HealthMonitor health = { 0 };
+
 /**
  * Generates canvases for each region so that we can generate a PPM heatmap.
  */
-void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *outputfile)
+void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *outputfile, OutputFormat format)
 {
-    int num_cores = get_num_cores();
+    int canvas_length = spec.GridSize * spec.PoolLength;
 
     // Bail early if we have no output filename.
     if (outputfile == NULL) return;
 
-    // Allocate space for all canvases.
-    int ***all_canvases = malloc(num_cores * sizeof(int **));
-
-    // Generate canvas for each region.
-    for (int region_id = 0; region_id < num_cores; region_id++) {
+    // Draw each region onto a single canvas for the entire pool.
+    Canvas canvas = allocate_canvas(0, 0, canvas_length, canvas_length);
+    for (int region_id = 0; region_id < decomp.num_regions; region_id++) {
         print_particles(LOG_LEVEL_DEBUG, "Generating canvas for my region", sizes[region_id], particles_by_region[region_id]);
-        all_canvases[region_id] = generate_region_canvas(spec, sizes[region_id], particles_by_region[region_id], region_id);
+        draw_particles(spec, canvas, sizes[region_id], particles_by_region[region_id], region_id);
         LL_VERBOSE("Canvas generated for region %d.", region_id);
     }
 
-    // Generate the heatmap.
-    generate_heatmap(spec, num_cores, all_canvases, outputfile);
-    free(all_canvases);
+    // Generate the heatmap, encoding binary heatmaps on all available cores.
+    if (format == OUTPUT_FORMAT_P6)
+        generate_binary_heatmap(canvas, outputfile, sysconf(_SC_NPROCESSORS_ONLN));
+    else if (format == OUTPUT_FORMAT_TILES)
+        generate_pyramid(canvas, outputfile);
+    else
+        generate_heatmap(canvas, outputfile);
+    free_canvas(canvas);
+}
+
+/**
+ * Copies the particles of all regions into a single array.
+ */
+Particle *copy_all_particles(int *sizes, Particle **particles_by_region, int *n)
+{
+    *n = 0;
+    for (int region_id = 0; region_id < decomp.num_regions; region_id++) *n += sizes[region_id];
+
+    Particle *particles = malloc(*n * sizeof(Particle));
+    for (int region_id = 0, offset = 0; region_id < decomp.num_regions; region_id++) {
+        memcpy(&particles[offset], particles_by_region[region_id], sizes[region_id] * sizeof(Particle));
+        offset += sizes[region_id];
+    }
+
+    return particles;
 }
 
 /**
@@ -63,17 +130,121 @@ void collate_generate_heatmap(int *sizes, Particle **particles_by_region, char *
  */
 void generate_debug_frame(int frame_id, int *sizes, Particle **particles, char *framesdir)
 {
-    int outputdir_len = strlen(framesdir);
-    char *outputfile = malloc(outputdir_len + 20);
-    sprintf(outputfile, "%s/%d.ppm", framesdir, frame_id);
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    if (frame_canvas.canvas.cells == NULL) frame_canvas = allocate_incremental_canvas(allocate_canvas(0, 0, canvas_length, canvas_length));
+
+    // Only redraw the particles that have moved since the last frame.
+    int n;
+    Particle *all_particles = copy_all_particles(sizes, particles, &n);
+    update_incremental_canvas(spec, &frame_canvas, n, all_particles);
+    free(all_particles);
+
+    if (frame_format == FRAME_FORMAT_STREAM) {
+        write_frame_stream(frame_stream, frame_id, frame_canvas.canvas);
+    } else {
+        char *outputfile = malloc(strlen(framesdir) + 20);
+        sprintf(outputfile, "%s/%d.ppm", framesdir, frame_id);
+        generate_heatmap(frame_canvas.canvas, outputfile);
+        free(outputfile);
+    }
+}
 
-    FILE *fp = fopen(outputfile, "w");
-    if (fp == NULL) {
-        LL_ERROR("Could not open %s for writing debug frame to!", outputfile);
-        exit(EXIT_FAILURE);
+/**
+ * Main method for frame writer threads, which draw and write debug frames from the queue
+ * until there are no more frames.
+ */
+void *write_debug_frames(void *arg)
+{
+    (void)arg;
+    int canvas_length = spec.GridSize * spec.PoolLength;
+    char *outputfile = malloc(strlen(frame_dir) + 20);
+
+    // Only redraw the particles that have moved since the last frame of this thread.
+    IncrementalCanvas canvas = allocate_incremental_canvas(allocate_canvas(0, 0, canvas_length, canvas_length));
+
+    while (1) {
+        // Take the next frame from the queue.
+        pthread_mutex_lock(&frame_mutex);
+        while (num_pending_frames == 0 && !frames_finished) pthread_cond_wait(&frame_posted, &frame_mutex);
+        if (num_pending_frames == 0) {
+            pthread_mutex_unlock(&frame_mutex);
+            break;
+        }
+        Frame frame = frame_queue[frame_head];
+        frame_head = (frame_head + 1) % MAX_PENDING_FRAMES;
+        num_pending_frames--;
+        pthread_cond_signal(&frame_taken);
+        pthread_mutex_unlock(&frame_mutex);
+
+        // Draw and write the frame.
+        update_incremental_canvas(spec, &canvas, frame.n, frame.particles);
+        if (frame_format == FRAME_FORMAT_STREAM) {
+            write_frame_stream(frame_stream, frame.frame_id, canvas.canvas);
+        } else {
+            sprintf(outputfile, "%s/%d.ppm", frame_dir, frame.frame_id);
+            generate_heatmap(canvas.canvas, outputfile);
+        }
+        free(frame.particles);
     }
 
-    collate_generate_heatmap(sizes, particles, outputfile);
+    free_incremental_canvas(canvas);
+    free(outputfile);
+    return NULL;
+}
+
+/**
+ * Opens the frame stream in the frames directory.
+ */
+void open_debug_frame_stream(char *framesdir)
+{
+    char *outputfile = malloc(strlen(framesdir) + 20);
+    sprintf(outputfile, "%s/frames.bin", framesdir);
+    frame_stream = open_frame_stream(outputfile, spec.GridSize * spec.PoolLength, frame_downsample, frame_decimation);
+    free(outputfile);
+}
+
+/**
+ * Starts the frame writer threads, which write debug frames to the frames directory.
+ */
+void start_debug_frames(char *framesdir)
+{
+    frame_dir = framesdir;
+    frame_threads = malloc(frame_writers * sizeof(pthread_t));
+    for (int i = 0; i < frame_writers; i++) pthread_create(&frame_threads[i], NULL, write_debug_frames, NULL);
+}
+
+/**
+ * Posts a copy of the particles of all regions to the frame writer threads,
+ * without waiting for the frame to be written.
+ *
+ * At most MAX_PENDING_FRAMES frames are queued at a time, so that slow frame writers
+ * hold back the simulation rather than letting an unbounded number of frames build up.
+ */
+void post_debug_frame(int frame_id, int *sizes, Particle **particles_by_region)
+{
+    Frame frame = { .frame_id = frame_id };
+    frame.particles = copy_all_particles(sizes, particles_by_region, &frame.n);
+
+    pthread_mutex_lock(&frame_mutex);
+    while (num_pending_frames == MAX_PENDING_FRAMES) pthread_cond_wait(&frame_taken, &frame_mutex);
+    frame_queue[(frame_head + num_pending_frames) % MAX_PENDING_FRAMES] = frame;
+    num_pending_frames++;
+    pthread_cond_signal(&frame_posted);
+    pthread_mutex_unlock(&frame_mutex);
+}
+
+/**
+ * Waits for the frame writer threads to write all remaining debug frames.
+ */
+void finish_debug_frames()
+{
+    pthread_mutex_lock(&frame_mutex);
+    frames_finished = 1;
+    pthread_cond_broadcast(&frame_posted);
+    pthread_mutex_unlock(&frame_mutex);
+
+    for (int i = 0; i < frame_writers; i++) pthread_join(frame_threads[i], NULL);
+    free(frame_threads);
 }
 
 /**
@@ -81,65 +252,58 @@ void generate_debug_frame(int frame_id, int *sizes, Particle **particles, char *
  */
 Particle **execute_time_step(int *sizes, Particle **particles_by_region)
 {
-    int num_cores = get_num_cores();
+    int num_regions = decomp.num_regions;
     long double dt = spec.TimeStep;
 
     // Compute new velocities for all regions. Horizon is ignored for sequential computation.
-    for (int i = 0; i < num_cores; i++)
-        update_velocity(dt, spec, sizes, particles_by_region, num_cores, i);
+    for (int i = 0; i < num_regions; i++)
+        update_velocity(dt, spec, sizes, particles_by_region, num_regions, i, NULL);
 
     // Handle collisions for all particles, updating the velocity (direction) if necessary.
-    for (int i = 0; i < num_cores; i++)
-        handle_collisions(spec, sizes, particles_by_region, num_cores, i);
+    for (int i = 0; i < num_regions; i++)
+        handle_collisions(spec, sizes, particles_by_region, num_regions, i, NULL);
 
     // Handle collisions of particles against the walls of the pool.
-    for (int i = 0; i < num_cores; i++)
+    for (int i = 0; i < num_regions; i++)
         handle_wall_collisions(spec, sizes[i], particles_by_region[i], i);
 
     // Update the positions of all particles in all regions.
-    for (int i = 0; i < num_cores; i++)
+    for (int i = 0; i < num_regions; i++)
         update_position(dt, spec, sizes[i], particles_by_region[i], i);
 
     // Reallocate the particles into their correct regions.
-    Particle ***reallocated_particles = malloc(num_cores * sizeof(Particle **));
-    int **reallocated_sizes = malloc(num_cores * sizeof(int *));
-    for (int i = 0; i < num_cores; i++)
-        reallocated_sizes[i] = calloc(num_cores, sizeof(int));
-    for (int i = 0; i < num_cores; i++)
-        reallocated_particles[i] = reallocate_for_region(spec, reallocated_sizes[i], sizes[i], particles_by_region[i], num_cores);
-
-    for (int i = 0; i < num_cores; i++)
-        for (int j = 0; j < num_cores; j++)
-            print_particle_ids(LOG_LEVEL_DEBUG, "Dump of reallocated particles", reallocated_sizes[i][j], reallocated_particles[i][j]);
-
-    // Recompute the sizes for all regions based on what was allocated.
-    for (int i = 0; i < num_cores; i++)
-        sizes[i] = 0;
-    for (int i = 0; i < num_cores; i++)
-        for (int j = 0; j < num_cores; j++)
-            sizes[j] += reallocated_sizes[i][j];
-
-    print_ints(LOG_LEVEL_DEBUG, "Resultant region sizes", num_cores, sizes);
-
-    // Merge all regions back together.
-    Particle **merged_particles = allocate_particles(sizes, num_cores);
-    int *counters = calloc(num_cores, sizeof(int));
-    for (int process = 0; process < num_cores; process++) // "Process" number
-        for (int region = 0; region < num_cores; region++) // Region within the "process"
-            for (int k = 0, size = reallocated_sizes[process][region]; k < size; k++) // Particle within the region
-                merged_particles[region][counters[region]++] = reallocated_particles[process][region][k];
-
-    print_ints(LOG_LEVEL_DEBUG, "Merged region sizes", num_cores, counters);
+    int *regions = malloc(num_regions * sizeof(int));
+    for (int i = 0; i < num_regions; i++) regions[i] = i;
+    int *merged_sizes = calloc(num_regions, sizeof(int));
+    Particle **merged_particles = reallocate_for_regions(spec, merged_sizes, num_regions, regions, sizes, particles_by_region, num_regions);
+    memcpy(sizes, merged_sizes, num_regions * sizeof(int));
+
+    print_ints(LOG_LEVEL_DEBUG, "Merged region sizes", num_regions, sizes);
 
     // Free all dynamically allocated memory.
-    for (int i = 0; i < num_cores; i++) free(reallocated_sizes[i]);
-    free(reallocated_sizes);
-    free(counters);
-    deallocate_particles(particles_by_region, num_cores);
+    free(regions);
+    free(merged_sizes);
+    deallocate_particles(particles_by_region, num_regions);
 
     return merged_particles;
 }
 
+/**
+ * Checks the health of the particles in all regions, and stops the simulation if they are corrupted.
+ */
+void check_particle_health(int time_slot, int *sizes, Particle **particles_by_region)
+{
+    HealthSample sample = { 0 };
+    for (int i = 0; i < decomp.num_regions; i++) {
+        sample_health(spec, sizes[i], particles_by_region[i], i, &sample);
+        if (health.energy_drift > 0) sample_potential_energy(spec, sizes, particles_by_region, decomp.num_regions, i, NULL, &sample);
+    }
+    if (!check_health(MPI_COMM_SELF, &health, time_slot, sample)) {
+        flush_log();
+        exit(EXIT_FAILURE);
+    }
+}
+
 /**
  * Runs the simulation according to the provided specifications.
  */
@@ -148,9 +312,20 @@ Particle **run_simulation(int *sizes, Particle **particles_by_region, char *fram
     long long start, end;
     char timebuf[TIMEBUF_LENGTH];
 
+    if (framesdir != NULL && frame_format == FRAME_FORMAT_STREAM) open_debug_frame_stream(framesdir);
+    if (framesdir != NULL && frame_writers > 0) start_debug_frames(framesdir);
+
     for (int i = 0; i < spec.TimeSlots; i++) {
+        // Periodically check the particles, instead of checking every interaction.
+        if (health.interval > 0 && i % health.interval == 0) check_particle_health(i, sizes, particles_by_region);
+
         // If debugging of frames is enabled, generate a frame and save it to the frames directory.
-        if (framesdir != NULL) generate_debug_frame(i, sizes, particles_by_region, framesdir);
+        if (framesdir != NULL && i % frame_decimation == 0) {
+            if (frame_writers > 0)
+                post_debug_frame(i, sizes, particles_by_region);
+            else
+                generate_debug_frame(i, sizes, particles_by_region, framesdir);
+        }
 
         // Execute time step.
         start = wall_clock_time();
@@ -161,6 +336,10 @@ Particle **run_simulation(int *sizes, Particle **particles_by_region, char *fram
         LL_VERBOSE("Computation time for iteration %4.0d: %s seconds", i + 1, timebuf);
     }
 
+    if (health.interval > 0) check_particle_health(spec.TimeSlots, sizes, particles_by_region);
+    if (framesdir != NULL && frame_writers > 0) finish_debug_frames();
+    if (frame_stream != NULL) close_frame_stream(frame_stream);
+
     return particles_by_region;
 }
 
@@ -170,7 +349,6 @@ Particle **run_simulation(int *sizes, Particle **particles_by_region, char *fram
  */
 void collate_timings(char *reportfile)
 {
-    int num_cores = get_num_cores();
     char timebuf[TIMEBUF_LENGTH];
 
     // Print the report on the master process.
@@ -178,7 +356,7 @@ void collate_timings(char *reportfile)
         LL_SUCCESS("%s", "============================");
         LL_SUCCESS("%s", "    Pool Simulator Report   ");
         LL_SUCCESS("%s", "============================");
-        LL_SUCCESS("Number of regions:    %d", num_cores);
+        LL_SUCCESS("Number of regions:    %d", decomp.pool_length * decomp.pool_length);
         LL_SUCCESS("Number of iterations: %d", spec.TimeSlots);
         LL_SUCCESS("Particles per region: %d", spec.TotalNumberOfParticles);
         LL_SUCCESS("%s", "============================");
@@ -200,7 +378,7 @@ void collate_timings(char *reportfile)
             fprintf(fp, "%s\n", "============================");
             fprintf(fp, "%s\n", "    Pool Simulator Report   ");
             fprintf(fp, "%s\n", "============================");
-            fprintf(fp, "Number of regions:    %d\n", num_cores);
+            fprintf(fp, "Number of regions:    %d\n", decomp.pool_length * decomp.pool_length);
             fprintf(fp, "Number of iterations: %d\n", spec.TimeSlots);
             fprintf(fp, "Particles per region: %d\n", spec.TotalNumberOfParticles);
             fprintf(fp, "%s\n", "============================");
@@ -225,24 +403,35 @@ void start(char *specfile, char *outputfile, char *reportfile, char *framesdir)
 {
     int num_cores = get_num_cores();
 
-    LL_NOTICE("Starting %s with %d region(s) on %d processor(s)...", PROG, get_num_cores(), get_num_cores());
+    LL_NOTICE("Starting %s on %d processor(s)...", PROG, get_num_cores());
+
+    // Lay out the "processes" in a grid, in the same way as the parallel version.
+    spec = parse_spec_file(specfile);
+    print_spec(spec);
+    decomp = decompose_spec(&spec, num_cores, 1);
 
     // Allocate space for particles and their array sizes.
-    int *sizes = calloc(num_cores, sizeof(int));
-    Particle **particles_by_region = allocate_particles(sizes, num_cores);
+    int num_regions = decomp.num_regions;
+    int *sizes = calloc(num_regions, sizeof(int));
+    int *process_sizes = calloc(num_regions, sizeof(int));
+    Particle **particles_by_region = allocate_particles(sizes, num_regions);
 
     for (int i = 0; i < num_cores; i++) {
-        // Read the specification file, which will generate large particles.
-        spec = read_spec_file(i, specfile);
-
-        // Generate particles for this region.
-        particles_by_region[i] = generate_particles(i, spec);
-        sizes[i] = spec.TotalNumberOfParticles;
+        // Generate the share of particles of this "process", and append them to their regions.
+        Particle **process_particles = generate_process_particles(spec, decomp, i, process_sizes, sysconf(_SC_NPROCESSORS_ONLN));
+        for (int region = 0; region < num_regions; region++) {
+            if (process_sizes[region] == 0) continue;
+            particles_by_region[region] = realloc(particles_by_region[region], (sizes[region] + process_sizes[region]) * sizeof(Particle));
+            memcpy(&particles_by_region[region][sizes[region]], process_particles[region], process_sizes[region] * sizeof(Particle));
+            sizes[region] += process_sizes[region];
+        }
+        deallocate_particles(process_particles, num_regions);
     }
 
-    // Debug print all read-in values.
-    print_spec(spec);
-    print_canvas_info(spec);
+    free(process_sizes);
+
+    // Debug print info about the canvas.
+    print_canvas_info(spec, decomp);
 
     // Run the simulation only in the region assigned.
     LL_NOTICE("Simulation is starting on %d core(s).", get_num_cores());
@@ -253,13 +442,22 @@ void start(char *specfile, char *outputfile, char *reportfile, char *framesdir)
     collate_timings(reportfile);
 
     // Collate particles and generate the heatmap on the master process.
-    collate_generate_heatmap(sizes, particles_by_region, outputfile);
+    collate_generate_heatmap(sizes, particles_by_region, outputfile, output_format);
 }
 
 int main(int argc, char **argv)
 {
     multiproc_init(argc, argv);
     set_log_level_env();
+    output_format = getenv_output_format();
+    frame_writers = getenv_frame_writers();
+    frame_format = getenv_frame_format();
+    frame_decimation = getenv_frame_decimation();
+    frame_downsample = getenv_frame_downsample();
+    health = create_health_monitor_env();
+
+    // Frames must be appended to a frame stream in order, so only a single thread can write them.
+    if (frame_format == FRAME_FORMAT_STREAM && frame_writers > 1) frame_writers = 1;
 
     // Parse arguments.
     check_arguments(argc, PROG);
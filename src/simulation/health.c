@@ -0,0 +1,157 @@
+#include <math.h>
+#include <mpi.h>
+
+#include "../utils/env.h"
+#include "../utils/log.h"
+#include "../utils/regions.h"
+#include "../utils/types.h"
+#include "health.h"
+#include "nbody.h"
+
+/**
+ * Creates a health monitor with the configuration of the environment.
+ */
+HealthMonitor create_health_monitor_env()
+{
+    return (HealthMonitor){
+        .interval = getenv_health_interval(),
+        .energy_drift = getenv_health_energy_drift(),
+        .momentum_drift = getenv_health_momentum_drift(),
+        .angular_momentum_drift = getenv_health_angular_momentum_drift(),
+    };
+}
+
+/**
+ * Returns 1 if the position and velocity of a particle are finite.
+ */
+int is_particle_finite(Particle p)
+{
+    return isfinite(p.x) && isfinite(p.y) && isfinite(p.vx) && isfinite(p.vy);
+}
+
+/**
+ * Adds the particles of a region to a sample, except for their potential energy.
+ */
+void sample_health(Spec spec, int size, Particle *particles, int region_id, HealthSample *sample)
+{
+    long double centre = spec.GridSize * spec.PoolLength / 2.0L;
+
+    for (int i = 0; i < size; i++) {
+        Particle p0 = particles[i];
+        sample->num_particles++;
+
+        // Non-finite particles would poison the sums, so they are only counted.
+        if (!is_particle_finite(p0)) {
+            if (sample->num_non_finite == 0)
+                LL_ERROR("Particle %d in region %d is not finite: (x, y) = (%0.9Lf, %0.9Lf); (vx, vy) = (%0.9Lf, %0.9Lf)", p0.id, region_id, p0.x, p0.y, p0.vx, p0.vy);
+            sample->num_non_finite++;
+            continue;
+        }
+
+        long double x0 = denorm_region_x(p0.x, region_id, spec);
+        long double y0 = denorm_region_y(p0.y, region_id, spec);
+        long double angular_momentum = p0.mass * ((x0 - centre) * p0.vy - (y0 - centre) * p0.vx);
+
+        sample->kinetic_energy += 0.5L * p0.mass * (p0.vx * p0.vx + p0.vy * p0.vy);
+        sample->momentum_x += p0.mass * p0.vx;
+        sample->momentum_y += p0.mass * p0.vy;
+        sample->angular_momentum += angular_momentum;
+        sample->momentum_scale += p0.mass * sqrtl(p0.vx * p0.vx + p0.vy * p0.vy);
+        sample->angular_momentum_scale += fabsl(angular_momentum);
+    }
+}
+
+/**
+ * Adds the potential energy of the particles of a region to a sample.
+ */
+void sample_potential_energy(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *near_regions, HealthSample *sample)
+{
+    for (int i = 0; i < sizes[region_id]; i++) {
+        Particle p0 = particles_by_region[region_id][i];
+        if (!is_particle_finite(p0)) continue;
+
+        long double x0 = denorm_region_x(p0.x, region_id, spec);
+        long double y0 = denorm_region_y(p0.y, region_id, spec);
+
+        // Compute the (softened) potential energy of p0 against each particle in all regions (within the horizon).
+        for (int region = 0; region < num_regions; region++) {
+            if (near_regions != NULL && !near_regions[region]) continue;
+            for (int j = 0; j < sizes[region]; j++) {
+                if (region == region_id && i == j) continue;
+
+                Particle p1 = particles_by_region[region][j];
+                if (!is_particle_finite(p1)) continue;
+
+                long double dx = denorm_region_x(p1.x, region, spec) - x0;
+                long double dy = denorm_region_y(p1.y, region, spec) - y0;
+                long double dist = sqrtl(dx * dx + dy * dy + SOFTENING_PARAM * SOFTENING_PARAM);
+                sample->potential_energy -= 0.5L * p0.mass * p1.mass / dist;
+            }
+        }
+    }
+}
+
+/**
+ * Returns the drift of a quantity relative to a scale, which is 0 if the scale is 0 (e.g. all particles are at rest).
+ */
+long double get_drift(long double change, long double scale)
+{
+    return scale > 0 ? fabsl(change) / scale : 0;
+}
+
+/**
+ * Checks the drift of a quantity against its threshold, if it has one.
+ */
+int check_drift(const char *quantity, long double drift, double threshold, int time_slot)
+{
+    if (threshold <= 0 || drift <= threshold) return 1;
+
+    if (is_master()) LL_ERROR("Drift of %s at time slot %d is %0.3Le, which exceeds %0.3e!", quantity, time_slot, drift, threshold);
+    return 0;
+}
+
+/**
+ * Reduces the samples of all processes of a communicator, and checks them against the first check.
+ */
+int check_health(MPI_Comm comm, HealthMonitor *monitor, int time_slot, HealthSample sample)
+{
+    HealthSample total;
+    MPI_Allreduce(&sample, &total, HEALTH_SAMPLE_FIELD_COUNT, MPI_LONG_DOUBLE, MPI_SUM, comm);
+
+    if (total.num_non_finite > 0) {
+        if (is_master()) LL_ERROR("%0.0Lf of %0.0Lf particle(s) are not finite at time slot %d!", total.num_non_finite, total.num_particles, time_slot);
+        return 0;
+    }
+
+    if (!monitor->has_baseline) {
+        monitor->baseline = total;
+        monitor->has_baseline = 1;
+    }
+
+    // Find the drift of each quantity since the first check, relative to the magnitudes of its parts,
+    // since the particles may start at rest.
+    HealthSample base = monitor->baseline;
+    long double energy = total.kinetic_energy + total.potential_energy;
+    long double energy_drift = get_drift(energy - base.kinetic_energy - base.potential_energy, total.kinetic_energy - total.potential_energy);
+    long double momentum_drift = get_drift(hypotl(total.momentum_x - base.momentum_x, total.momentum_y - base.momentum_y), total.momentum_scale);
+    long double angular_momentum_drift = get_drift(total.angular_momentum - base.angular_momentum, total.angular_momentum_scale);
+
+    if (is_master()) {
+        LL_VERBOSE2("Health at time slot %d: energy = %0.9Le (drift %0.3Le), momentum = (%0.9Le, %0.9Le) (drift %0.3Le), angular momentum = %0.9Le (drift %0.3Le)",
+            time_slot,
+            energy,
+            energy_drift,
+            total.momentum_x,
+            total.momentum_y,
+            momentum_drift,
+            total.angular_momentum,
+            angular_momentum_drift);
+    }
+
+    // The energy is only checked if its potential energy was sampled.
+    int healthy = check_drift("energy", energy_drift, monitor->energy_drift, time_slot);
+    healthy &= check_drift("momentum", momentum_drift, monitor->momentum_drift, time_slot);
+    healthy &= check_drift("angular momentum", angular_momentum_drift, monitor->angular_momentum_drift, time_slot);
+
+    return healthy;
+}
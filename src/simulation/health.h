@@ -0,0 +1,99 @@
+#include <mpi.h>
+
+#include "../utils/types.h"
+
+/**
+ * The health monitor periodically checks the particles for numerical corruption, in a separate pass over the
+ * particles of each process rather than within the computation of every interaction. Each check counts the
+ * particles with non-finite positions or velocities, and sums the conserved quantities of the particles:
+ * total energy, momentum and angular momentum (about the centre of the pool).
+ *
+ * The quantities are only conserved approximately, since gravity is cut off beyond the horizon (and summarised
+ * beyond the multipole horizon, which is not included in the potential energy) and the walls reflect particles,
+ * so their drift since the first check is only an error once it exceeds a threshold.
+ *
+ * The potential energy costs as much as a velocity update, so it is only sampled if the drift of the energy
+ * is checked. Otherwise, the energy only consists of the kinetic energy.
+ */
+
+/**
+ * Sums over the particles of a process (or of all processes, once reduced).
+ */
+typedef struct health_sample_t {
+    long double kinetic_energy;
+    long double potential_energy;
+    long double momentum_x;
+    long double momentum_y;
+    long double angular_momentum;
+
+    // Sums of the magnitudes of the momenta and angular momenta of each particle, which the drift of the
+    // (vector) totals is relative to, since the totals themselves may cancel out to zero.
+    long double momentum_scale;
+    long double angular_momentum_scale;
+
+    long double num_particles;
+    long double num_non_finite;
+} HealthSample;
+
+#define HEALTH_SAMPLE_FIELD_COUNT (sizeof(HealthSample) / sizeof(long double))
+
+/**
+ * Configuration of the health monitor, and the sample of its first check.
+ */
+typedef struct health_monitor_t {
+    // Number of time slots between checks (0 disables the monitor).
+    int interval;
+
+    // Maximum relative drift of each quantity since the first check (0 disables the check of the quantity).
+    double energy_drift;
+    double momentum_drift;
+    double angular_momentum_drift;
+
+    HealthSample baseline;
+    int has_baseline;
+} HealthMonitor;
+
+/**
+ * Creates a health monitor with the configuration of the environment.
+ */
+HealthMonitor create_health_monitor_env();
+
+/**
+ * Adds the particles of a region to a sample, except for their potential energy (see sample_potential_energy),
+ * which takes a single pass over the particles of the region.
+ *
+ * @param spec          The program specification.
+ * @param size          Size of the particles array.
+ * @param particles     Array of particles to add.
+ * @param region_id     The region that these particles reside in.
+ * @param sample        The sample to add to.
+ */
+void sample_health(Spec spec, int size, Particle *particles, int region_id, HealthSample *sample);
+
+/**
+ * Adds the potential energy of the particles of a region to a sample. The potential energy of each particle
+ * is computed against the same particles as the exact part of its velocity (see update_velocity), and is split
+ * evenly between both particles of each pair, so that the samples of all regions add up to the total energy.
+ *
+ * @param spec                  The program specification.
+ * @param sizes                 Sizes of each array in particles_by_region.
+ * @param particles_by_region   2-D array of particles, indexed by region ID.
+ * @param num_regions           The number of regions.
+ * @param region_id             The region whose particles should be added.
+ * @param near_regions          Flags for each region, indexed by region ID, of whether it lies within the (near)
+ *                              horizon of the region. May be NULL, to use all regions.
+ * @param sample                The sample to add to.
+ */
+void sample_potential_energy(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *near_regions, HealthSample *sample);
+
+/**
+ * Reduces the samples of all processes of a communicator, and checks them against the first check.
+ * Every process returns the same result. This must be called collectively by all processes of the communicator.
+ *
+ * @param comm          The communicator of all processes which sampled their particles.
+ * @param monitor       The health monitor.
+ * @param time_slot     The current time slot.
+ * @param sample        The sample of this process.
+ * @return              Returns 1 if the particles are healthy, or 0 (after logging the errors) otherwise.
+ */
+int check_health(MPI_Comm comm, HealthMonitor *monitor, int time_slot, HealthSample sample);
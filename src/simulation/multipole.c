@@ -0,0 +1,90 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../utils/log.h"
+#include "../utils/regions.h"
+#include "../utils/types.h"
+#include "multipole.h"
+#include "nbody.h"
+
+Multipole compute_multipole(Spec spec, int size, Particle *particles, int region_id)
+{
+    Multipole m = { 0 };
+
+    for (int i = 0; i < size; i++) {
+        Particle p = particles[i];
+        long double x = denorm_region_x(p.x, region_id, spec);
+        long double y = denorm_region_y(p.y, region_id, spec);
+
+        m.mass += p.mass;
+        m.mx += p.mass * x;
+        m.my += p.mass * y;
+        m.mxx += p.mass * x * x;
+        m.mxy += p.mass * x * y;
+        m.myy += p.mass * y * y;
+    }
+
+    LL_DEBUG("Multipole for region %d: mass = %0.9Lf, moments = (%0.9Lf, %0.9Lf)", region_id, m.mass, m.mx, m.my);
+
+    return m;
+}
+
+/**
+ * Computes the far-field velocity update for each particle in the given region.
+ *
+ * The potential of a region is expanded up to the quadrupole term about its centre of mass:
+ *   phi(r) = -M / |r| - (r . Q . r) / (2 |r|^5)
+ * where Q is the traceless quadrupole tensor. The resultant force is then m * -grad(phi).
+ */
+void update_velocity_multipole(long double dt, Spec spec, int size, Particle *particles, int region_id, Multipole *multipoles, int num_regions, char *far_regions)
+{
+    for (int region = 0; region < num_regions; region++) {
+        Multipole m = multipoles[region];
+
+        // Only use summaries for regions beyond the near horizon, but within the horizon.
+        if (region == region_id || !far_regions[region] || m.mass <= 0) continue;
+
+        // Shift the moments to be about the centre of mass.
+        long double cx = m.mx / m.mass;
+        long double cy = m.my / m.mass;
+        long double ixx = m.mxx - m.mass * cx * cx;
+        long double ixy = m.mxy - m.mass * cx * cy;
+        long double iyy = m.myy - m.mass * cy * cy;
+
+        // Traceless quadrupole tensor (all particles lie on the z = 0 plane).
+        long double qxx = 2 * ixx - iyy;
+        long double qxy = 3 * ixy;
+        long double qyy = 2 * iyy - ixx;
+
+        LL_DEBUG2("Far-field region %d: mass = %0.9Lf, centre = (%0.9Lf, %0.9Lf)", region, m.mass, cx, cy);
+
+        for (int i = 0; i < size; i++) {
+            Particle p = particles[i];
+
+            // Displacement of the particle from the centre of mass.
+            long double rx = denorm_region_x(p.x, region_id, spec) - cx;
+            long double ry = denorm_region_y(p.y, region_id, spec) - cy;
+            long double r2 = rx * rx + ry * ry + SOFTENING_PARAM * SOFTENING_PARAM;
+            long double r1 = sqrtl(r2);
+            long double r5 = r2 * r2 * r1;
+
+            // Monopole term, which attracts the particle towards the centre of mass.
+            long double ax = -m.mass * rx / (r2 * r1);
+            long double ay = -m.mass * ry / (r2 * r1);
+
+            // Quadrupole term.
+            long double qrx = qxx * rx + qxy * ry;
+            long double qry = qxy * rx + qyy * ry;
+            long double rqr = rx * qrx + ry * qry;
+            ax += qrx / r5 - 2.5L * rqr * rx / (r5 * r2);
+            ay += qry / r5 - 2.5L * rqr * ry / (r5 * r2);
+
+            particles[i].vx += dt * p.mass * ax;
+            particles[i].vy += dt * p.mass * ay;
+
+            assert(!isnan(particles[i].vx) && !isnan(particles[i].vy) && isfinite(particles[i].vx) && isfinite(particles[i].vy));
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#include "../utils/types.h"
+
+/**
+ * Number of long double fields in the Multipole struct.
+ * Used to send arrays of Multipole structs as MPI_LONG_DOUBLE.
+ */
+#define MULTIPOLE_FIELD_COUNT 6
+
+/**
+ * Computes the multipole summary (total mass, centre of mass and quadrupole moments)
+ * of all particles within a single region.
+ *
+ * @param spec          The program specification.
+ * @param size          Size of the particles array.
+ * @param particles     Array of particles to summarise.
+ * @param region_id     The region that these particles reside in.
+ * @return              Returns the summary of the region, with moments taken about the origin.
+ */
+Multipole compute_multipole(Spec spec, int size, Particle *particles, int region_id);
+
+/**
+ * Computes the far-field velocity update for each particle in the given region,
+ * using only the multipole summaries of the given far regions (i.e. those that lie
+ * beyond the near horizon, but still within the horizon of the spec).
+ *
+ * Regions within the near horizon are expected to be computed exactly
+ * with update_velocity, and must not be marked as far regions.
+ *
+ * @param dt                The time step value.
+ * @param spec              The program specification.
+ * @param size              Size of the particles array.
+ * @param particles         Array of particles whose velocities should be updated.
+ * @param region_id         The region that these particles reside in.
+ * @param multipoles        Multipole summaries, indexed by region ID.
+ * @param num_regions       The number of regions.
+ * @param far_regions       Flags for each region, indexed by region ID, of whether its summary should be used.
+ */
+void update_velocity_multipole(long double dt, Spec spec, int size, Particle *particles, int region_id, Multipole *multipoles, int num_regions, char *far_regions);
@@ -10,8 +10,7 @@
 #include "../utils/regions.h"
 #include "../utils/types.h"
 #include "../utils/vector.h"
-
-#define SOFTENING_PARAM 0.0001F
+#include "nbody.h"
 
 void update_position(long double dt, Spec spec, int size, Particle *particles, int region_id)
 {
@@ -53,16 +52,21 @@ void update_position(long double dt, Spec spec, int size, Particle *particles, i
         LL_DEBUG2("  Velocity   = (%0.9Lf, %0.9Lf), Displacement = (%0.9Lf, %0.9Lf)", p.vx, p.vy, dt * p.vx, dt * p.vy);
         LL_DEBUG("  New (x, y) = (%0.9Lf, %0.9Lf)", p.x, p.y);
 
-        // Perform assertions to aid debugging.
+        // Perform assertions to aid debugging (compiled out with NDEBUG, in favour of the health monitor).
+#ifndef NDEBUG
         if (isnan(p.x) || isnan(p.y) || !isfinite(p.x) || !isfinite(p.y)) {
             LL_ERROR("Assertion failed: (x,y) = (%0.9Lf, %0.9Lf); (vx, vy) = (%0.9Lf, %0.9Lf)", p.x, p.y, p.vx, p.vy);
             assert(!isnan(p.x) && !isnan(p.y) && isfinite(p.x) && isfinite(p.y));
         }
+#endif
     }
 }
 
 Particle **reallocate_for_region(Spec spec, int *sizes, int num_particles, Particle *particles, int num_regions)
 {
+    // The spec is only used in assertions, which may be compiled out.
+    (void)spec;
+
     // Truncate the sizes of all regions first.
     for (int i = 0; i < num_regions; i++) sizes[i] = 0;
 
@@ -110,6 +114,45 @@ Particle **reallocate_for_region(Spec spec, int *sizes, int num_particles, Parti
     return new_particles;
 }
 
+Particle **reallocate_for_regions(Spec spec, int *sizes, int num_sources, int *source_regions, int *source_sizes, Particle **particles_by_region, int num_regions)
+{
+    // The spec is only used in assertions, which may be compiled out.
+    (void)spec;
+
+    // Compute the number of particles in their resultant regions, across all source regions.
+    for (int i = 0; i < num_regions; i++) sizes[i] = 0;
+    for (int s = 0; s < num_sources; s++) {
+        int source = source_regions[s];
+        for (int i = 0; i < source_sizes[source]; i++) sizes[particles_by_region[source][i].region]++;
+    }
+
+    print_ints(LOG_LEVEL_DEBUG2, "Resultant sizes after updating positions", num_regions, sizes);
+
+    // Keep track of number of particles stored within each region.
+    int *counters = calloc(num_regions, sizeof(int));
+    assert(counters != NULL);
+
+    Particle **new_particles = allocate_particles(sizes, num_regions);
+    assert(new_particles != NULL);
+
+    // Append each particle into the array of its resultant region.
+    for (int s = 0; s < num_sources; s++) {
+        int source = source_regions[s];
+        for (int i = 0; i < source_sizes[source]; i++) {
+            int region = particles_by_region[source][i].region;
+            new_particles[region][counters[region]++] = particles_by_region[source][i];
+            assert(counters[region] <= spec.TotalNumberOfParticles * num_regions);
+        }
+    }
+
+    // Ensure that the sizes for counters and tabulated sizes are equal.
+    for (int i = 0; i < num_regions; i++) assert(counters[i] == sizes[i]);
+
+    free(counters);
+
+    return new_particles;
+}
+
 /**
  * Computes the new velocity for each particle for a given timestep, only for the given region ID.
  * Uses all other regions' particles to compute the force on the region's particles, in order to
@@ -117,7 +160,7 @@ Particle **reallocate_for_region(Spec spec, int *sizes, int num_particles, Parti
  * 
  * This method uses Newton's law of universal gravitation.
  */
-void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id)
+void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *near_regions)
 {
     // Iterate through all particles in the given region.
     for (int i = 0; i < sizes[region_id]; i++) {
@@ -129,8 +172,9 @@ void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles
         LL_DEBUG("+ p0(x, y)        = (%0.9Lf, %0.9Lf)", p0.x, p0.y);
         LL_DEBUG("  denorm_p0(x, y) = (%0.9Lf, %0.9Lf)", denorm_region_x(p0.x, region_id, spec), denorm_region_y(p0.y, region_id, spec));
 
-        // Compute the force of each particle in all regions on p0.
+        // Compute the force of each particle in all regions (within the horizon) on p0.
         for (int region = 0; region < num_regions; region++) {
+            if (near_regions != NULL && !near_regions[region]) continue;
             for (int j = 0; j < sizes[region]; j++) {
                 // Don't compute the force of a particle on itself.
                 if (region == region_id && i == j) continue;
@@ -177,7 +221,7 @@ void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles
  * Updates the velocities of any particles in this process' region
  * if it is colliding with any other particle.
  */
-void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id)
+int handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *flags)
 {
     // Count the number of collisions we handled in total.
     int total_collisions = 0;
@@ -195,6 +239,9 @@ void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, in
 
         // Check for collisions against all other particles in every region.
         for (int region = 0; region < num_regions; region++) {
+            // Collisions against a lower region computed by the caller have already been handled.
+            if (flags != NULL && region < region_id && (flags[region] & REGION_COMPUTED)) continue;
+
             for (int j = 0; j < sizes[region]; j++) {
                 // Don't collide with yourself; don't double-count
                 // collisions of two particles in the same region.
@@ -225,6 +272,14 @@ void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, in
                 LL_DEBUG("  + Collision detected between (%d, %d) and (%d, %d)!", region_id, p1.id, region, p2.id);
                 total_collisions++;
 
+                // Copy a read-only region before its first update, so that its particles can be updated locally.
+                if (flags != NULL && (flags[region] & REGION_READ_ONLY)) {
+                    Particle *copy = malloc(sizes[region] * sizeof(Particle));
+                    memcpy(copy, particles_by_region[region], sizes[region] * sizeof(Particle));
+                    particles_by_region[region] = copy;
+                    flags[region] &= ~REGION_READ_ONLY;
+                }
+
                 // Handle the case when the particles overlap, AND their unit vectors are equal.
                 // Add an arbitrary constant to both x and y velocities so that they are different.
                 if (vec_len(pos_diff) == 0 && vec_normalize(vel1).x == vec_normalize(vel2).x && vec_normalize(vel1).y == vec_normalize(vel2).y) {
@@ -275,7 +330,8 @@ void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, in
                 p1 = particles_by_region[region_id][i];
                 p2 = particles_by_region[region][j];
 
-                // Perform assertions to aid debugging.
+                // Perform assertions to aid debugging (compiled out with NDEBUG, in favour of the health monitor).
+#ifndef NDEBUG
                 if (isnan(p1.x) || isnan(p1.y) || !isfinite(p1.x) || !isfinite(p1.y)
                     || isnan(p2.x) || isnan(p2.y) || !isfinite(p2.x) || !isfinite(p2.y)
                     || isnan(p1.vx) || isnan(p1.vy) || !isfinite(p1.vx) || !isfinite(p1.vy)
@@ -289,17 +345,19 @@ void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, in
                     assert(!isnan(p1.vx) && !isnan(p1.vy) && isfinite(p1.vx) && isfinite(p1.vy));
                     assert(!isnan(p2.vx) && !isnan(p2.vy) && isfinite(p2.vx) && isfinite(p2.vy));
                 }
+#endif
             }
         }
     }
 
     LL_VERBOSE2("Total number of particle collisions for region %d: %d", region_id, total_collisions);
+    return total_collisions;
 }
 
 /**
  * Handle collisions against the walls of the pool area.
  */
-void handle_wall_collisions(Spec spec, int size, Particle *particles, int region_id)
+int handle_wall_collisions(Spec spec, int size, Particle *particles, int region_id)
 {
     // Count the number of collisions we handled in total.
     int total_collisions = 0;
@@ -348,11 +406,12 @@ void handle_wall_collisions(Spec spec, int size, Particle *particles, int region
             total_collisions++;
         }
 
-        // Perform assertions to aid debugging.
+        // Perform assertions to aid debugging (compiled out with NDEBUG, in favour of the health monitor).
         p = particles[i];
         assert(!isnan(p.x) && !isnan(p.y) && isfinite(p.x) && isfinite(p.y));
         assert(!isnan(p.vx) && !isnan(p.vy) && isfinite(p.vx) && isfinite(p.vy));
     }
 
     LL_VERBOSE2("Total number of wall collisions for region %d: %d", region_id, total_collisions);
+    return total_collisions;
 }
@@ -1,5 +1,17 @@
 #include "../utils/types.h"
 
+/**
+ * Flags for each region, as passed to handle_collisions.
+ */
+#define REGION_COMPUTED 1
+#define REGION_READ_ONLY 2
+
+/**
+ * Softening of the gravitational force (and potential) between two particles, which keeps it finite for
+ * particles at the same position. Shared by all kernels, so that their forces and energies agree.
+ */
+#define SOFTENING_PARAM 0.0001F
+
 /**
  * Computes the new velocity for each particle for a given timestep, only for the given region ID.
  * Uses all other regions' particles to compute the force on the region's particles, in order to
@@ -13,8 +25,10 @@
  * @param particles_by_region   2-D array of particles, indexed by region ID.
  * @param num_regions           The number of regions.
  * @param region_id             The region whose particles' velocities should be updated.
+ * @param near_regions          Flags for each region, indexed by region ID, of whether its particles exert a force
+ *                              on the region (i.e. it lies within the horizon). May be NULL, to use all regions.
  */
-void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id);
+void update_velocity(long double dt, Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *near_regions);
 
 /**
  * Updates the position of particles for a given timestep.
@@ -42,6 +56,23 @@ void update_position(long double dt, Spec spec, int size, Particle *particles, i
  */
 Particle **reallocate_for_region(Spec spec, int *sizes, int num_particles, Particle *particles, int num_regions);
 
+/**
+ * Reallocates the particles for multiple regions into a single 2-D array of
+ * particles indexed by their regions.
+ *
+ * Note that the array passed to sizes will be modified in-place.
+ *
+ * @param spec                  The program specification.
+ * @param sizes                 Resultant sizes of each region.
+ * @param num_sources           The number of regions whose particles are to be reallocated.
+ * @param source_regions        The regions whose particles are to be reallocated.
+ * @param source_sizes          Sizes of each array in particles_by_region.
+ * @param particles_by_region   2-D array of particles, indexed by region ID.
+ * @param num_regions           The number of regions.
+ * @return                      Returns a new array of particles.
+ */
+Particle **reallocate_for_regions(Spec spec, int *sizes, int num_sources, int *source_regions, int *source_sizes, Particle **particles_by_region, int num_regions);
+
 /**
  * Updates the velocities of any particles in this process' region
  * if it is colliding with any other particle.
@@ -58,8 +89,14 @@ Particle **reallocate_for_region(Spec spec, int *sizes, int num_particles, Parti
  * @param particles_by_region   2-D array of particles, indexed by region ID.
  * @param num_regions           The number of regions.
  * @param region_id             The region whose particles' velocities should be updated.
+ * @param flags                 Flags for each region, indexed by region ID. May be NULL.
+ *                              Collisions between particles of two REGION_COMPUTED regions are only
+ *                              handled once, from the lower region ID. REGION_READ_ONLY regions are
+ *                              never written to; they are replaced by a private copy (and the flag is
+ *                              cleared) before the first update to any of their particles.
+ * @return                      Returns the number of collisions that were handled.
  */
-void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id);
+int handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, int num_regions, int region_id, char *flags);
 
 /**
  * Handle collisions against the walls of the pool area.
@@ -75,5 +112,6 @@ void handle_collisions(Spec spec, int *sizes, Particle **particles_by_region, in
  * @param size          Size of the array.
  * @param particles     Array of particles whose velocities should be updated.
  * @param region_id     The region that the particles reside in.
+ * @return              Returns the number of collisions against the walls.
  */
-void handle_wall_collisions(Spec spec, int size, Particle *particles, int region_id);
+int handle_wall_collisions(Spec spec, int size, Particle *particles, int region_id);
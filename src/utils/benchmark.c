@@ -0,0 +1,237 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "log.h"
+#include "multiproc.h"
+#include "timer.h"
+
+/**
+ * Names of each phase and counter, as the keys in the benchmark file.
+ */
+const char *benchmark_phase_names[] = {
+    "step",
+    "compute",
+    "velocity",
+    "collisions",
+    "walls",
+    "position",
+    "reallocate",
+    "sync",
+    "sync_sizes",
+    "sync_migrate",
+    "sync_truncate",
+    "sync_halo",
+    "mpi_wait",
+    "mpi_transfer",
+};
+
+static const char *counter_names[NUM_BENCHMARK_COUNTERS] = {
+    "particles",
+    "halo_particles",
+    "migrated_particles",
+    "gravity_interactions",
+    "collision_checks",
+    "collisions",
+    "wall_collisions",
+};
+
+/**
+ * Starts the record of a time slot, which is filled in with the timings and counts of the time slot.
+ */
+void start_benchmark_record(Benchmark *benchmark, int time_slot, int rank)
+{
+    memset(&benchmark->current, 0, sizeof(BenchmarkRecord));
+    benchmark->current.time_slot = time_slot;
+    benchmark->current.rank = rank;
+    benchmark->step_start = wall_clock_time();
+    get_mpi_times(&benchmark->mpi_wait_start, &benchmark->mpi_transfer_start);
+}
+
+/**
+ * Adds the current record to the records of the benchmark.
+ */
+void end_benchmark_record(Benchmark *benchmark)
+{
+    long long wait_time, transfer_time;
+    get_mpi_times(&wait_time, &transfer_time);
+    benchmark->current.phases[PHASE_STEP] += wall_clock_time() - benchmark->step_start;
+    benchmark->current.phases[PHASE_MPI_WAIT] += wait_time - benchmark->mpi_wait_start;
+    benchmark->current.phases[PHASE_MPI_TRANSFER] += transfer_time - benchmark->mpi_transfer_start;
+
+    if (benchmark->num_records == benchmark->capacity) {
+        benchmark->capacity = benchmark->capacity > 0 ? 2 * benchmark->capacity : 64;
+        benchmark->records = realloc(benchmark->records, benchmark->capacity * sizeof(BenchmarkRecord));
+    }
+    benchmark->records[benchmark->num_records++] = benchmark->current;
+}
+
+/**
+ * Adds the time of a scope to its phase (see BENCHMARK_SCOPE).
+ */
+void end_benchmark_scope(BenchmarkScope *scope)
+{
+    scope->benchmark->current.phases[scope->phase] += wall_clock_time() - scope->start;
+}
+
+/**
+ * Adds the time since start to a phase of the current record, and returns the current time.
+ */
+long long lap_benchmark_phase(Benchmark *benchmark, BenchmarkPhase phase, long long start)
+{
+    long long now = wall_clock_time();
+    benchmark->current.phases[phase] += now - start;
+
+    return now;
+}
+
+/**
+ * Comparator which orders records by time slot, and then by rank.
+ */
+int compare_benchmark_records(const void *a, const void *b)
+{
+    const BenchmarkRecord *r1 = a, *r2 = b;
+    if (r1->time_slot != r2->time_slot) return r1->time_slot - r2->time_slot;
+    return r1->rank - r2->rank;
+}
+
+/**
+ * Writes records as a JSON object, with an array of records.
+ */
+void write_benchmark_json(FILE *fp, int num_procs, int n, BenchmarkRecord *records)
+{
+    fprintf(fp, "{\n  \"processes\": %d,\n  \"time_unit\": \"ns\",\n  \"records\": [", num_procs);
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%s\n    {\"time_slot\": %d, \"rank\": %d, \"phases\": {", i > 0 ? "," : "", records[i].time_slot, records[i].rank);
+        for (int p = 0; p < NUM_BENCHMARK_PHASES; p++)
+            fprintf(fp, "%s\"%s\": %lld", p > 0 ? ", " : "", benchmark_phase_names[p], records[i].phases[p]);
+        fprintf(fp, "}, \"counts\": {");
+        for (int c = 0; c < NUM_BENCHMARK_COUNTERS; c++)
+            fprintf(fp, "%s\"%s\": %lld", c > 0 ? ", " : "", counter_names[c], records[i].counters[c]);
+        fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+/**
+ * Writes records as CSV, with a row per record.
+ */
+void write_benchmark_csv(FILE *fp, int n, BenchmarkRecord *records)
+{
+    fprintf(fp, "time_slot,rank");
+    for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) fprintf(fp, ",%s_ns", benchmark_phase_names[p]);
+    for (int c = 0; c < NUM_BENCHMARK_COUNTERS; c++) fprintf(fp, ",%s", counter_names[c]);
+    fprintf(fp, "\n");
+
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%d,%d", records[i].time_slot, records[i].rank);
+        for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) fprintf(fp, ",%lld", records[i].phases[p]);
+        for (int c = 0; c < NUM_BENCHMARK_COUNTERS; c++) fprintf(fp, ",%lld", records[i].counters[c]);
+        fprintf(fp, "\n");
+    }
+}
+
+/**
+ * Gathers the records of all processes of a communicator on the first process, which writes them to a file.
+ */
+void write_benchmark(MPI_Comm comm, Benchmark *benchmark, char *benchmarkfile, BenchmarkFormat format)
+{
+    int rank, num_procs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_procs);
+
+    // Gather the records of all processes, as bytes since all processes have the same layout.
+    int size = benchmark->num_records * sizeof(BenchmarkRecord);
+    int *sizes = NULL, *displs = NULL;
+    BenchmarkRecord *records = NULL;
+    int total = 0;
+    if (rank == 0) {
+        sizes = malloc(num_procs * sizeof(int));
+        displs = malloc(num_procs * sizeof(int));
+    }
+    MPI_Gather(&size, 1, MPI_INT, sizes, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        for (int i = 0; i < num_procs; i++) {
+            displs[i] = total;
+            total += sizes[i];
+        }
+        records = malloc(total);
+    }
+    MPI_Gatherv(benchmark->records, size, MPI_BYTE, records, sizes, displs, MPI_BYTE, 0, comm);
+
+    if (rank == 0) {
+        int n = total / sizeof(BenchmarkRecord);
+        qsort(records, n, sizeof(BenchmarkRecord), compare_benchmark_records);
+
+        FILE *fp = fopen(benchmarkfile, "w");
+        if (fp == NULL) {
+            LL_ERROR("Could not open %s for writing benchmark!", benchmarkfile);
+            exit(EXIT_FAILURE);
+        }
+        if (format == BENCHMARK_FORMAT_CSV)
+            write_benchmark_csv(fp, n, records);
+        else
+            write_benchmark_json(fp, num_procs, n, records);
+        fclose(fp);
+
+        LL_SUCCESS("Successfully written benchmark of %d record(s) to %s.", n, benchmarkfile);
+        free(sizes);
+        free(displs);
+        free(records);
+    }
+}
+
+/**
+ * Comparator which orders times in ascending order.
+ */
+int compare_times(const void *a, const void *b)
+{
+    long long t1 = *(const long long *)a, t2 = *(const long long *)b;
+    return (t1 > t2) - (t1 < t2);
+}
+
+/**
+ * Summarises each phase over the records of all processes of a communicator, on the first process.
+ */
+void summarise_benchmark(MPI_Comm comm, Benchmark *benchmark, BenchmarkSummary summaries[NUM_BENCHMARK_PHASES])
+{
+    int rank, num_procs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_procs);
+    int n = benchmark->num_records;
+
+    // Find the time of the slowest process in each time slot, which holds up all other processes,
+    // and the total time of each process.
+    long long *times = malloc((n + 1) * NUM_BENCHMARK_PHASES * sizeof(long long));
+    long long *slowest = malloc((n + 1) * NUM_BENCHMARK_PHASES * sizeof(long long));
+    long long totals[NUM_BENCHMARK_PHASES] = { 0 }, total_sums[NUM_BENCHMARK_PHASES], total_maxes[NUM_BENCHMARK_PHASES];
+    for (int i = 0; i < n; i++) {
+        for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) {
+            times[p * n + i] = benchmark->records[i].phases[p];
+            totals[p] += benchmark->records[i].phases[p];
+        }
+    }
+    MPI_Reduce(times, slowest, n * NUM_BENCHMARK_PHASES, MPI_LONG_LONG, MPI_MAX, 0, comm);
+    MPI_Reduce(totals, total_sums, NUM_BENCHMARK_PHASES, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(totals, total_maxes, NUM_BENCHMARK_PHASES, MPI_LONG_LONG, MPI_MAX, 0, comm);
+
+    if (rank == 0) {
+        for (int p = 0; p < NUM_BENCHMARK_PHASES; p++) {
+            // Take the nearest rank of each percentile over all time slots.
+            long long *phase_times = &slowest[p * n];
+            qsort(phase_times, n, sizeof(long long), compare_times);
+            summaries[p] = (BenchmarkSummary){
+                .p50 = n > 0 ? phase_times[(n * 50 + 99) / 100 - 1] : 0,
+                .p90 = n > 0 ? phase_times[(n * 90 + 99) / 100 - 1] : 0,
+                .p99 = n > 0 ? phase_times[(n * 99 + 99) / 100 - 1] : 0,
+                .max = n > 0 ? phase_times[n - 1] : 0,
+                .imbalance = total_sums[p] > 0 ? (double)total_maxes[p] * num_procs / total_sums[p] : 1.0,
+            };
+        }
+    }
+
+    free(times);
+    free(slowest);
+}
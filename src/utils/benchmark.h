@@ -0,0 +1,168 @@
+#include <mpi.h>
+
+#include "timer.h"
+#include "types.h"
+
+/**
+ * A benchmark records the time spent in each phase of every time slot by every process, as well as the
+ * number of particles and interactions that it computed, so that throughput and imbalance can be tracked
+ * without parsing the logs. It is written by the master process as JSON or CSV at the end of the simulation,
+ * and summarised in the report.
+ *
+ * Phases may be nested: the time of a nested phase is also counted in the phases that enclose it.
+ */
+
+/**
+ * Phases of a time slot.
+ */
+typedef enum benchmark_phase_t {
+    // The entire time slot.
+    PHASE_STEP,
+
+    // Computation of the time step, which encloses the phases up to PHASE_REALLOCATE:
+    // velocities (including far-field multipoles), collisions, wall collisions and positions.
+    PHASE_COMPUTE,
+    PHASE_VELOCITY,
+    PHASE_COLLISIONS,
+    PHASE_WALLS,
+    PHASE_POSITION,
+
+    // Reallocating the particles into their new regions.
+    PHASE_REALLOCATE,
+
+    // Synchronisation of particles (and multipoles), which encloses its steps: the sizes of all regions,
+    // migrating particles to the processes of their regions, truncating the sizes of other regions,
+    // and duplicating the halos.
+    PHASE_SYNC,
+    PHASE_SYNC_SIZES,
+    PHASE_SYNC_MIGRATE,
+    PHASE_SYNC_TRUNCATE,
+    PHASE_SYNC_HALO,
+
+    // Time in point-to-point communication (see get_mpi_times), split between waiting for other processes
+    // and transferring messages once they are matched.
+    PHASE_MPI_WAIT,
+    PHASE_MPI_TRANSFER,
+
+    NUM_BENCHMARK_PHASES,
+} BenchmarkPhase;
+
+/**
+ * Counts of a time slot.
+ */
+typedef enum benchmark_counter_t {
+    // Particles in the regions of the process, and in the halo regions of other processes.
+    COUNTER_PARTICLES,
+    COUNTER_HALO_PARTICLES,
+
+    // Particles sent to other processes whose regions they moved into.
+    COUNTER_MIGRATED_PARTICLES,
+
+    // Pairs of particles whose gravity and collisions were computed, and the collisions that were handled.
+    COUNTER_GRAVITY_INTERACTIONS,
+    COUNTER_COLLISION_CHECKS,
+    COUNTER_COLLISIONS,
+    COUNTER_WALL_COLLISIONS,
+
+    NUM_BENCHMARK_COUNTERS,
+} BenchmarkCounter;
+
+/**
+ * Timings (in nanoseconds) and counts of a single process for a single time slot.
+ */
+typedef struct benchmark_record_t {
+    int time_slot;
+    int rank;
+    long long phases[NUM_BENCHMARK_PHASES];
+    long long counters[NUM_BENCHMARK_COUNTERS];
+} BenchmarkRecord;
+
+/**
+ * Records of all time slots of a process, including the record of the current time slot.
+ */
+typedef struct benchmark_t {
+    BenchmarkRecord current;
+    BenchmarkRecord *records;
+    int num_records;
+    int capacity;
+
+    // Start of the current time slot, and the MPI times at its start.
+    long long step_start;
+    long long mpi_wait_start;
+    long long mpi_transfer_start;
+} Benchmark;
+
+/**
+ * Phase which is timed until the end of the enclosing scope.
+ */
+typedef struct benchmark_scope_t {
+    Benchmark *benchmark;
+    BenchmarkPhase phase;
+    long long start;
+} BenchmarkScope;
+
+/**
+ * Times the rest of the enclosing scope as a phase of the current record, however the scope is left.
+ */
+#define BENCHMARK_SCOPE(benchmark, phase) \
+    BenchmarkScope benchmark_scope_##phase __attribute__((cleanup(end_benchmark_scope))) = { (benchmark), (phase), wall_clock_time() }
+
+/**
+ * Distribution of the time of a phase over all time slots, for the slowest process in each time slot,
+ * and the load imbalance of its total time (max / mean across processes).
+ */
+typedef struct benchmark_summary_t {
+    long long p50;
+    long long p90;
+    long long p99;
+    long long max;
+    double imbalance;
+} BenchmarkSummary;
+
+/**
+ * Names of each phase, as the keys in the benchmark file.
+ */
+extern const char *benchmark_phase_names[];
+
+/**
+ * Starts the record of a time slot, which is filled in with the timings and counts of the time slot.
+ */
+void start_benchmark_record(Benchmark *benchmark, int time_slot, int rank);
+
+/**
+ * Adds the current record to the records of the benchmark, including the time of the entire time slot
+ * and the MPI times since it started.
+ */
+void end_benchmark_record(Benchmark *benchmark);
+
+/**
+ * Adds the time of a scope to its phase (see BENCHMARK_SCOPE).
+ */
+void end_benchmark_scope(BenchmarkScope *scope);
+
+/**
+ * Adds the time since start to a phase of the current record, and returns the current time,
+ * so that consecutive phases can be timed one after another.
+ */
+long long lap_benchmark_phase(Benchmark *benchmark, BenchmarkPhase phase, long long start);
+
+/**
+ * Gathers the records of all processes of a communicator on the first process, which writes them to a file
+ * ordered by time slot and rank. This must be called collectively by all processes of the communicator.
+ *
+ * @param comm              The communicator of all processes which recorded a benchmark.
+ * @param benchmark         The benchmark of this process.
+ * @param benchmarkfile     The path of the benchmark file.
+ * @param format            The format of the benchmark file.
+ */
+void write_benchmark(MPI_Comm comm, Benchmark *benchmark, char *benchmarkfile, BenchmarkFormat format);
+
+/**
+ * Summarises each phase over the records of all processes of a communicator, on the first process.
+ * This must be called collectively by all processes of the communicator, which recorded the same time slots.
+ *
+ * @param comm          The communicator of all processes which recorded a benchmark.
+ * @param benchmark     The benchmark of this process.
+ * @param summaries     Resultant summary of each phase (on the first process only).
+ */
+void summarise_benchmark(MPI_Comm comm, Benchmark *benchmark, BenchmarkSummary summaries[NUM_BENCHMARK_PHASES]);
@@ -0,0 +1,207 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+
+/**
+ * Returns the offset of the first particle in a checkpoint file, after its header and index.
+ */
+MPI_Offset get_checkpoint_data_offset(CheckpointHeader header)
+{
+    return sizeof(CheckpointHeader) + 2 * (MPI_Offset)header.num_regions * sizeof(long long);
+}
+
+/**
+ * Starts writing a checkpoint collectively with all processes of a communicator, without waiting for it
+ * to be written. Each process writes the particles of its own regions, which are taken over by the checkpoint.
+ */
+Checkpoint *start_checkpoint(MPI_Comm comm, char *checkpointfile, CheckpointHeader header, int n, int *regions, int *sizes, Particle *particles, MPI_Datatype particle_type)
+{
+    int rank, particle_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Type_size(particle_type, &particle_size);
+
+    Checkpoint *checkpoint = calloc(1, sizeof(Checkpoint));
+    checkpoint->rank = rank;
+    for (int i = 0; i < 3; i++) checkpoint->requests[i] = MPI_REQUEST_NULL;
+    checkpoint->particles = particles;
+    checkpoint->checkpointfile = checkpointfile;
+    checkpoint->tmpfile = malloc(strlen(checkpointfile) + 5);
+    sprintf(checkpoint->tmpfile, "%s.tmp", checkpointfile);
+
+    // Find the offset of the particles of this process, after the particles of all processes before it.
+    long long count = 0, offset = 0, total = 0;
+    for (int i = 0; i < n; i++) count += sizes[regions[i]];
+    MPI_Exscan(&count, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&count, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0) offset = 0;
+
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.particle_size = particle_size;
+    header.num_particles = total;
+    checkpoint->header = header;
+
+    // Gather the offset and number of particles of each region on the first process.
+    long long *index = calloc(2 * header.num_regions, sizeof(long long));
+    long long region_offset = offset;
+    for (int i = 0; i < n; i++) {
+        index[2 * regions[i]] = region_offset;
+        index[2 * regions[i] + 1] = sizes[regions[i]];
+        region_offset += sizes[regions[i]];
+    }
+    if (rank == 0) checkpoint->index = malloc(2 * header.num_regions * sizeof(long long));
+    MPI_Reduce(index, checkpoint->index, 2 * header.num_regions, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    free(index);
+
+    int error = MPI_File_open(comm, checkpoint->tmpfile, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &checkpoint->fh);
+    if (error != MPI_SUCCESS) {
+        LL_ERROR("Could not open %s for writing checkpoint!", checkpoint->tmpfile);
+        exit(EXIT_FAILURE);
+    }
+    MPI_Offset data_offset = get_checkpoint_data_offset(header);
+    MPI_File_set_size(checkpoint->fh, data_offset + total * particle_size);
+
+    // Write the header, index and the particles of each process, which carry on in the background.
+    if (rank == 0) {
+        MPI_File_iwrite_at(checkpoint->fh, 0, &checkpoint->header, sizeof(CheckpointHeader), MPI_BYTE, &checkpoint->requests[1]);
+        MPI_File_iwrite_at(checkpoint->fh, sizeof(CheckpointHeader), checkpoint->index, 2 * header.num_regions, MPI_LONG_LONG, &checkpoint->requests[2]);
+    }
+    MPI_File_iwrite_at_all(checkpoint->fh, data_offset + offset * particle_size, particles, count, particle_type, &checkpoint->requests[0]);
+
+    LL_VERBOSE("Started checkpoint of %lld particle(s) at time slot %d.", count, header.time_slot);
+    return checkpoint;
+}
+
+/**
+ * Makes progress on writing a checkpoint, without waiting for it.
+ * Returns 1 if this process has finished writing its part of the checkpoint.
+ */
+int test_checkpoint(Checkpoint *checkpoint)
+{
+    int done;
+    MPI_Testall(3, checkpoint->requests, &done, MPI_STATUSES_IGNORE);
+
+    return done;
+}
+
+/**
+ * Waits for a checkpoint to be written by all processes, and replaces the checkpoint file with it.
+ */
+void finish_checkpoint(Checkpoint *checkpoint)
+{
+    MPI_Waitall(3, checkpoint->requests, MPI_STATUSES_IGNORE);
+    MPI_File_close(&checkpoint->fh);
+
+    // Only replace the previous checkpoint once the new checkpoint is complete,
+    // so that a job which is killed while writing can still restart from the previous checkpoint.
+    if (checkpoint->rank == 0) {
+        if (rename(checkpoint->tmpfile, checkpoint->checkpointfile) != 0) {
+            LL_ERROR("Could not replace %s with checkpoint!", checkpoint->checkpointfile);
+            exit(EXIT_FAILURE);
+        }
+        LL_SUCCESS("Successfully written checkpoint of %lld particle(s) at time slot %d to %s.", checkpoint->header.num_particles, checkpoint->header.time_slot, checkpoint->checkpointfile);
+    }
+
+    free(checkpoint->index);
+    free(checkpoint->particles);
+    free(checkpoint->tmpfile);
+    free(checkpoint);
+}
+
+/**
+ * Checks that a checkpoint can be restarted by this program, with a pool of the given length.
+ */
+void check_checkpoint_header(CheckpointHeader header, char *checkpointfile, int particle_size, int canvas_length)
+{
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0) {
+        LL_ERROR("%s is not a checkpoint file!", checkpointfile);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header.particle_size != particle_size) {
+        LL_ERROR("Checkpoint %s has particles of %d bytes, but expected %d bytes!", checkpointfile, header.particle_size, particle_size);
+        exit(EXIT_FAILURE);
+    }
+
+    if (canvas_length > 0 && header.canvas_length != canvas_length) {
+        LL_ERROR("Checkpoint %s has a pool of length %d, but the pool has length %d (set PoolLength in the specification file to restart it with a different number of processes)!",
+            checkpointfile, header.canvas_length, canvas_length);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Reads the header of a checkpoint file (on a single process).
+ */
+CheckpointHeader read_checkpoint_header(char *checkpointfile)
+{
+    CheckpointHeader header;
+
+    FILE *fp = fopen(checkpointfile, "rb");
+    if (fp == NULL || fread(&header, sizeof(CheckpointHeader), 1, fp) != 1) {
+        LL_ERROR("Could not read checkpoint %s!", checkpointfile);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+
+    check_checkpoint_header(header, checkpointfile, header.particle_size, 0);
+    return header;
+}
+
+/**
+ * Reads the particles in a checkpoint file collectively with all processes of a communicator.
+ */
+Particle *read_checkpoint(MPI_Comm comm, char *checkpointfile, CheckpointHeader header, int n, int *regions, MPI_Datatype particle_type, int *time_slot, int *count)
+{
+    int rank, num_procs, particle_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_procs);
+    MPI_Type_size(particle_type, &particle_size);
+
+    MPI_File fh;
+    int error = MPI_File_open(comm, checkpointfile, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    if (error != MPI_SUCCESS) {
+        LL_ERROR("Could not open checkpoint %s!", checkpointfile);
+        exit(EXIT_FAILURE);
+    }
+
+    CheckpointHeader file_header;
+    MPI_File_read_at_all(fh, 0, &file_header, sizeof(CheckpointHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    check_checkpoint_header(file_header, checkpointfile, particle_size, header.canvas_length);
+    *time_slot = file_header.time_slot;
+
+    MPI_Offset data_offset = get_checkpoint_data_offset(file_header);
+    Particle *particles;
+
+    if (file_header.grid_size == header.grid_size && file_header.num_regions == header.num_regions) {
+        // Read the particles of each of my regions.
+        long long *index = malloc(2 * file_header.num_regions * sizeof(long long));
+        MPI_File_read_at_all(fh, sizeof(CheckpointHeader), index, 2 * file_header.num_regions, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+
+        *count = 0;
+        for (int i = 0; i < n; i++) *count += index[2 * regions[i] + 1];
+        particles = malloc(*count * sizeof(Particle));
+
+        for (int i = 0, offset = 0; i < n; i++) {
+            int size = index[2 * regions[i] + 1];
+            MPI_File_read_at(fh, data_offset + index[2 * regions[i]] * particle_size, &particles[offset], size, particle_type, MPI_STATUS_IGNORE);
+            offset += size;
+        }
+        free(index);
+    } else {
+        // Read a contiguous share of the particles, which are binned into the regions of this decomposition.
+        long long start = file_header.num_particles * rank / num_procs;
+        long long end = file_header.num_particles * (rank + 1) / num_procs;
+        *count = end - start;
+
+        particles = malloc(*count * sizeof(Particle));
+        MPI_File_read_at_all(fh, data_offset + start * particle_size, particles, *count, particle_type, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+
+    LL_VERBOSE("Read %d particle(s) from checkpoint %s.", *count, checkpointfile);
+    return particles;
+}
@@ -0,0 +1,120 @@
+#include <mpi.h>
+
+#include "types.h"
+
+/**
+ * A checkpoint stores the state of the simulation at the start of a time slot (after synchronisation),
+ * so that it can be restarted with any number of processes, as long as the pool has the same length
+ * (i.e. the same PoolLength and GridSize in the specification file).
+ * All integers are in native byte order.
+ *
+ * The file starts with a CheckpointHeader, followed by the index of each region (int64 offset of its first
+ * particle, and int64 number of particles), followed by the particles of all regions, in the packed (native)
+ * layout of the MPI datatype for the Particle struct. The particles of each region are contiguous, in the
+ * order that they were simulated in. The coordinates of each particle are absolute (i.e. denormalized
+ * wrt its region), so that they can be binned into the regions of any decomposition.
+ */
+
+#define CHECKPOINT_MAGIC "POOLCKP1"
+
+/**
+ * Header of a checkpoint file.
+ */
+typedef struct checkpoint_header_t {
+    // CHECKPOINT_MAGIC (not null-terminated).
+    char magic[8];
+
+    // Size of each particle in the file, which must match the program that restarts from it.
+    int particle_size;
+
+    // Length of the pool, which must match the decomposition of the program that restarts from it.
+    int canvas_length;
+
+    // Length and number of regions, which are the same for the program that restarts from it
+    // if it decomposes the pool into the same regions.
+    int grid_size;
+    int num_regions;
+
+    // Number of time slots that were completed.
+    int time_slot;
+
+    // Reserved (0).
+    int reserved;
+
+    // Total number of particles in the file.
+    long long num_particles;
+} CheckpointHeader;
+
+/**
+ * Checkpoint which is being written in the background.
+ */
+typedef struct checkpoint_t {
+    MPI_File fh;
+
+    // Rank of this process in the communicator of the checkpoint.
+    int rank;
+
+    // Requests for the particles of this process, and the header and index (on the first process only).
+    MPI_Request requests[3];
+
+    // Staged copy of the header, index and particles, which must not be modified until the checkpoint is finished.
+    CheckpointHeader header;
+    long long *index;
+    Particle *particles;
+
+    // The checkpoint is written to a temporary file, which replaces the checkpoint file once complete.
+    char *checkpointfile;
+    char *tmpfile;
+} Checkpoint;
+
+/**
+ * Starts writing a checkpoint collectively with all processes of a communicator, without waiting for it
+ * to be written. Each process writes the particles of its own regions, which are taken over by the checkpoint.
+ *
+ * @param comm              The communicator of all processes which hold particles.
+ * @param checkpointfile    The path of the checkpoint file.
+ * @param header            The header of the checkpoint (the magic, size of particles and number of particles are filled in).
+ * @param n                 The number of regions of this process.
+ * @param regions           The regions of this process.
+ * @param sizes             The number of particles in each region, indexed by region ID.
+ * @param particles         The particles of the regions of this process in order, with absolute coordinates.
+ * @param particle_type     The MPI datatype for the Particle struct.
+ * @return                  Returns the checkpoint being written.
+ */
+Checkpoint *start_checkpoint(MPI_Comm comm, char *checkpointfile, CheckpointHeader header, int n, int *regions, int *sizes, Particle *particles, MPI_Datatype particle_type);
+
+/**
+ * Makes progress on writing a checkpoint, without waiting for it.
+ * Returns 1 if this process has finished writing its part of the checkpoint.
+ */
+int test_checkpoint(Checkpoint *checkpoint);
+
+/**
+ * Waits for a checkpoint to be written by all processes, and replaces the checkpoint file with it.
+ * This must be called collectively by all processes that started the checkpoint.
+ */
+void finish_checkpoint(Checkpoint *checkpoint);
+
+/**
+ * Reads the header of a checkpoint file (on a single process).
+ */
+CheckpointHeader read_checkpoint_header(char *checkpointfile);
+
+/**
+ * Reads the particles in a checkpoint file collectively with all processes of a communicator.
+ *
+ * If the checkpoint has the same regions as the given decomposition, each process reads the particles
+ * of its own regions, in the order that they were simulated in, so that the simulation carries on exactly
+ * as if it had not been interrupted. Otherwise, each process reads an equal share of the particles.
+ *
+ * @param comm              The communicator of all processes which read particles.
+ * @param checkpointfile    The path of the checkpoint file.
+ * @param header            The header of the decomposition, which must have the same length of pool.
+ * @param n                 The number of regions of this process.
+ * @param regions           The regions of this process, in ascending order.
+ * @param particle_type     The MPI datatype for the Particle struct.
+ * @param time_slot         Resultant number of time slots that were completed.
+ * @param count             Resultant number of particles read by this process.
+ * @return                  Returns a new array of particles, with absolute coordinates.
+ */
+Particle *read_checkpoint(MPI_Comm comm, char *checkpointfile, CheckpointHeader header, int n, int *regions, MPI_Datatype particle_type, int *time_slot, int *count);
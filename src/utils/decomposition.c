@@ -0,0 +1,389 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decomposition.h"
+#include "log.h"
+#include "particles.h"
+#include "regions.h"
+#include "types.h"
+#include "../simulation/nbody.h"
+
+/**
+ * Returns which of the n blocks along an axis of the given length contains a sub-region, where the i-th block
+ * starts from sub-region (length * i / n), so that blocks differ by at most one sub-region along the axis.
+ */
+int get_block_index(int length, int n, int x)
+{
+    return ((long long)(x + 1) * n - 1) / length;
+}
+
+/**
+ * Returns the process whose initial block of the process grid contains the given region.
+ */
+int get_block_owner(Spec spec, Decomposition decomp, int region_id)
+{
+    int block_x = get_block_index(spec.PoolLength, decomp.procs_x, get_region_x(region_id, spec));
+    int block_y = get_block_index(spec.PoolLength, decomp.procs_y, get_region_y(region_id, spec));
+
+    return decomp.block_ranks[block_y * decomp.procs_x + block_x];
+}
+
+/**
+ * Chooses the number of sub-regions that each region of the spec is split into along each side, which must
+ * divide GridSize, such that each process has a block of at least min_length sub-regions along each side.
+ * Of the choices of up to 4 times as many sub-regions as needed, the one which splits the pool most evenly
+ * between the processes is chosen (or the fewest sub-regions, if there is a tie).
+ * Returns 0 if the pool is too small.
+ */
+int get_sub_region_split(int grid_size, int pool_length, int procs_x, int procs_y, int min_length)
+{
+    int procs = procs_x > procs_y ? procs_x : procs_y;
+    int best = 0;
+    long double best_imbalance = 0;
+
+    for (int split = 1; split <= grid_size; split++) {
+        if (grid_size % split != 0) continue;
+
+        int length = pool_length * split;
+        if (length < min_length * procs) continue;
+        if (best > 0 && length > 4 * min_length * procs) break;
+
+        // Compare the largest block to the smallest one.
+        long double largest = (long double)((length + procs_x - 1) / procs_x) * ((length + procs_y - 1) / procs_y);
+        long double imbalance = largest / ((length / procs_x) * (length / procs_y));
+        if (best == 0 || imbalance < best_imbalance) {
+            best = split;
+            best_imbalance = imbalance;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Lays out the processes in a rectangular grid, and splits the regions of the spec into sub-regions.
+ */
+Decomposition decompose_spec(Spec *spec, int num_procs, int sub_regions)
+{
+    if (sub_regions < 1) {
+        LL_ERROR("Number of sub-regions %d must be positive!", sub_regions);
+        exit(EXIT_FAILURE);
+    }
+
+    // By default, the pool has a region for each process, or as close to it as possible.
+    int pool_length = spec->PoolLength > 0 ? spec->PoolLength : lroundl(sqrtl(num_procs));
+    if (pool_length < 1) pool_length = 1;
+
+    Decomposition decomp = {
+        .num_procs = num_procs,
+        .pool_length = pool_length,
+        .horizon = spec->Horizon,
+    };
+
+    // Lay out the processes in a grid, where each process has a block of whole sub-regions.
+    get_process_grid(num_procs, &decomp.procs_x, &decomp.procs_y);
+    decomp.sub_regions = get_sub_region_split(spec->GridSize, pool_length, decomp.procs_x, decomp.procs_y, sub_regions);
+    if (decomp.sub_regions == 0) {
+        LL_ERROR("A pool of %dx%d region(s) of size %d cannot be split between %dx%d processes with %d sub-region(s) each along each side!",
+            pool_length, pool_length, spec->GridSize, decomp.procs_x, decomp.procs_y, sub_regions);
+        exit(EXIT_FAILURE);
+    }
+
+    // Describe the grid of sub-regions in the spec instead (but keep the horizon between regions of the spec).
+    spec->PoolLength = pool_length * decomp.sub_regions;
+    spec->GridSize /= decomp.sub_regions;
+    decomp.num_regions = spec->PoolLength * spec->PoolLength;
+
+    // Assign the blocks of the process grid to processes in row-major order.
+    decomp.block_ranks = malloc(num_procs * sizeof(int));
+    for (int block = 0; block < num_procs; block++) decomp.block_ranks[block] = block;
+
+    // Assign each sub-region to the process of the block which contains it.
+    decomp.owners = malloc(decomp.num_regions * sizeof(int));
+    order_blocks(*spec, &decomp, decomp.block_ranks);
+
+    return decomp;
+}
+
+/**
+ * Reassigns the blocks of the process grid to the given processes,
+ * and assigns each sub-region to the process of the block which contains it.
+ */
+void order_blocks(Spec spec, Decomposition *decomp, int *block_ranks)
+{
+    memmove(decomp->block_ranks, block_ranks, decomp->num_procs * sizeof(int));
+    for (int region = 0; region < decomp->num_regions; region++)
+        decomp->owners[region] = get_block_owner(spec, *decomp, region);
+}
+
+/**
+ * Converts a distance along a Hilbert curve filling an n x n grid into its coordinates,
+ * where n is a power of 2.
+ */
+void hilbert_d2xy(int n, int d, int *x, int *y)
+{
+    *x = *y = 0;
+    for (int s = 1; s < n; s *= 2, d /= 4) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+
+        // Rotate the quadrant, so that the curve stays continuous.
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            int t = *x;
+            *x = *y;
+            *y = t;
+        }
+
+        *x += s * rx;
+        *y += s * ry;
+    }
+}
+
+/**
+ * Assigns the blocks of the process grid to processes in the order of a Hilbert curve.
+ */
+void get_hilbert_block_ranks(Decomposition decomp, int *block_ranks)
+{
+    // The curve fills the smallest power-of-2 grid that covers the process grid,
+    // skipping the points that lie outside of it.
+    int n = 1;
+    while (n < decomp.procs_x || n < decomp.procs_y) n *= 2;
+
+    int rank = 0;
+    for (int d = 0; d < n * n; d++) {
+        int x, y;
+        hilbert_d2xy(n, d, &x, &y);
+        if (x < decomp.procs_x && y < decomp.procs_y) block_ranks[y * decomp.procs_x + x] = rank++;
+    }
+}
+
+/**
+ * Returns the block of the process grid that a process is initially assigned to.
+ */
+int get_process_block(Decomposition decomp, int proc)
+{
+    for (int block = 0; block < decomp.num_procs; block++)
+        if (decomp.block_ranks[block] == proc) return block;
+
+    return -1;
+}
+
+/**
+ * Returns the region of the spec that a sub-region lies in.
+ */
+int get_spec_region(Spec spec, Decomposition decomp, int region_id)
+{
+    int x = get_region_x(region_id, spec) / decomp.sub_regions;
+    int y = get_region_y(region_id, spec) / decomp.sub_regions;
+
+    return y * decomp.pool_length + x;
+}
+
+/**
+ * Returns the horizon distance between the regions of the spec that two sub-regions lie in.
+ */
+int get_spec_region_dist(Spec spec, Decomposition decomp, int r1, int r2)
+{
+    return get_horizon_dist(decomp.pool_length, get_spec_region(spec, decomp, r1), get_spec_region(spec, decomp, r2));
+}
+
+/**
+ * Gets the list of regions assigned to a process, in ascending order.
+ */
+int get_owned_regions(Decomposition decomp, int proc, int *regions)
+{
+    int n = 0;
+    for (int region = 0; region < decomp.num_regions; region++)
+        if (decomp.owners[region] == proc) regions[n++] = region;
+
+    return n;
+}
+
+/**
+ * Generates an equal share of the particles of the pool on a process,
+ * and separates them into their sub-regions.
+ */
+Particle **generate_process_particles(Spec spec, Decomposition decomp, int proc, int *sizes, int num_threads)
+{
+    // Every particle of the pool needs a distinct ID.
+    long long total = (long long)decomp.pool_length * decomp.pool_length * spec.TotalNumberOfParticles;
+    if (total > INT_MAX) {
+        LL_ERROR("A pool of %dx%d region(s) with %d particle(s) each has more particles than can be numbered!",
+            decomp.pool_length, decomp.pool_length, spec.TotalNumberOfParticles);
+        exit(EXIT_FAILURE);
+    }
+
+    // Generate a contiguous range of the particles of the pool, which may lie in the regions of any process.
+    int first = total * proc / decomp.num_procs;
+    int n = total * (proc + 1) / decomp.num_procs - first;
+    int region_length = spec.GridSize * decomp.sub_regions;
+    Particle *particles = generate_pool_particles(spec, decomp.pool_length, region_length, first, n, num_threads);
+
+    // Normalize each particle wrt its sub-region instead.
+    for (int i = 0; i < n; i++) {
+        particles[i].x = wrap_around(particles[i].x, spec.PoolLength * spec.GridSize);
+        particles[i].y = wrap_around(particles[i].y, spec.PoolLength * spec.GridSize);
+        particles[i].region = get_denorm_particle_region(particles[i], spec);
+        particles[i].x = norm_region(particles[i].x, spec);
+        particles[i].y = norm_region(particles[i].y, spec);
+    }
+
+    Particle **particles_by_region = reallocate_for_region(spec, sizes, n, particles, decomp.num_regions);
+    free(particles);
+
+    return particles_by_region;
+}
+
+/**
+ * Comparator which orders regions block by block (in the order of the processes that they were
+ * initially assigned to), and in row-major order within each block.
+ */
+Spec order_spec;
+Decomposition order_decomp;
+int compare_block_order(const void *a, const void *b)
+{
+    int r1 = *(const int *)a, r2 = *(const int *)b;
+    int b1 = get_block_owner(order_spec, order_decomp, r1);
+    int b2 = get_block_owner(order_spec, order_decomp, r2);
+
+    if (b1 != b2) return b1 - b2;
+    return r1 - r2;
+}
+
+/**
+ * Reassigns regions to processes, so that the total cost of each process is roughly equal.
+ */
+int rebalance_regions(Spec spec, Decomposition *decomp, long long *costs)
+{
+    int num_regions = decomp->num_regions;
+    int num_procs = decomp->num_procs;
+
+    // Order the regions block by block.
+    int *order = malloc(num_regions * sizeof(int));
+    for (int i = 0; i < num_regions; i++) order[i] = i;
+    order_spec = spec;
+    order_decomp = *decomp;
+    qsort(order, num_regions, sizeof(int), compare_block_order);
+
+    // Add a unit cost to each region, so that empty regions are still spread out evenly.
+    long double total = 0;
+    for (int i = 0; i < num_regions; i++) total += costs[i] + 1;
+    long double share = total / num_procs;
+
+    // Cut the ordering into contiguous chunks of roughly equal cost.
+    int proc = 0, assigned = 0, moved = 0;
+    long double cumulative = 0;
+    for (int i = 0; i < num_regions; i++) {
+        int region = order[i];
+        long double cost = costs[region] + 1;
+
+        // Move on to the next process once this process has its share of the total cost,
+        // or if the remaining regions are just enough for one region per remaining process.
+        if (proc < num_procs - 1 && assigned > 0
+            && (cumulative + cost / 2 > share * (proc + 1) || num_regions - i <= num_procs - 1 - proc)) {
+            proc++;
+            assigned = 0;
+        }
+
+        if (decomp->owners[region] != proc) moved++;
+        decomp->owners[region] = proc;
+        cumulative += cost;
+        assigned++;
+    }
+
+    free(order);
+
+    return moved;
+}
+
+/**
+ * Recursively bisects the rectangle of regions [x0, x1) x [y0, y1) amongst num_procs processes,
+ * starting from first_proc, such that each side of the split has roughly equal cost per process.
+ */
+void bisect_regions(Spec spec, Decomposition *decomp, long long *costs, int x0, int y0, int x1, int y1, int first_proc, int num_procs)
+{
+    int width = x1 - x0, height = y1 - y0;
+
+    // Assign the whole rectangle to a single process.
+    if (num_procs == 1) {
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) decomp->owners[y * spec.PoolLength + x] = first_proc;
+        return;
+    }
+
+    // Split along the longer axis, perpendicular to it.
+    int vertical = width >= height;
+    int length = vertical ? width : height;
+    int extent = vertical ? height : width;
+
+    // Sum up the cost of each slice along the axis, adding a unit cost to each region
+    // so that empty regions are still spread out evenly.
+    long double *slice_costs = calloc(length, sizeof(long double));
+    long double total = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            long double cost = costs[y * spec.PoolLength + x] + 1;
+            slice_costs[vertical ? x - x0 : y - y0] += cost;
+            total += cost;
+        }
+    }
+
+    // Choose the split plane closest to splitting the processes in half.
+    int half = num_procs / 2;
+    long double target = total * half / num_procs;
+    long double cumulative = 0, best_cumulative = 0;
+    int split = 1;
+    for (int i = 1; i < length; i++) {
+        cumulative += slice_costs[i - 1];
+        if (i == 1 || fabsl(cumulative - target) < fabsl(best_cumulative - target)) {
+            split = i;
+            best_cumulative = cumulative;
+        }
+    }
+
+    // Divide the processes in proportion to the cost of each side,
+    // such that each process is still assigned at least one region.
+    int lower_regions = split * extent;
+    int upper_regions = (length - split) * extent;
+    int lower_procs = lroundl(num_procs * best_cumulative / total);
+    if (lower_procs > lower_regions) lower_procs = lower_regions;
+    if (lower_procs > num_procs - 1) lower_procs = num_procs - 1;
+    if (lower_procs < num_procs - upper_regions) lower_procs = num_procs - upper_regions;
+    if (lower_procs < 1) lower_procs = 1;
+
+    free(slice_costs);
+
+    if (vertical) {
+        bisect_regions(spec, decomp, costs, x0, y0, x0 + split, y1, first_proc, lower_procs);
+        bisect_regions(spec, decomp, costs, x0 + split, y0, x1, y1, first_proc + lower_procs, num_procs - lower_procs);
+    } else {
+        bisect_regions(spec, decomp, costs, x0, y0, x1, y0 + split, first_proc, lower_procs);
+        bisect_regions(spec, decomp, costs, x0, y0 + split, x1, y1, first_proc + lower_procs, num_procs - lower_procs);
+    }
+}
+
+/**
+ * Reassigns regions to processes using orthogonal recursive bisection (i.e. a kd-tree).
+ */
+int rebalance_regions_orb(Spec spec, Decomposition *decomp, long long *costs)
+{
+    int *old_owners = malloc(decomp->num_regions * sizeof(int));
+    memcpy(old_owners, decomp->owners, decomp->num_regions * sizeof(int));
+
+    bisect_regions(spec, decomp, costs, 0, 0, spec.PoolLength, spec.PoolLength, 0, decomp->num_procs);
+
+    int moved = 0;
+    for (int region = 0; region < decomp->num_regions; region++)
+        if (decomp->owners[region] != old_owners[region]) moved++;
+
+    free(old_owners);
+
+    return moved;
+}
@@ -0,0 +1,90 @@
+#include "types.h"
+
+/**
+ * Lays out the processes in a rectangular grid of procs_x x procs_y processes (which can
+ * factor any number of processes), and splits the regions of the spec into sub-regions.
+ *
+ * The pool has PoolLength x PoolLength regions of GridSize x GridSize, as given by the spec
+ * (or a region for each process, rounded to the nearest square, if PoolLength is not given).
+ * Each region is split into the same number of sub-regions along each side (which divides GridSize),
+ * such that each process is assigned a rectangular block of at least sub_regions x sub_regions
+ * whole sub-regions. Blocks differ by at most one sub-region along each axis, if the sub-regions
+ * cannot be split evenly.
+ *
+ * The spec will be modified in-place, such that PoolLength and GridSize refer to
+ * the grid of sub-regions, while Horizon is still measured in regions of the spec
+ * (see get_spec_region_dist). Each process (i.e. rank) is initially assigned the set of
+ * sub-regions in its block of the process grid, which may cover parts of several regions
+ * of the spec (or part of a single one), if the processes do not divide the pool evenly.
+ */
+Decomposition decompose_spec(Spec *spec, int num_procs, int sub_regions);
+
+/**
+ * Reassigns the blocks of the process grid to the given processes (indexed by block ID),
+ * and assigns each sub-region to the process of the block which contains it.
+ */
+void order_blocks(Spec spec, Decomposition *decomp, int *block_ranks);
+
+/**
+ * Assigns the blocks of the process grid to processes in the order of a Hilbert curve,
+ * such that processes with consecutive ranks (which are usually on the same node)
+ * are assigned blocks which are close together.
+ *
+ * @param decomp        The decomposition of regions.
+ * @param block_ranks   Resultant process of each block, indexed by block ID.
+ */
+void get_hilbert_block_ranks(Decomposition decomp, int *block_ranks);
+
+/**
+ * Returns the block of the process grid that a process is initially assigned to.
+ */
+int get_process_block(Decomposition decomp, int proc);
+
+/**
+ * Returns the horizon distance between the regions of the spec that two sub-regions lie in.
+ * The sub-regions within the horizon of a sub-region are therefore exactly those of the regions
+ * within the horizon of its region, regardless of how many sub-regions each region is split into.
+ */
+int get_spec_region_dist(Spec spec, Decomposition decomp, int r1, int r2);
+
+/**
+ * Gets the list of regions assigned to a process, in ascending order.
+ * Returns the number of regions written to the regions array.
+ */
+int get_owned_regions(Decomposition decomp, int proc, int *regions);
+
+/**
+ * Generates an equal share of the particles of the pool on a process (which may lie in the regions
+ * of any process), and separates them into their sub-regions.
+ *
+ * @param spec          The program specification, after decomposition.
+ * @param decomp        The decomposition of regions.
+ * @param proc          The process whose particles should be generated.
+ * @param sizes         Resultant sizes of each region.
+ * @param num_threads   The number of threads to generate particles with.
+ * @return              Returns a new 2-D array of particles, indexed by region ID.
+ */
+Particle **generate_process_particles(Spec spec, Decomposition decomp, int proc, int *sizes, int num_threads);
+
+/**
+ * Reassigns regions to processes, so that the total cost of each process is roughly equal.
+ *
+ * Regions are ordered block by block (i.e. in the order of their initial assignment),
+ * and the ordering is cut into contiguous chunks of equal cost, so that each process
+ * only hands over regions at the edges of its chunk to its neighbouring processes.
+ *
+ * Returns the number of regions that were reassigned to a different process.
+ */
+int rebalance_regions(Spec spec, Decomposition *decomp, long long *costs);
+
+/**
+ * Reassigns regions to processes using orthogonal recursive bisection (i.e. a kd-tree).
+ *
+ * The pool is recursively split along the longer axis of each rectangle of regions,
+ * at the plane which best divides the cost of the rectangle between two halves of its
+ * processes. Each process is therefore assigned a rectangle of regions, which is smaller
+ * where the regions are more costly (e.g. dense clusters of particles).
+ *
+ * Returns the number of regions that were reassigned to a different process.
+ */
+int rebalance_regions_orb(Spec spec, Decomposition *decomp, long long *costs);
@@ -1,5 +1,6 @@
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "env.h"
 #include "log.h"
@@ -21,3 +22,223 @@ int getenv_log_process()
 
     return -1;
 }
+
+int getenv_log_async()
+{
+    char *env = getenv("LOG_ASYNC");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+int getenv_multipole_horizon()
+{
+    char *env = getenv("MULTIPOLE_HORIZON");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return -1;
+}
+
+int getenv_neighbour_sync()
+{
+    char *env = getenv("NEIGHBOUR_SYNC");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+int getenv_sub_regions()
+{
+    char *env = getenv("SUB_REGIONS");
+    if (env != NULL && env[0] >= '1' && env[0] <= '9')
+        return atoi(env);
+
+    return 1;
+}
+
+int getenv_rebalance_interval()
+{
+    char *env = getenv("REBALANCE_INTERVAL");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+int getenv_frame_writers()
+{
+    char *env = getenv("FRAME_WRITERS");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+FrameFormat getenv_frame_format()
+{
+    char *env = getenv("FRAME_FORMAT");
+    if (env != NULL && strcmp(env, "stream") == 0)
+        return FRAME_FORMAT_STREAM;
+
+    return FRAME_FORMAT_PPM;
+}
+
+int getenv_frame_decimation()
+{
+    char *env = getenv("FRAME_DECIMATION");
+    if (env != NULL && env[0] >= '1' && env[0] <= '9')
+        return atoi(env);
+
+    return 1;
+}
+
+int getenv_frame_downsample()
+{
+    char *env = getenv("FRAME_DOWNSAMPLE");
+    if (env != NULL && env[0] >= '1' && env[0] <= '9')
+        return atoi(env);
+
+    return 1;
+}
+
+int getenv_orb_decomposition()
+{
+    char *env = getenv("ORB_DECOMPOSITION");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+int getenv_shared_halos()
+{
+    char *env = getenv("SHARED_HALOS");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+int getenv_hierarchical_halos()
+{
+    char *env = getenv("HIERARCHICAL_HALOS");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+RegionOrder getenv_region_order()
+{
+    char *env = getenv("REGION_ORDER");
+    if (env != NULL && strcmp(env, "hilbert") == 0)
+        return REGION_ORDER_HILBERT;
+    if (env != NULL && strcmp(env, "cart") == 0)
+        return REGION_ORDER_CART;
+
+    return REGION_ORDER_ROW_MAJOR;
+}
+
+OutputFormat getenv_output_format()
+{
+    char *env = getenv("OUTPUT_FORMAT");
+    if (env != NULL && strcmp(env, "p6") == 0)
+        return OUTPUT_FORMAT_P6;
+    if (env != NULL && strcmp(env, "tiles") == 0)
+        return OUTPUT_FORMAT_TILES;
+
+    return OUTPUT_FORMAT_P3;
+}
+
+char *getenv_checkpoint_file()
+{
+    char *env = getenv("CHECKPOINT_FILE");
+    if (env != NULL && env[0] != '\0')
+        return env;
+
+    return NULL;
+}
+
+int getenv_checkpoint_interval()
+{
+    char *env = getenv("CHECKPOINT_INTERVAL");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+char *getenv_restart_file()
+{
+    char *env = getenv("RESTART_FILE");
+    if (env != NULL && env[0] != '\0')
+        return env;
+
+    return NULL;
+}
+
+char *getenv_particle_file()
+{
+    char *env = getenv("PARTICLE_FILE");
+    if (env != NULL && env[0] != '\0')
+        return env;
+
+    return NULL;
+}
+
+char *getenv_benchmark_file()
+{
+    char *env = getenv("BENCHMARK_FILE");
+    if (env != NULL && env[0] != '\0')
+        return env;
+
+    return NULL;
+}
+
+BenchmarkFormat getenv_benchmark_format()
+{
+    char *env = getenv("BENCHMARK_FORMAT");
+    if (env != NULL && strcmp(env, "csv") == 0)
+        return BENCHMARK_FORMAT_CSV;
+
+    return BENCHMARK_FORMAT_JSON;
+}
+
+int getenv_health_interval()
+{
+    char *env = getenv("HEALTH_INTERVAL");
+    if (env != NULL && env[0] >= '0' && env[0] <= '9')
+        return atoi(env);
+
+    return 0;
+}
+
+double getenv_health_energy_drift()
+{
+    char *env = getenv("HEALTH_ENERGY_DRIFT");
+    if (env != NULL && ((env[0] >= '0' && env[0] <= '9') || env[0] == '.'))
+        return atof(env);
+
+    return 0;
+}
+
+double getenv_health_momentum_drift()
+{
+    char *env = getenv("HEALTH_MOMENTUM_DRIFT");
+    if (env != NULL && ((env[0] >= '0' && env[0] <= '9') || env[0] == '.'))
+        return atof(env);
+
+    return 0;
+}
+
+double getenv_health_angular_momentum_drift()
+{
+    char *env = getenv("HEALTH_ANGULAR_MOMENTUM_DRIFT");
+    if (env != NULL && ((env[0] >= '0' && env[0] <= '9') || env[0] == '.'))
+        return atof(env);
+
+    return 0;
+}
@@ -1,3 +1,5 @@
+#include "types.h"
+
 /**
  * Gets the LOG_LEVEL value from the environment.
  * Defaults to LOG_LEVEL_NOTICE.
@@ -9,3 +11,147 @@ unsigned char getenv_log_level();
  * Defaults to -1 (all processes).
  */
 int getenv_log_process();
+
+/**
+ * Gets the LOG_ASYNC value from the environment.
+ * Defaults to 0 (messages are written to stderr synchronously).
+ */
+int getenv_log_async();
+
+/**
+ * Gets the MULTIPOLE_HORIZON value from the environment.
+ * Defaults to -1 (multipole summaries are disabled).
+ */
+int getenv_multipole_horizon();
+
+/**
+ * Gets the NEIGHBOUR_SYNC value from the environment.
+ * Defaults to 0 (processes are synchronised globally every time step).
+ */
+int getenv_neighbour_sync();
+
+/**
+ * Gets the SUB_REGIONS value from the environment.
+ * Defaults to 1 (each process computes a single region).
+ */
+int getenv_sub_regions();
+
+/**
+ * Gets the REBALANCE_INTERVAL value from the environment.
+ * Defaults to 0 (regions are never reassigned).
+ */
+int getenv_rebalance_interval();
+
+/**
+ * Gets the FRAME_WRITERS value from the environment.
+ * Defaults to 0 (debug frames are generated synchronously by the compute processes).
+ */
+int getenv_frame_writers();
+
+/**
+ * Gets the FRAME_FORMAT value from the environment ("ppm" or "stream").
+ * Defaults to FRAME_FORMAT_PPM (a PPM file is written for each debug frame).
+ */
+FrameFormat getenv_frame_format();
+
+/**
+ * Gets the FRAME_DECIMATION value from the environment.
+ * Defaults to 1 (a debug frame is written for every time slot).
+ */
+int getenv_frame_decimation();
+
+/**
+ * Gets the FRAME_DOWNSAMPLE value from the environment.
+ * Defaults to 1 (frame streams have a pixel for every cell).
+ */
+int getenv_frame_downsample();
+
+/**
+ * Gets the ORB_DECOMPOSITION value from the environment.
+ * Defaults to 0 (regions are assigned in blocks of the process grid).
+ */
+int getenv_orb_decomposition();
+
+/**
+ * Gets the SHARED_HALOS value from the environment.
+ * Defaults to 0 (halos are always copied through messages).
+ */
+int getenv_shared_halos();
+
+/**
+ * Gets the HIERARCHICAL_HALOS value from the environment.
+ * Defaults to 0 (halos are sent directly to processes on other nodes).
+ */
+int getenv_hierarchical_halos();
+
+/**
+ * Gets the REGION_ORDER value from the environment ("hilbert" or "cart").
+ * Defaults to REGION_ORDER_ROW_MAJOR (blocks are assigned to processes in row-major order).
+ */
+RegionOrder getenv_region_order();
+
+/**
+ * Gets the OUTPUT_FORMAT value from the environment ("p3", "p6" or "tiles").
+ * Defaults to OUTPUT_FORMAT_P3 (plain-text heatmaps).
+ */
+OutputFormat getenv_output_format();
+
+/**
+ * Gets the CHECKPOINT_FILE value from the environment.
+ * Defaults to NULL (checkpoints are never written).
+ */
+char *getenv_checkpoint_file();
+
+/**
+ * Gets the CHECKPOINT_INTERVAL value from the environment.
+ * Defaults to 0 (checkpoints are only written when the simulation is stopped by a signal).
+ */
+int getenv_checkpoint_interval();
+
+/**
+ * Gets the RESTART_FILE value from the environment.
+ * Defaults to NULL (the simulation starts from newly generated particles).
+ */
+char *getenv_restart_file();
+
+/**
+ * Gets the PARTICLE_FILE value from the environment.
+ * Defaults to NULL (the particles are generated from the spec).
+ */
+char *getenv_particle_file();
+
+/**
+ * Gets the BENCHMARK_FILE value from the environment.
+ * Defaults to NULL (no benchmark is written).
+ */
+char *getenv_benchmark_file();
+
+/**
+ * Gets the BENCHMARK_FORMAT value from the environment ("json" or "csv").
+ * Defaults to BENCHMARK_FORMAT_JSON.
+ */
+BenchmarkFormat getenv_benchmark_format();
+
+/**
+ * Gets the HEALTH_INTERVAL value from the environment.
+ * Defaults to 0 (the health of the particles is never checked).
+ */
+int getenv_health_interval();
+
+/**
+ * Gets the HEALTH_ENERGY_DRIFT value from the environment.
+ * Defaults to 0 (the drift of the kinetic energy is not checked).
+ */
+double getenv_health_energy_drift();
+
+/**
+ * Gets the HEALTH_MOMENTUM_DRIFT value from the environment.
+ * Defaults to 0 (the drift of the momentum is not checked).
+ */
+double getenv_health_momentum_drift();
+
+/**
+ * Gets the HEALTH_ANGULAR_MOMENTUM_DRIFT value from the environment.
+ * Defaults to 0 (the drift of the angular momentum is not checked).
+ */
+double getenv_health_angular_momentum_drift();
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framestream.h"
+#include "heatmap.h"
+#include "log.h"
+
+/**
+ * Writes a little-endian integer of the given number of bytes into a buffer.
+ */
+void put_uint(unsigned char *buf, unsigned long long value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) buf[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/**
+ * Opens a new frame stream for frames of canvas_length x canvas_length cells.
+ */
+FrameStream *open_frame_stream(char *outputfile, int canvas_length, int downsample, int decimation)
+{
+    FrameStream *stream = calloc(1, sizeof(FrameStream));
+    stream->fp = fopen(outputfile, "wb");
+    if (stream->fp == NULL) {
+        LL_ERROR("Could not open %s for writing frames!", outputfile);
+        exit(EXIT_FAILURE);
+    }
+
+    stream->downsample = downsample;
+    stream->decimation = decimation;
+    stream->width = (canvas_length + downsample - 1) / downsample;
+    stream->height = stream->width;
+
+    // Each pixel is a run of its own in the worst case.
+    int num_pixels = stream->width * stream->height;
+    stream->pixels = malloc(num_pixels);
+    stream->previous = calloc(num_pixels, 1);
+    stream->buf = malloc(1 + 2 * (size_t)num_pixels);
+
+    // Leave space for the header, which is only complete once the stream is closed.
+    unsigned char header[FRAME_STREAM_HEADER_LENGTH] = { 0 };
+    fwrite(header, 1, FRAME_STREAM_HEADER_LENGTH, stream->fp);
+    stream->offset = FRAME_STREAM_HEADER_LENGTH;
+
+    return stream;
+}
+
+/**
+ * Converts the cells of a canvas into pixels, taking the max of each square of downsample x downsample cells.
+ */
+void downsample_pixels(FrameStream *stream, Canvas canvas)
+{
+    memset(stream->pixels, 0, stream->width * stream->height);
+
+    for (int y = 0; y < canvas.height; y++) {
+        unsigned char *row = &stream->pixels[(y / stream->downsample) * stream->width];
+        for (int x = 0; x < canvas.width; x++) {
+            int cell = canvas.cells[y * canvas.width + x];
+            unsigned char value = cell > BITMAP_MAX ? FRAME_LARGE : cell > FRAME_SMALL_MAX ? FRAME_SMALL_MAX : cell;
+            unsigned char *pixel = &row[x / stream->downsample];
+            if (value > *pixel) *pixel = value;
+        }
+    }
+}
+
+/**
+ * Run-length encodes an array of values into a buffer.
+ * Returns the number of bytes written.
+ */
+int encode_runs(int n, unsigned char *values, unsigned char *buf)
+{
+    int length = 0;
+
+    for (int i = 0; i < n;) {
+        int run = 1;
+        while (i + run < n && values[i + run] == values[i]) run++;
+
+        // Write the length of the run as a varint, followed by its value.
+        unsigned int remaining = run;
+        while (remaining >= 0x80) {
+            buf[length++] = (remaining & 0x7F) | 0x80;
+            remaining >>= 7;
+        }
+        buf[length++] = remaining;
+        buf[length++] = values[i];
+
+        i += run;
+    }
+
+    return length;
+}
+
+/**
+ * Encodes a canvas of the entire pool as the frame for a time slot, and appends it to the stream.
+ */
+void write_frame_stream(FrameStream *stream, int time_slot, Canvas canvas)
+{
+    int num_pixels = stream->width * stream->height;
+    downsample_pixels(stream, canvas);
+
+    // Encode key frames periodically, and the difference from the previous frame otherwise,
+    // which is mostly zero since most particles move less than a pixel per time slot.
+    int type = stream->num_frames % FRAME_KEY_INTERVAL == 0 ? FRAME_TYPE_KEY : FRAME_TYPE_DELTA;
+    if (type == FRAME_TYPE_KEY)
+        memcpy(stream->previous, stream->pixels, num_pixels);
+    else
+        for (int i = 0; i < num_pixels; i++) stream->previous[i] ^= stream->pixels[i];
+
+    stream->buf[0] = type;
+    int length = 1 + encode_runs(num_pixels, stream->previous, &stream->buf[1]);
+    fwrite(stream->buf, 1, length, stream->fp);
+
+    // Add the frame to the index.
+    if (stream->num_frames == stream->capacity) {
+        stream->capacity = stream->capacity > 0 ? 2 * stream->capacity : 64;
+        stream->offsets = realloc(stream->offsets, stream->capacity * sizeof(long long));
+        stream->lengths = realloc(stream->lengths, stream->capacity * sizeof(int));
+        stream->time_slots = realloc(stream->time_slots, stream->capacity * sizeof(int));
+    }
+    stream->offsets[stream->num_frames] = stream->offset;
+    stream->lengths[stream->num_frames] = length;
+    stream->time_slots[stream->num_frames] = time_slot;
+    stream->num_frames++;
+    stream->offset += length;
+
+    // Keep the pixels of this frame for the next frame.
+    unsigned char *previous = stream->previous;
+    stream->previous = stream->pixels;
+    stream->pixels = previous;
+
+    LL_VERBOSE("Frame %d written to stream (%d bytes).", time_slot, length);
+}
+
+/**
+ * Writes the index and header of a frame stream, and closes it.
+ */
+void close_frame_stream(FrameStream *stream)
+{
+    // Append the index after the last frame.
+    unsigned char entry[FRAME_STREAM_INDEX_LENGTH];
+    for (int i = 0; i < stream->num_frames; i++) {
+        put_uint(&entry[0], stream->offsets[i], 8);
+        put_uint(&entry[8], stream->lengths[i], 4);
+        put_uint(&entry[12], stream->time_slots[i], 4);
+        fwrite(entry, 1, FRAME_STREAM_INDEX_LENGTH, stream->fp);
+    }
+
+    // Fill in the header.
+    unsigned char header[FRAME_STREAM_HEADER_LENGTH] = { 0 };
+    memcpy(header, FRAME_STREAM_MAGIC, 8);
+    put_uint(&header[8], stream->width, 4);
+    put_uint(&header[12], stream->height, 4);
+    put_uint(&header[16], stream->downsample, 4);
+    put_uint(&header[20], stream->decimation, 4);
+    put_uint(&header[24], stream->num_frames, 4);
+    put_uint(&header[32], stream->offset, 8);
+    fseek(stream->fp, 0, SEEK_SET);
+    fwrite(header, 1, FRAME_STREAM_HEADER_LENGTH, stream->fp);
+
+    LL_SUCCESS("Successfully written %d frame(s) to stream.", stream->num_frames);
+
+    // Clean up.
+    fclose(stream->fp);
+    free(stream->pixels);
+    free(stream->previous);
+    free(stream->buf);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->time_slots);
+    free(stream);
+}
@@ -0,0 +1,53 @@
+#include "types.h"
+
+/**
+ * A frame stream stores all debug frames in a single binary file, which is much smaller and
+ * faster to write and load than a PPM for every frame. All integers are little-endian.
+ *
+ * The file starts with a header of FRAME_STREAM_HEADER_LENGTH bytes:
+ *   char[8]    magic ("POOLFRM1")
+ *   uint32     width and height of each frame, after downsampling
+ *   uint32     downsample factor (each pixel is the max of a square of downsample x downsample cells)
+ *   uint32     decimation factor (only every decimation-th time slot is written)
+ *   uint32     number of frames
+ *   uint32     reserved (0)
+ *   uint64     offset of the index
+ *
+ * The header is followed by each frame, and then the index of FRAME_STREAM_INDEX_LENGTH bytes per frame:
+ *   uint64     offset of the frame
+ *   uint32     length of the frame in bytes
+ *   uint32     time slot of the frame
+ *
+ * Each pixel is a single byte, which is the number of small particles covering it (up to FRAME_SMALL_MAX),
+ * or FRAME_LARGE for a large particle. Each frame starts with its type, followed by the run-length encoding
+ * of its pixels (FRAME_TYPE_KEY), or of its pixels XOR the pixels of the previous frame (FRAME_TYPE_DELTA).
+ * Each run is a varint (7 bits per byte, least significant first) of its length, followed by its value.
+ */
+
+#define FRAME_STREAM_MAGIC "POOLFRM1"
+#define FRAME_STREAM_HEADER_LENGTH 40
+#define FRAME_STREAM_INDEX_LENGTH 16
+#define FRAME_TYPE_KEY 0
+#define FRAME_TYPE_DELTA 1
+#define FRAME_SMALL_MAX 254
+#define FRAME_LARGE 255
+
+/**
+ * Number of frames between key frames, which can be decoded without any previous frames.
+ */
+#define FRAME_KEY_INTERVAL 30
+
+/**
+ * Opens a new frame stream for frames of canvas_length x canvas_length cells.
+ */
+FrameStream *open_frame_stream(char *outputfile, int canvas_length, int downsample, int decimation);
+
+/**
+ * Encodes a canvas of the entire pool as the frame for a time slot, and appends it to the stream.
+ */
+void write_frame_stream(FrameStream *stream, int time_slot, Canvas canvas);
+
+/**
+ * Writes the index and header of a frame stream, and closes it.
+ */
+void close_frame_stream(FrameStream *stream);
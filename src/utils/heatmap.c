@@ -1,29 +1,186 @@
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "heatmap.h"
 #include "log.h"
 #include "particles.h"
 #include "regions.h"
 
-#define BITMAP_MAX 255
+#define CELL_VECTOR_LENGTH 8
+#define MAX_STAMPS 16
 
 /**
- * Generates a 2-D canvas of all particles.
- * 
+ * Sums up the values of two cells, such that the sum never exceeds BITMAP_MAX,
+ * unless either cell contains the body of a large particle.
+ */
+int merge_cells(int cell, int other)
+{
+    if (cell > BITMAP_MAX || other > BITMAP_MAX) return BITMAP_MAX + 1;
+
+    return fmin(cell + other, BITMAP_MAX);
+}
+
+/**
+ * Allocates an empty canvas covering the given rectangle of the pool.
+ */
+Canvas allocate_canvas(int x, int y, int width, int height)
+{
+    Canvas canvas = {
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height,
+        .cells = calloc((size_t)width * height, sizeof(int)),
+    };
+
+    return canvas;
+}
+
+/**
+ * Frees a canvas.
+ */
+void free_canvas(Canvas canvas)
+{
+    free(canvas.cells);
+}
+
+/**
+ * Returns the max number of pixels that a particle can be drawn outside of its region.
+ */
+int get_canvas_margin(Spec spec)
+{
+    long double radius = spec.SmallParticleRadius;
+    for (int i = 0; i < spec.NumberOfLargeParticles; i++)
+        if (spec.LargeParticles[i].radius > radius) radius = spec.LargeParticles[i].radius;
+
+    return ceil(radius);
+}
+
+/**
+ * Vector of cells, which is added to with SIMD instructions.
+ */
+typedef int CellVector __attribute__((vector_size(CELL_VECTOR_LENGTH * sizeof(int))));
+
+/**
+ * Circular stamp of a particle radius, as the half-width of the span of each row.
+ */
+typedef struct stamp_t {
+    long double radius;
+    int r;
+    int *half_widths;
+} Stamp;
+
+// Cache of stamps for the most recently drawn radii (one per thread, for the frame writer threads).
+static __thread Stamp stamps[MAX_STAMPS];
+static __thread int num_stamps = 0;
+
+/**
+ * Gets the stamp of a particle radius, computing it if it is not cached yet.
+ */
+Stamp *get_stamp(long double radius)
+{
+    for (int i = 0; i < num_stamps && i < MAX_STAMPS; i++)
+        if (stamps[i].radius == radius) return &stamps[i];
+
+    // Replace the least recently computed stamp once the cache is full.
+    Stamp *stamp = &stamps[num_stamps % MAX_STAMPS];
+    if (num_stamps >= MAX_STAMPS) free(stamp->half_widths);
+    num_stamps++;
+
+    // Each row covers the pixels within the radius (in the same way as draw_particles_scan).
+    stamp->radius = radius;
+    stamp->r = ceil(radius);
+    stamp->half_widths = malloc((2 * stamp->r + 1) * sizeof(int));
+    for (int j = -stamp->r; j <= stamp->r; j++) {
+        int k = stamp->r;
+        while (k >= 0 && j * j + k * k >= radius * radius) k--;
+        stamp->half_widths[j + stamp->r] = k;
+    }
+
+    return stamp;
+}
+
+/**
+ * Adds a small particle to a span of cells, up to BITMAP_MAX.
+ * Cells containing the body of a large particle are left as they are.
+ */
+void add_small_span(int *cells, int n)
+{
+    const CellVector max = BITMAP_MAX - (CellVector){ 0 };
+    int i = 0;
+
+    // Comparisons are -1 where true, so subtracting them increments every cell below BITMAP_MAX.
+    for (; i + CELL_VECTOR_LENGTH <= n; i += CELL_VECTOR_LENGTH) {
+        CellVector v;
+        memcpy(&v, &cells[i], sizeof(v));
+        v -= v < max;
+        memcpy(&cells[i], &v, sizeof(v));
+    }
+    for (; i < n; i++) cells[i] += cells[i] < BITMAP_MAX;
+}
+
+/**
+ * Draws particles onto a canvas, by adding the span of each row of the stamp of their radius.
+ *
  * Any values less than or equal to BITMAP_MAX represents
  * the presence of the body of a small particle, while
  * any value greater than BITMAP_MAX represents the body
  * of a large particle.
  */
-int **generate_region_canvas(Spec spec, int n, Particle *particles, int region_id)
+void draw_particles(Spec spec, Canvas canvas, int n, Particle *particles, int region_id)
 {
     int canvas_length = spec.GridSize * spec.PoolLength;
 
-    // Allocate enough memory for a 2-D canvas.
-    int **canvas = (int **)malloc(canvas_length * sizeof(int *));
-    for (int i = 0; i < canvas_length; i++)
-        canvas[i] = (int *)calloc(canvas_length, sizeof(int));
+    // Only draw within the bounds of the board, and the canvas.
+    int x0 = fmax(0, canvas.x);
+    int y0 = fmax(0, canvas.y);
+    int x1 = fmin(canvas_length, canvas.x + canvas.width);
+    int y1 = fmin(canvas_length, canvas.y + canvas.height);
+
+    for (int i = 0; i < n; i++) {
+        Particle p = particles[i];
+        Stamp *stamp = get_stamp(p.radius);
+
+        // Denormalize the position wrt region.
+        int nx = denorm_region_x(p.x, region_id, spec);
+        int ny = denorm_region_y(p.y, region_id, spec);
+
+        for (int j = -stamp->r; j <= stamp->r; j++) {
+            int y = ny + j;
+            int half_width = stamp->half_widths[j + stamp->r];
+            if (y < y0 || y >= y1 || half_width < 0) continue;
+
+            // Clip the span of the row.
+            int start = nx - half_width < x0 ? x0 : nx - half_width;
+            int end = nx + half_width + 1 > x1 ? x1 : nx + half_width + 1;
+            if (start >= end) continue;
+
+            // If the particle size is large, we immediately set the value to BITMAP_MAX + 1.
+            // Otherwise, we will increment the value, up to BITMAP_MAX.
+            int *cells = &canvas.cells[(y - canvas.y) * canvas.width + (start - canvas.x)];
+            if (p.size == LARGE)
+                for (int k = 0; k < end - start; k++) cells[k] = BITMAP_MAX + 1;
+            else
+                add_small_span(cells, end - start);
+        }
+    }
+}
+
+/**
+ * Draws particles onto a canvas, by testing every pixel within the bounding box of each particle.
+ * This is the original rasteriser, which is kept as a baseline for benchmarking.
+ *
+ * Any values less than or equal to BITMAP_MAX represents
+ * the presence of the body of a small particle, while
+ * any value greater than BITMAP_MAX represents the body
+ * of a large particle.
+ */
+void draw_particles_scan(Spec spec, Canvas canvas, int n, Particle *particles, int region_id)
+{
+    int canvas_length = spec.GridSize * spec.PoolLength;
 
     // Iterate through all particles.
     for (int i = 0; i < n; i++) {
@@ -32,44 +189,348 @@ int **generate_region_canvas(Spec spec, int n, Particle *particles, int region_i
         // Round up the coordinates of the particle's radius to find bounding box.
         int r = ceil(p.radius);
 
+        // Denormalize the position wrt region.
+        int nx = denorm_region_x(p.x, region_id, spec);
+        int ny = denorm_region_y(p.y, region_id, spec);
+
         // Iterate through all pixels occupied by the particle using simple
         // radius checking in the bounding box.
         for (int j = -r; j <= r; j++) {
             for (int k = -r; k <= r; k++) {
-                if (j * j + k * k < p.radius * p.radius) {
-                    // Denormalize the position wrt region.
-                    int nx = denorm_region_x(p.x, region_id, spec);
-                    int ny = denorm_region_y(p.y, region_id, spec);
-
-                    // Get the coordinates relative to the origin.
-                    int x = nx + k;
-                    int y = ny + j;
-
-                    // Prevent drawing outside of the bounds of the board.
-                    if (x < 0 || x >= canvas_length || y < 0 || y >= canvas_length) continue;
-
-                    // If the particle size is large, we immediately set the value to BITMAP_MAX + 1.
-                    // Otherwise, we will increment the value, up to BITMAP_MAX.
-                    if (p.size == LARGE || canvas[y][x] > BITMAP_MAX)
-                        canvas[y][x] = BITMAP_MAX + 1;
-                    else
-                        canvas[y][x] = fmin(BITMAP_MAX, canvas[y][x] + 1);
-                }
+                if (j * j + k * k >= p.radius * p.radius) continue;
+
+                // Get the coordinates relative to the origin.
+                int x = nx + k;
+                int y = ny + j;
+
+                // Prevent drawing outside of the bounds of the board, or the canvas.
+                if (x < 0 || x >= canvas_length || y < 0 || y >= canvas_length) continue;
+                if (x < canvas.x || x >= canvas.x + canvas.width || y < canvas.y || y >= canvas.y + canvas.height) continue;
+
+                // If the particle size is large, we immediately set the value to BITMAP_MAX + 1.
+                // Otherwise, we will increment the value, up to BITMAP_MAX.
+                int *cell = &canvas.cells[(y - canvas.y) * canvas.width + (x - canvas.x)];
+                if (p.size == LARGE || *cell > BITMAP_MAX)
+                    *cell = BITMAP_MAX + 1;
+                else
+                    *cell = fmin(BITMAP_MAX, *cell + 1);
             }
         }
     }
+}
+
+/**
+ * Allocates an empty tile canvas for a particular region.
+ */
+Canvas allocate_region_canvas(Spec spec, int region_id, int margin)
+{
+    int canvas_length = spec.GridSize * spec.PoolLength;
+
+    // Cover the region with a margin on each side, within the bounds of the board.
+    int x0 = fmax(0, get_region_x(region_id, spec) * spec.GridSize - margin);
+    int y0 = fmax(0, get_region_y(region_id, spec) * spec.GridSize - margin);
+    int x1 = fmin(canvas_length, (get_region_x(region_id, spec) + 1) * spec.GridSize + margin);
+    int y1 = fmin(canvas_length, (get_region_y(region_id, spec) + 1) * spec.GridSize + margin);
+
+    return allocate_canvas(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * Generates a tile canvas of all particles in a particular region.
+ */
+Canvas generate_region_canvas(Spec spec, int n, Particle *particles, int region_id, int margin)
+{
+    Canvas canvas = allocate_region_canvas(spec, region_id, margin);
+    draw_particles(spec, canvas, n, particles, region_id);
 
     return canvas;
 }
 
 /**
- * Generate a heatmap of particles in all regions from a list of canvases, 
- * and saves it to an image file.
+ * Creates an incremental canvas from an empty canvas, which it takes ownership of.
  */
-void generate_heatmap(Spec spec, int num_regions, int ***canvas_by_region, char *outputfile)
+IncrementalCanvas allocate_incremental_canvas(Canvas canvas)
+{
+    return (IncrementalCanvas){
+        .canvas = canvas,
+        .small_counts = calloc(canvas.width * canvas.height, sizeof(int)),
+        .large_counts = calloc(canvas.width * canvas.height, sizeof(int)),
+        .drawn = NULL,
+        .capacity = 0,
+    };
+}
+
+/**
+ * Frees an incremental canvas, including its canvas.
+ */
+void free_incremental_canvas(IncrementalCanvas canvas)
+{
+    free_canvas(canvas.canvas);
+    free(canvas.small_counts);
+    free(canvas.large_counts);
+    free(canvas.drawn);
+}
+
+/**
+ * Adds (or removes, with a negative delta) a particle at a rasterised position to the counts of an
+ * incremental canvas, and updates the value of every pixel it covers.
+ */
+void stamp_incremental_canvas(Spec spec, IncrementalCanvas *ic, DrawnParticle p, int delta)
 {
     int canvas_length = spec.GridSize * spec.PoolLength;
+    Canvas canvas = ic->canvas;
+    Stamp *stamp = get_stamp(p.radius);
+    int *counts = p.size == LARGE ? ic->large_counts : ic->small_counts;
+
+    // Only draw within the bounds of the board, and the canvas.
+    int x0 = fmax(0, canvas.x);
+    int y0 = fmax(0, canvas.y);
+    int x1 = fmin(canvas_length, canvas.x + canvas.width);
+    int y1 = fmin(canvas_length, canvas.y + canvas.height);
+
+    for (int j = -stamp->r; j <= stamp->r; j++) {
+        int y = p.y + j;
+        int half_width = stamp->half_widths[j + stamp->r];
+        if (y < y0 || y >= y1 || half_width < 0) continue;
+
+        int start = p.x - half_width < x0 ? x0 : p.x - half_width;
+        int end = p.x + half_width + 1 > x1 ? x1 : p.x + half_width + 1;
+        for (int i = (y - canvas.y) * canvas.width + (start - canvas.x), k = start; k < end; i++, k++) {
+            counts[i] += delta;
+
+            // Large particles cover any small particles, and small particles saturate at BITMAP_MAX.
+            if (ic->large_counts[i] > 0)
+                canvas.cells[i] = BITMAP_MAX + 1;
+            else
+                canvas.cells[i] = ic->small_counts[i] < BITMAP_MAX ? ic->small_counts[i] : BITMAP_MAX;
+        }
+    }
+}
+
+/**
+ * Finds a drawn particle by ID which has not been seen in this update yet, or NULL if there is none.
+ */
+DrawnParticle *find_drawn_particle(IncrementalCanvas *ic, int id)
+{
+    if (ic->capacity == 0) return NULL;
+
+    for (int i = (unsigned)id * 2654435761U & (ic->capacity - 1); ic->drawn[i].used; i = (i + 1) & (ic->capacity - 1))
+        if (ic->drawn[i].id == id && !ic->drawn[i].seen) return &ic->drawn[i];
+
+    return NULL;
+}
+
+/**
+ * Inserts a drawn particle into a hash table with a power-of-2 capacity.
+ */
+void insert_drawn_particle(DrawnParticle *drawn, int capacity, DrawnParticle p)
+{
+    int i = (unsigned)p.id * 2654435761U & (capacity - 1);
+    while (drawn[i].used) i = (i + 1) & (capacity - 1);
+    drawn[i] = p;
+}
+
+/**
+ * Updates an incremental canvas to show the given particles, each within its own region.
+ */
+void update_incremental_canvas(Spec spec, IncrementalCanvas *ic, int n, Particle *particles)
+{
+    // Keep the hash table at most half full.
+    int capacity = 16;
+    while (capacity < 2 * n) capacity *= 2;
+    DrawnParticle *drawn = calloc(capacity, sizeof(DrawnParticle));
+
+    for (int i = 0; i < n; i++) {
+        Particle p = particles[i];
+        DrawnParticle d = {
+            .used = 1,
+            .id = p.id,
+            .x = denorm_region_x(p.x, p.region, spec),
+            .y = denorm_region_y(p.y, p.region, spec),
+            .size = p.size,
+            .radius = p.radius,
+        };
+
+        // Only redraw the particle if its footprint has changed since the last update.
+        DrawnParticle *last = find_drawn_particle(ic, p.id);
+        if (last != NULL) last->seen = 1;
+        if (last == NULL || last->x != d.x || last->y != d.y || last->size != d.size || last->radius != d.radius) {
+            if (last != NULL) stamp_incremental_canvas(spec, ic, *last, -1);
+            stamp_incremental_canvas(spec, ic, d, 1);
+        }
+
+        insert_drawn_particle(drawn, capacity, d);
+    }
 
+    // Erase all particles which are no longer on the canvas.
+    for (int i = 0; i < ic->capacity; i++)
+        if (ic->drawn[i].used && !ic->drawn[i].seen) stamp_incremental_canvas(spec, ic, ic->drawn[i], -1);
+
+    free(ic->drawn);
+    ic->drawn = drawn;
+    ic->capacity = capacity;
+}
+
+/**
+ * Merges the cells of another canvas into the overlapping cells of a canvas, in-place.
+ */
+void merge_canvas(Canvas canvas, Canvas other)
+{
+    int x0 = fmax(canvas.x, other.x);
+    int y0 = fmax(canvas.y, other.y);
+    int x1 = fmin(canvas.x + canvas.width, other.x + other.width);
+    int y1 = fmin(canvas.y + canvas.height, other.y + other.height);
+
+    for (int y = y0; y < y1; y++) {
+        int *row = &canvas.cells[(y - canvas.y) * canvas.width];
+        int *other_row = &other.cells[(y - other.y) * other.width];
+        for (int x = x0; x < x1; x++) row[x - canvas.x] = merge_cells(row[x - canvas.x], other_row[x - other.x]);
+    }
+}
+
+/**
+ * Packs the cells of a canvas within a rectangle into a buffer, prefixed with its header.
+ */
+int pack_canvas_rect(Canvas canvas, int x0, int y0, int x1, int y1, int *buf)
+{
+    if (x0 < canvas.x) x0 = canvas.x;
+    if (y0 < canvas.y) y0 = canvas.y;
+    if (x1 > canvas.x + canvas.width) x1 = canvas.x + canvas.width;
+    if (y1 > canvas.y + canvas.height) y1 = canvas.y + canvas.height;
+    if (x0 >= x1 || y0 >= y1) return 0;
+
+    int width = x1 - x0;
+    if (buf != NULL) {
+        int header[CANVAS_HEADER_LENGTH] = { x0, y0, width, y1 - y0 };
+        memcpy(buf, header, sizeof(header));
+        for (int y = y0; y < y1; y++)
+            memcpy(&buf[CANVAS_HEADER_LENGTH + (y - y0) * width], &canvas.cells[(y - canvas.y) * canvas.width + (x0 - canvas.x)], width * sizeof(int));
+    }
+
+    return CANVAS_HEADER_LENGTH + (y1 - y0) * width;
+}
+
+/**
+ * Packs the rows of a canvas within [y0, y1) into a buffer, prefixed with its header.
+ */
+int pack_canvas_rows(Canvas canvas, int y0, int y1, int *buf)
+{
+    return pack_canvas_rect(canvas, canvas.x, y0, canvas.x + canvas.width, y1, buf);
+}
+
+/**
+ * Merges all packed canvases in a buffer into a canvas, in-place.
+ */
+void merge_packed_canvases(Canvas canvas, int count, int *buf)
+{
+    for (int offset = 0; offset < count;) {
+        Canvas other = {
+            .x = buf[offset],
+            .y = buf[offset + 1],
+            .width = buf[offset + 2],
+            .height = buf[offset + 3],
+            .cells = &buf[offset + CANVAS_HEADER_LENGTH],
+        };
+        merge_canvas(canvas, other);
+        offset += CANVAS_HEADER_LENGTH + other.width * other.height;
+    }
+}
+
+/**
+ * Writes the header of a binary (P6) heatmap into a buffer.
+ */
+int format_binary_header(char *buf, int width, int height)
+{
+    return sprintf(buf, "P6\n%d %d\n%d\n", width, height, BITMAP_MAX);
+}
+
+/**
+ * Encodes the rows of a canvas within [y0, y1) into RGB pixels.
+ */
+void encode_pixels(Canvas canvas, int y0, int y1, unsigned char *pixels)
+{
+    for (int i = y0 * canvas.width; i < y1 * canvas.width; i++) {
+        int sum = canvas.cells[i];
+
+        // If the value is greater than BITMAP_MAX, we draw a blue pixel.
+        // Otherwise, we draw a red pixel whose intensity is the value.
+        unsigned char *pixel = &pixels[3 * (i - y0 * canvas.width)];
+        pixel[0] = sum > BITMAP_MAX ? 0 : sum;
+        pixel[1] = 0;
+        pixel[2] = sum > BITMAP_MAX ? BITMAP_MAX : 0;
+    }
+}
+
+/**
+ * Arguments for each thread encoding a band of rows.
+ */
+typedef struct encode_args_t {
+    Canvas canvas;
+    int y0;
+    int y1;
+    unsigned char *pixels;
+} EncodeArgs;
+
+void *encode_pixels_thread(void *arg)
+{
+    EncodeArgs *args = arg;
+    encode_pixels(args->canvas, args->y0, args->y1, &args->pixels[3 * args->y0 * args->canvas.width]);
+
+    return NULL;
+}
+
+/**
+ * Generate a binary (P6) heatmap of particles from a canvas covering the entire pool,
+ * encoding bands of rows on multiple threads, and saves it to an image file.
+ */
+void generate_binary_heatmap(Canvas canvas, char *outputfile, int num_threads)
+{
+    // Open file for writing.
+    FILE *fp = fopen(outputfile, "wb");
+    if (fp == NULL) {
+        LL_ERROR("Could not open %s for writing!", outputfile);
+        exit(EXIT_FAILURE);
+    }
+
+    // Encode each band of rows on its own thread.
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > canvas.height) num_threads = canvas.height > 0 ? canvas.height : 1;
+    unsigned char *pixels = malloc(3 * (size_t)canvas.width * canvas.height);
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    EncodeArgs *args = malloc(num_threads * sizeof(EncodeArgs));
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (EncodeArgs){
+            .canvas = canvas,
+            .y0 = (long long)canvas.height * i / num_threads,
+            .y1 = (long long)canvas.height * (i + 1) / num_threads,
+            .pixels = pixels,
+        };
+        pthread_create(&threads[i], NULL, encode_pixels_thread, &args[i]);
+    }
+    for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+    // Write the header, followed by all pixels at once.
+    char header[64];
+    int header_length = format_binary_header(header, canvas.width, canvas.height);
+    fwrite(header, 1, header_length, fp);
+    fwrite(pixels, 3, (size_t)canvas.width * canvas.height, fp);
+
+    // Print success message.
+    LL_SUCCESS("Successfully written image to %s.", outputfile);
+
+    // Clean up.
+    fclose(fp);
+    free(pixels);
+    free(threads);
+    free(args);
+}
+
+/**
+ * Generate a heatmap of particles from a canvas covering the entire pool,
+ * and saves it to an image file.
+ */
+void generate_heatmap(Canvas canvas, char *outputfile)
+{
     // Open file for writing.
     FILE *fp = fopen(outputfile, "w");
     if (fp == NULL) {
@@ -78,22 +539,12 @@ void generate_heatmap(Spec spec, int num_regions, int ***canvas_by_region, char
     }
 
     // Print PPM header.
-    fprintf(fp, "P3\n%d %d\n%d\n", canvas_length, canvas_length, BITMAP_MAX);
+    fprintf(fp, "P3\n%d %d\n%d\n", canvas.width, canvas.height, BITMAP_MAX);
 
     // Print each cell in the entire canvas.
-    for (int y = 0; y < canvas_length; y++) {
-        for (int x = 0; x < canvas_length; x++) {
-            int sum = 0;
-
-            // Sum up the cells.
-            for (int region = 0; region < num_regions; region++) {
-                int cell = canvas_by_region[region][y][x];
-
-                if (sum > BITMAP_MAX || cell > BITMAP_MAX)
-                    sum = BITMAP_MAX + 1;
-                else
-                    sum = fmin(sum + cell, BITMAP_MAX);
-            }
+    for (int y = 0; y < canvas.height; y++) {
+        for (int x = 0; x < canvas.width; x++) {
+            int sum = canvas.cells[y * canvas.width + x];
 
             // If the value is greater than BITMAP_MAX, we draw a blue pixel.
             // Otherwise, we draw a red pixel whose intensity is the value.
@@ -102,7 +553,7 @@ void generate_heatmap(Spec spec, int num_regions, int ***canvas_by_region, char
             else
                 fprintf(fp, "%d 0 0", sum);
 
-            if (x < canvas_length - 1)
+            if (x < canvas.width - 1)
                 fprintf(fp, " ");
             else
                 fprintf(fp, "\n");
@@ -1,17 +1,129 @@
 #include "types.h"
 
 /**
- * Generates a 2-D canvas of all particles in a particular region.
- * 
+ * Max value of a cell covered by small particles. Any greater value represents a large particle.
+ */
+#define BITMAP_MAX 255
+
+/**
+ * Number of ints in the header of a packed canvas (x, y, width, height), followed by its cells.
+ */
+#define CANVAS_HEADER_LENGTH 4
+
+/**
+ * Allocates an empty canvas covering the given rectangle of the pool.
+ */
+Canvas allocate_canvas(int x, int y, int width, int height);
+
+/**
+ * Frees a canvas.
+ */
+void free_canvas(Canvas canvas);
+
+/**
+ * Returns the max number of pixels that a particle can be drawn outside of its region,
+ * i.e. the radius of the largest particle, rounded up.
+ */
+int get_canvas_margin(Spec spec);
+
+/**
+ * Draws particles in a particular region onto a canvas.
+ * Any part of a particle which lies outside of the canvas is not drawn.
+ *
  * Any values less than or equal to BITMAP_MAX represents
  * the presence of the body of a small particle, while
  * any value greater than BITMAP_MAX represents the body
  * of a large particle.
  */
-int **generate_region_canvas(Spec spec, int n, Particle *particles, int region_id);
+void draw_particles(Spec spec, Canvas canvas, int n, Particle *particles, int region_id);
+
+/**
+ * Draws particles in a particular region onto a canvas in the same way as draw_particles,
+ * by testing every pixel within the bounding box of each particle.
+ *
+ * This is much slower than draw_particles, which draws a precomputed span of cells for each row
+ * of a particle, and is only kept as a baseline for benchmarking.
+ */
+void draw_particles_scan(Spec spec, Canvas canvas, int n, Particle *particles, int region_id);
+
+/**
+ * Allocates an empty tile canvas for a particular region, in the same way as generate_region_canvas.
+ */
+Canvas allocate_region_canvas(Spec spec, int region_id, int margin);
+
+/**
+ * Generates a tile canvas of all particles in a particular region.
+ * The tile covers the region with a margin on each side (within the bounds of the board),
+ * which should be at least the canvas margin, so that every particle is drawn in full.
+ */
+Canvas generate_region_canvas(Spec spec, int n, Particle *particles, int region_id, int margin);
+
+/**
+ * Creates an incremental canvas from an empty canvas, which it takes ownership of.
+ */
+IncrementalCanvas allocate_incremental_canvas(Canvas canvas);
 
 /**
- * Generate a heatmap of particles in all regions from a list of canvases, 
+ * Frees an incremental canvas, including its canvas.
+ */
+void free_incremental_canvas(IncrementalCanvas canvas);
+
+/**
+ * Updates an incremental canvas to show the given particles (according to the region of each particle),
+ * such that its canvas is the same as if the particles were drawn onto an empty canvas.
+ *
+ * The rasterised position of every particle is kept by its ID, so that only particles which have moved
+ * by at least a pixel (or were added or removed) since the last update are erased and redrawn.
+ * The exact number of small and large particles covering each pixel is kept, so that erasing a particle
+ * restores the pixels that it saturated or covered.
+ */
+void update_incremental_canvas(Spec spec, IncrementalCanvas *ic, int n, Particle *particles);
+
+/**
+ * Merges the cells of another canvas into the overlapping cells of a canvas, in-place,
+ * such that the sum never exceeds BITMAP_MAX, unless either cell contains the body of a large particle.
+ */
+void merge_canvas(Canvas canvas, Canvas other);
+
+/**
+ * Generate a heatmap of particles from a canvas covering the entire pool,
  * and saves it to an image file.
  */
-void generate_heatmap(Spec spec, int num_regions, int ***canvas_by_region, char *outputfile);
+void generate_heatmap(Canvas canvas, char *outputfile);
+
+/**
+ * Packs the cells of a canvas within the rectangle [x0, x1) x [y0, y1) into a buffer, prefixed with its
+ * header (x, y, width, height) of CANVAS_HEADER_LENGTH ints. If buf is NULL, nothing is written.
+ * Returns the number of ints packed, or 0 if the canvas has no cells within the rectangle.
+ */
+int pack_canvas_rect(Canvas canvas, int x0, int y0, int x1, int y1, int *buf);
+
+/**
+ * Packs the rows of a canvas within [y0, y1) into a buffer, prefixed with its header
+ * (x, y, width, height) of CANVAS_HEADER_LENGTH ints. If buf is NULL, nothing is written.
+ * Returns the number of ints packed, or 0 if the canvas has no rows within [y0, y1).
+ */
+int pack_canvas_rows(Canvas canvas, int y0, int y1, int *buf);
+
+/**
+ * Merges all packed canvases in a buffer of count ints into a canvas, in-place.
+ */
+void merge_packed_canvases(Canvas canvas, int count, int *buf);
+
+/**
+ * Writes the header of a binary (P6) heatmap into a buffer.
+ * Returns the length of the header.
+ */
+int format_binary_header(char *buf, int width, int height);
+
+/**
+ * Encodes the rows of a canvas within [y0, y1) into RGB pixels (3 bytes each),
+ * where y0 and y1 are relative to the top of the canvas.
+ */
+void encode_pixels(Canvas canvas, int y0, int y1, unsigned char *pixels);
+
+/**
+ * Generate a binary (P6) heatmap of particles from a canvas covering the entire pool,
+ * encoding bands of rows on multiple threads, and saves it to an image file.
+ */
+void generate_binary_heatmap(Canvas canvas, char *outputfile, int num_threads);
@@ -1,5 +1,10 @@
 #include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "env.h"
 #include "log.h"
@@ -41,8 +46,185 @@ const char *log_level_colors[] = {
 
 const char color_end[] = "\033[0m";
 
+// Whether messages are written by the asynchronous logger.
+int log_async = 0;
+
+// Number of entries in the ring buffer of the asynchronous logger (a power of 2),
+// and the length of the messages which fit in an entry.
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_LENGTH 256
+
+/**
+ * Entry of the ring buffer of the asynchronous logger.
+ */
+typedef struct log_entry_t {
+    // Position of the ring buffer that the entry can be written for, or read from once it is one past it.
+    unsigned long sequence;
+
+    LogLevel level;
+    time_t time;
+    int process_id;
+    char message[LOG_MESSAGE_LENGTH];
+
+    // Messages which are too long for the entry are allocated separately.
+    char *long_message;
+} LogEntry;
+
+static LogEntry log_ring[LOG_RING_SIZE];
+
+// Position of the next entry to be written by any thread, and to be read by the logger thread.
+static unsigned long log_head = 0;
+static unsigned long log_tail = 0;
+
+// Number of messages which have been written to stderr.
+static unsigned long log_flushed = 0;
+
+static pthread_t log_thread;
+static int log_stopping = 0;
+
+/**
+ * Writes all messages in the ring buffer to stderr, and returns the number of messages written.
+ */
+int drain_log()
+{
+    int n = 0;
+    char time_str[26];
+    struct tm tm;
+
+    while (1) {
+        LogEntry *entry = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != log_tail + 1) break;
+
+        strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", localtime_r(&entry->time, &tm));
+        fprintf(stderr, "%s[%s] %02d ~  %s%s%s\n",
+            log_level_colors[entry->level],
+            time_str,
+            entry->process_id,
+            log_level_labels[entry->level],
+            entry->long_message != NULL ? entry->long_message : entry->message,
+            color_end);
+        free(entry->long_message);
+
+        // Hand the entry back to the writers for the next round of the ring buffer.
+        __atomic_store_n(&entry->sequence, log_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_tail++;
+        n++;
+    }
+
+    if (n > 0) {
+        fflush(stderr);
+        __atomic_store_n(&log_flushed, log_tail, __ATOMIC_RELEASE);
+    }
+
+    return n;
+}
+
+/**
+ * Background thread of the asynchronous logger, which drains the ring buffer until the logger is stopped.
+ */
+void *run_log_thread(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE)) {
+        if (drain_log() == 0) usleep(1000);
+    }
+    drain_log();
+
+    return NULL;
+}
+
+/**
+ * Writes the remaining messages and stops the logger thread when the program exits.
+ */
+void stop_log_thread()
+{
+    __atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    log_async = 0;
+}
+
+/**
+ * Appends a message to the ring buffer of the asynchronous logger.
+ * Writers claim entries in order without locks, and only wait if the ring buffer is full.
+ */
+void log_async_message(LogLevel level, const char *fmt, ...)
+{
+    // Claim the next free entry.
+    unsigned long position = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    LogEntry *entry;
+    while (1) {
+        entry = &log_ring[position & (LOG_RING_SIZE - 1)];
+        long diff = (long)(__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) - position);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // The ring buffer is full, so wait for the logger thread rather than dropping the message.
+            sched_yield();
+            position = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        } else {
+            position = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    entry->level = level;
+    entry->time = time(NULL);
+    entry->process_id = get_process_id();
+    entry->long_message = NULL;
+
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(entry->message, LOG_MESSAGE_LENGTH, fmt, args);
+    va_end(args);
+    if (length >= LOG_MESSAGE_LENGTH) {
+        entry->long_message = malloc(length + 1);
+        va_start(args, fmt);
+        vsnprintf(entry->long_message, length + 1, fmt, args);
+        va_end(args);
+    }
+
+    // Publish the entry to the logger thread.
+    __atomic_store_n(&entry->sequence, position + 1, __ATOMIC_RELEASE);
+
+    if (level == LOG_LEVEL_ERROR) {
+        while ((long)(__atomic_load_n(&log_flushed, __ATOMIC_ACQUIRE) - (position + 1)) < 0)
+            sched_yield();
+    }
+}
+
+/**
+ * Waits for all messages in the ring buffer of the asynchronous logger to be written.
+ */
+void flush_log()
+{
+    if (!log_async) return;
+
+    unsigned long head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    while ((long)(__atomic_load_n(&log_flushed, __ATOMIC_ACQUIRE) - head) < 0)
+        sched_yield();
+}
+
+/**
+ * Starts the logger thread, which writes the messages of all threads of this process.
+ */
+void start_log_thread()
+{
+    for (unsigned long i = 0; i < LOG_RING_SIZE; i++)
+        log_ring[i].sequence = i;
+
+    if (pthread_create(&log_thread, NULL, run_log_thread, NULL) != 0) {
+        LL_ERROR("%s", "Could not start the logger thread, logging synchronously instead.");
+        return;
+    }
+
+    log_async = 1;
+    atexit(stop_log_thread);
+}
+
 void set_log_level_env()
 {
     log_level = getenv_log_level();
     log_process = getenv_log_process();
+
+    if (getenv_log_async() && !log_async) start_log_thread();
 }
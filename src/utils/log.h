@@ -24,31 +24,50 @@ typedef enum log_level_t {
 } LogLevel;
 #endif
 
+/**
+ * Messages above this level are compiled out entirely, including the evaluation of their arguments,
+ * regardless of LOG_LEVEL (e.g. pass LOG_MAX_LEVEL=4 to make to compile out MPI and debug messages).
+ */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_MPI2
+#endif
+
 extern unsigned char log_level;
 extern int log_process;
+extern int log_async;
 extern const char *log_level_labels[];
 extern const char *log_level_colors[];
 extern const char color_end[];
 
-#define LOG(level, fmt, arg...)                                                           \
-    do {                                                                                  \
-        if (level <= log_level && (log_process < 0 || log_process == get_process_id())) { \
-            time_t timer;                                                                 \
-            char time_str[26];                                                            \
-            time(&timer);                                                                 \
-            strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", localtime(&timer));               \
-            fprintf(stderr, "%s[%s] %02d ~  %s" fmt "%s\n",                               \
-                log_level_colors[level],                                                  \
-                time_str,                                                                 \
-                get_process_id(),                                                         \
-                log_level_labels[level],                                                  \
-                arg,                                                                      \
-                color_end);                                                               \
-            fflush(stderr);                                                               \
-        }                                                                                 \
+/**
+ * Writes a message at the given level if the condition holds, on the processes selected by LOG_PROCESS.
+ */
+#define LOG_IF(condition, level, fmt, arg...)                                                       \
+    do {                                                                                            \
+        if ((condition) && (log_process < 0 || log_process == get_process_id())) {                  \
+            if (log_async) {                                                                        \
+                log_async_message(level, fmt, arg);                                                 \
+                break;                                                                              \
+            }                                                                                       \
+            time_t timer;                                                                           \
+            char time_str[26];                                                                      \
+            time(&timer);                                                                           \
+            strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", localtime(&timer));                         \
+            fprintf(stderr, "%s[%s] %02d ~  %s" fmt "%s\n",                                         \
+                log_level_colors[level],                                                            \
+                time_str,                                                                           \
+                get_process_id(),                                                                   \
+                log_level_labels[level],                                                            \
+                arg,                                                                                \
+                color_end);                                                                         \
+            fflush(stderr);                                                                         \
+        }                                                                                           \
     } while (0)
 
-#define LL(fmt, arg...) LOG(LOG_LEVEL_NONE, fmt, arg)
+#define LOG(level, fmt, arg...) LOG_IF((level) <= LOG_MAX_LEVEL && (level) <= log_level, level, fmt, arg)
+
+// Messages without a level are always written, without comparing against the (unsigned) log level.
+#define LL(fmt, arg...) LOG_IF(1, LOG_LEVEL_NONE, fmt, arg)
 #define LL_MPI2(fmt, arg...) LOG(LOG_LEVEL_MPI2, fmt, arg)
 #define LL_DEBUG2(fmt, arg...) LOG(LOG_LEVEL_DEBUG2, fmt, arg)
 #define LL_DEBUG(fmt, arg...) LOG(LOG_LEVEL_DEBUG, fmt, arg)
@@ -60,4 +79,12 @@ extern const char color_end[];
 #define LL_ERROR(fmt, arg...) LOG(LOG_LEVEL_ERROR, fmt, arg)
 
 // The log level can be overwritten by the LOG_LEVEL environment variable.
+// Starts the asynchronous logger if LOG_ASYNC is set.
 void set_log_level_env();
+
+// Appends a message to the ring buffer of the asynchronous logger, which is written to stderr by a background thread.
+// Errors are waited for until they are written, since the program usually exits right after them.
+void log_async_message(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Waits for all messages in the ring buffer of the asynchronous logger to be written.
+void flush_log();
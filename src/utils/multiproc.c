@@ -1,4 +1,3 @@
-#include <math.h>
 #include <mpi.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -6,10 +5,12 @@
 
 #include "log.h"
 #include "multiproc.h"
+#include "timer.h"
 #include "types.h"
 
 #define MASTER_ID 0
 #define PARTICLE_FIELD_COUNT 9
+#define SPEC_FIELD_COUNT 14
 
 /**
  * MPI rank number.
@@ -21,6 +22,18 @@ int rank;
  */
 int size;
 
+/**
+ * Total time spent waiting for other processes (until their messages arrive or requests complete),
+ * and transferring messages once they are matched, in nanoseconds.
+ */
+long long mpi_wait_time = 0;
+long long mpi_transfer_time = 0;
+
+/**
+ * MPI communicator of all compute processes.
+ */
+MPI_Comm comm;
+
 /**
  * Initializes MPI.
  */
@@ -29,13 +42,32 @@ void multiproc_init(int argc, char **argv)
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    comm = MPI_COMM_WORLD;
+}
+
+/**
+ * Splits off the last processes as dedicated frame writers, which do not compute any regions.
+ */
+int mpi_split_frame_writers(int num_writers)
+{
+    if (num_writers < 0 || num_writers >= size) {
+        if (rank == MASTER_ID) LL_ERROR("Cannot use %d frame writer(s) with %d process(es)!", num_writers, size);
+        exit(EXIT_FAILURE);
+    }
+
+    int is_writer = rank >= size - num_writers;
+    MPI_Comm_split(MPI_COMM_WORLD, is_writer, rank, &comm);
+    size -= num_writers;
+
+    return is_writer;
 }
 
 /**
- * Finalizes MPI.
+ * Writes out any pending log messages, and finalizes MPI.
  */
 void multiproc_finalize()
 {
+    flush_log();
     MPI_Finalize();
 }
 
@@ -81,18 +113,141 @@ void mpi_init_particle(MPI_Datatype *newtype)
 }
 
 /**
- * Gets the number of cores.
+ * Initializes and creates a datatype for the Spec struct, excluding its large particles.
  */
-int get_num_cores()
+void mpi_init_spec(MPI_Datatype *newtype)
 {
-    // Fail if the number of cores is not a perfect square.
-    int np_sqrt = sqrt(size);
+    int blocklengths[SPEC_FIELD_COUNT] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+    MPI_Aint displacements[SPEC_FIELD_COUNT] = {
+        offsetof(Spec, TimeSlots),
+        offsetof(Spec, TimeStep),
+        offsetof(Spec, Horizon),
+        offsetof(Spec, GridSize),
+        offsetof(Spec, NumberOfSmallParticles),
+        offsetof(Spec, SmallParticleMass),
+        offsetof(Spec, SmallParticleRadius),
+        offsetof(Spec, NumberOfLargeParticles),
+        offsetof(Spec, PoolLength),
+        offsetof(Spec, TotalNumberOfParticles),
+        offsetof(Spec, Seed),
+        offsetof(Spec, Distribution),
+        offsetof(Spec, DistributionRadius),
+        offsetof(Spec, NumberOfClusters),
+    };
 
-    if (np_sqrt * np_sqrt != size) {
-        LL_ERROR("Number of processes %d must be a perfect square!", size);
+    MPI_Datatype types[SPEC_FIELD_COUNT] = {
+        MPI_INT,
+        MPI_LONG_DOUBLE,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_LONG_DOUBLE,
+        MPI_LONG_DOUBLE,
+        MPI_INT,
+        MPI_INT,
+        MPI_INT,
+        MPI_LONG_LONG,
+        MPI_INT,
+        MPI_LONG_DOUBLE,
+        MPI_INT,
+    };
+
+    // Create the datatype.
+    int error = MPI_Type_create_struct(SPEC_FIELD_COUNT, blocklengths, displacements, types, newtype);
+    if (error != MPI_SUCCESS) {
+        LL_ERROR("Could not initialize Spec MPI datatype! Error code: %d", error);
         exit(EXIT_FAILURE);
     }
 
+    MPI_Type_commit(newtype);
+}
+
+/**
+ * Splits the processes by node, such that processes on the same node can share memory.
+ */
+void mpi_init_node_comm(MPI_Comm *node_comm, int *node_ranks)
+{
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, node_comm);
+
+    // Translate every process into its rank within the node communicator, if it is on the same node.
+    MPI_Group world_group, node_group;
+    MPI_Comm_group(comm, &world_group);
+    MPI_Comm_group(*node_comm, &node_group);
+
+    int *world_ranks = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) world_ranks[i] = i;
+    MPI_Group_translate_ranks(world_group, size, world_ranks, node_group, node_ranks);
+    for (int i = 0; i < size; i++)
+        if (node_ranks[i] == MPI_UNDEFINED) node_ranks[i] = -1;
+
+    free(world_ranks);
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&node_group);
+}
+
+/**
+ * Creates a communicator between the leaders (i.e. the first process) of each node,
+ * and finds the node of every process.
+ */
+int mpi_init_leader_comm(MPI_Comm node_comm, MPI_Comm *leader_comm, int *node_ids)
+{
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, leader_comm);
+
+    // Nodes are numbered by the rank of their leader within the leader communicator.
+    int node_id = 0;
+    if (node_rank == 0) MPI_Comm_rank(*leader_comm, &node_id);
+    MPI_Bcast(&node_id, 1, MPI_INT, 0, node_comm);
+    MPI_Allgather(&node_id, 1, MPI_INT, node_ids, 1, MPI_INT, comm);
+
+    int num_nodes = 0;
+    for (int i = 0; i < size; i++)
+        if (node_ids[i] + 1 > num_nodes) num_nodes = node_ids[i] + 1;
+
+    return num_nodes;
+}
+
+/**
+ * Assigns the blocks of a procs_x x procs_y (periodic) process grid to processes using a
+ * Cartesian topology, allowing MPI to reorder the processes to match the physical topology.
+ */
+void mpi_get_cart_block_ranks(int procs_x, int procs_y, int *block_ranks)
+{
+    MPI_Comm cart_comm;
+    int dims[2] = { procs_y, procs_x };
+    int periods[2] = { 1, 1 };
+    MPI_Cart_create(comm, 2, dims, periods, 1, &cart_comm);
+
+    // Find the block at the coordinates of this process in the topology.
+    int cart_rank, coords[2];
+    MPI_Comm_rank(cart_comm, &cart_rank);
+    MPI_Cart_coords(cart_comm, cart_rank, 2, coords);
+    int block = coords[0] * procs_x + coords[1];
+
+    // Share the block of every process with all processes.
+    int *blocks = malloc(size * sizeof(int));
+    MPI_Allgather(&block, 1, MPI_INT, blocks, 1, MPI_INT, comm);
+    for (int i = 0; i < size; i++) block_ranks[blocks[i]] = i;
+
+    free(blocks);
+    MPI_Comm_free(&cart_comm);
+}
+
+/**
+ * Gets the communicator of all compute processes.
+ */
+MPI_Comm get_compute_comm()
+{
+    return comm;
+}
+
+/**
+ * Gets the number of cores.
+ */
+int get_num_cores()
+{
     return size;
 }
 
@@ -113,12 +268,21 @@ int is_master()
 }
 
 /**
- * Very simple wrapper around MPI_Send, which adds debug messages.
+ * Wrapper around MPI_Send (as a non-blocking send which is waited on), which adds debug messages.
+ * The time to post the message (which copies out small messages eagerly) is counted as transfer time,
+ * and the time until the send completes (e.g. until the receiver matches a large message) as wait time.
  */
 int mpi_send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
 {
+    MPI_Request request;
+
     LL_MPI2("Sending %d items to process %d...", count, dest);
-    int error = MPI_Send(buf, count, datatype, dest, tag, comm);
+    long long start = wall_clock_time();
+    int error = MPI_Isend(buf, count, datatype, dest, tag, comm, &request);
+    long long posted = wall_clock_time();
+    mpi_transfer_time += posted - start;
+    if (error == MPI_SUCCESS) error = MPI_Wait(&request, MPI_STATUS_IGNORE);
+    mpi_wait_time += wall_clock_time() - posted;
     LL_MPI2("Sent %d items to process %d!", count, dest);
 
     return error;
@@ -126,12 +290,52 @@ int mpi_send(const void *buf, int count, MPI_Datatype datatype, int dest, int ta
 
 /**
  * Very simple wrapper around MPI_Recv, which adds debug messages.
+ * The message is probed first, so that the time until it arrives is counted as wait time,
+ * and only the time to receive it is counted as transfer time.
  */
 int mpi_recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status)
 {
+    MPI_Status probed;
+
     LL_MPI2("Receiving %d items from process %d...", count, source);
-    int error = MPI_Recv(buf, count, datatype, source, tag, comm, status);
+    mpi_probe(source, tag, comm, &probed);
+    long long start = wall_clock_time();
+    int error = MPI_Recv(buf, count, datatype, probed.MPI_SOURCE, probed.MPI_TAG, comm, status);
+    mpi_transfer_time += wall_clock_time() - start;
     LL_MPI2("Received %d items from process %d!", count, source);
 
     return error;
 }
+
+/**
+ * Wrapper around MPI_Probe, which counts the time until a message arrives as wait time.
+ */
+int mpi_probe(int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    long long start = wall_clock_time();
+    int error = MPI_Probe(source, tag, comm, status);
+    mpi_wait_time += wall_clock_time() - start;
+
+    return error;
+}
+
+/**
+ * Wrapper around MPI_Waitall, which counts the time until all requests complete as wait time.
+ */
+int mpi_waitall(int count, MPI_Request *requests, MPI_Status *statuses)
+{
+    long long start = wall_clock_time();
+    int error = MPI_Waitall(count, requests, statuses);
+    mpi_wait_time += wall_clock_time() - start;
+
+    return error;
+}
+
+/**
+ * Gets the total time spent waiting for other processes, and transferring messages, in nanoseconds.
+ */
+void get_mpi_times(long long *wait_time, long long *transfer_time)
+{
+    *wait_time = mpi_wait_time;
+    *transfer_time = mpi_transfer_time;
+}
@@ -5,16 +5,67 @@
  */
 void multiproc_init(int argc, char **argv);
 
+/**
+ * Splits off the last num_writers processes as dedicated frame writers, which do not compute
+ * any regions. Afterwards, all processes keep their rank in MPI_COMM_WORLD, but get_num_cores()
+ * and get_compute_comm() only refer to the compute processes (i.e. the first processes).
+ *
+ * Returns 1 if the current process is a frame writer.
+ */
+int mpi_split_frame_writers(int num_writers);
+
 /**
  * Initializes and creates a datatype for the Particle struct.
  */
 void mpi_init_particle(MPI_Datatype *newtype);
 
 /**
- * Finalizes MPI.
+ * Initializes and creates a datatype for the Spec struct, excluding its large particles.
+ */
+void mpi_init_spec(MPI_Datatype *newtype);
+
+/**
+ * Splits the processes by node, such that processes on the same node can share memory.
+ *
+ * @param node_comm     Resultant communicator of all processes on the same node.
+ * @param node_ranks    Resultant rank of each process within node_comm, indexed by process ID,
+ *                      or -1 if the process is on a different node.
+ */
+void mpi_init_node_comm(MPI_Comm *node_comm, int *node_ranks);
+
+/**
+ * Creates a communicator between the leaders (i.e. the first process) of each node,
+ * and finds the node of every process.
+ *
+ * @param node_comm     Communicator of all processes on the same node.
+ * @param leader_comm   Resultant communicator of all node leaders, or MPI_COMM_NULL if not a leader.
+ * @param node_ids      Resultant node of each process, indexed by process ID.
+ *                      Each node is numbered by the rank of its leader in leader_comm.
+ * @return              Returns the number of nodes.
+ */
+int mpi_init_leader_comm(MPI_Comm node_comm, MPI_Comm *leader_comm, int *node_ids);
+
+/**
+ * Assigns the blocks of a procs_x x procs_y (periodic) process grid to processes using a
+ * Cartesian topology (MPI_Cart_create), allowing MPI to reorder the processes to match
+ * the physical topology.
+ *
+ * @param procs_x       Number of processes along the x-axis of the process grid.
+ * @param procs_y       Number of processes along the y-axis of the process grid.
+ * @param block_ranks   Resultant process of each block, indexed by block ID (in row-major order).
+ */
+void mpi_get_cart_block_ranks(int procs_x, int procs_y, int *block_ranks);
+
+/**
+ * Writes out any pending log messages, and finalizes MPI.
  */
 void multiproc_finalize();
 
+/**
+ * Gets the communicator of all compute processes (MPI_COMM_WORLD, unless frame writers were split off).
+ */
+MPI_Comm get_compute_comm();
+
 /**
  * Gets the number of cores.
  */
@@ -31,11 +82,31 @@ int get_process_id();
 int is_master();
 
 /**
- * Very simple wrapper around MPI_Send, which adds debug messages.
+ * Wrapper around MPI_Send (as a non-blocking send which is waited on), which adds debug messages.
+ * The time to post the message (which copies out small messages eagerly) is counted as transfer time,
+ * and the time until the send completes (e.g. until the receiver matches a large message) as wait time.
  */
 int mpi_send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm);
 
 /**
  * Very simple wrapper around MPI_Recv, which adds debug messages.
+ * The message is probed first, so that the time until it arrives is counted as wait time,
+ * and only the time to receive it is counted as transfer time.
  */
 int mpi_recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+/**
+ * Wrapper around MPI_Probe, which counts the time until a message arrives as wait time.
+ */
+int mpi_probe(int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+/**
+ * Wrapper around MPI_Waitall, which counts the time until all requests complete as wait time.
+ */
+int mpi_waitall(int count, MPI_Request *requests, MPI_Status *statuses);
+
+/**
+ * Gets the total time spent waiting for other processes, and transferring messages, in nanoseconds,
+ * in the wrappers above.
+ */
+void get_mpi_times(long long *wait_time, long long *transfer_time);
@@ -0,0 +1,182 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "particlefile.h"
+
+/**
+ * Checks that a particle file can be read by this program, and that it holds all of its records.
+ */
+void check_particle_file_header(ParticleFileHeader header, char *particlefile, long long file_size)
+{
+    if (memcmp(header.magic, PARTICLE_FILE_MAGIC, 8) != 0) {
+        LL_ERROR("%s is not a particle file!", particlefile);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header.record_size != PARTICLE_RECORD_SIZE) {
+        LL_ERROR("Particle file %s has records of %d bytes, but expected %d bytes!", particlefile, header.record_size, PARTICLE_RECORD_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    // Particles are numbered by their index in the file, which must fit in their (int) IDs.
+    if (header.num_particles > INT_MAX) {
+        LL_ERROR("Particle file %s has %lld particle(s), but at most %d particle(s) can be numbered!", particlefile, header.num_particles, INT_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header.num_particles < 0 || file_size < (long long)sizeof(ParticleFileHeader) + header.num_particles * PARTICLE_RECORD_SIZE) {
+        LL_ERROR("Particle file %s is truncated (expected %lld particle(s))!", particlefile, header.num_particles);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Converts the records of a particle file into particles, with their coordinates wrapped around the pool.
+ * The IDs of the particles are their indices in the file, starting from the given index,
+ * which fit in an int once the header has been checked.
+ */
+void convert_particle_records(char *particlefile, int n, const ParticleRecord *records, long long first, int canvas_length, Particle *particles)
+{
+    for (int i = 0; i < n; i++) {
+        ParticleRecord r = records[i];
+        if ((r.size != SMALL && r.size != LARGE) || !(r.mass > 0) || !(r.radius > 0) || !isfinite(r.x) || !isfinite(r.y) || !isfinite(r.vx) || !isfinite(r.vy)) {
+            LL_ERROR("Particle %lld in %s is invalid!", first + i, particlefile);
+            exit(EXIT_FAILURE);
+        }
+
+        long double x = fmodl(r.x, canvas_length);
+        long double y = fmodl(r.y, canvas_length);
+        particles[i] = (Particle){
+            .id = first + i,
+            .size = r.size,
+            .mass = r.mass,
+            .radius = r.radius,
+            .x = x < 0 ? x + canvas_length : x,
+            .y = y < 0 ? y + canvas_length : y,
+            .vx = r.vx,
+            .vy = r.vy,
+        };
+    }
+}
+
+/**
+ * Returns 1 if all processes of a communicator are on the same node, and can share a mapping of a file.
+ */
+int is_single_node(MPI_Comm comm)
+{
+    int size, node_size;
+    MPI_Comm node_comm;
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+
+    return node_size == size;
+}
+
+/**
+ * Reads an equal share of the particles in a particle file, by mapping the file into memory.
+ */
+Particle *map_particle_file(MPI_Comm comm, char *particlefile, int canvas_length, int *count)
+{
+    int rank, num_procs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_procs);
+
+    struct stat st;
+    int fd = open(particlefile, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ParticleFileHeader)) {
+        LL_ERROR("Could not open particle file %s!", particlefile);
+        exit(EXIT_FAILURE);
+    }
+
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LL_ERROR("Could not map particle file %s!", particlefile);
+        exit(EXIT_FAILURE);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    ParticleFileHeader header;
+    memcpy(&header, data, sizeof(ParticleFileHeader));
+    check_particle_file_header(header, particlefile, st.st_size);
+
+    // Convert my share of the records straight from the page cache, which is shared by all processes of the node.
+    long long start = header.num_particles * rank / num_procs;
+    long long end = header.num_particles * (rank + 1) / num_procs;
+    *count = end - start;
+
+    const ParticleRecord *records = (const ParticleRecord *)(data + sizeof(ParticleFileHeader)) + start;
+
+    Particle *particles = malloc(*count * sizeof(Particle));
+    convert_particle_records(particlefile, *count, records, start, canvas_length, particles);
+    munmap(data, st.st_size);
+
+    return particles;
+}
+
+/**
+ * Reads an equal share of the particles in a particle file collectively with MPI-IO.
+ */
+Particle *read_particle_file_mpiio(MPI_Comm comm, char *particlefile, int canvas_length, int *count)
+{
+    int rank, num_procs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_procs);
+
+    MPI_File fh;
+    int error = MPI_File_open(comm, particlefile, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    if (error != MPI_SUCCESS) {
+        LL_ERROR("Could not open particle file %s!", particlefile);
+        exit(EXIT_FAILURE);
+    }
+
+    MPI_Offset file_size;
+    ParticleFileHeader header;
+    MPI_File_get_size(fh, &file_size);
+    MPI_File_read_at_all(fh, 0, &header, sizeof(ParticleFileHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    check_particle_file_header(header, particlefile, file_size);
+
+    long long start = header.num_particles * rank / num_procs;
+    long long end = header.num_particles * (rank + 1) / num_procs;
+    *count = end - start;
+
+    // Read my share of the records, which are contiguous.
+    ParticleRecord *records = malloc(*count * sizeof(ParticleRecord));
+    MPI_Datatype record_type;
+    MPI_Type_contiguous(PARTICLE_RECORD_SIZE, MPI_BYTE, &record_type);
+    MPI_Type_commit(&record_type);
+    MPI_File_read_at_all(fh, sizeof(ParticleFileHeader) + start * PARTICLE_RECORD_SIZE, records, *count, record_type, MPI_STATUS_IGNORE);
+    MPI_Type_free(&record_type);
+    MPI_File_close(&fh);
+
+    Particle *particles = malloc(*count * sizeof(Particle));
+    convert_particle_records(particlefile, *count, records, start, canvas_length, particles);
+    free(records);
+
+    return particles;
+}
+
+/**
+ * Reads an equal share of the particles in a particle file collectively with all processes of a communicator.
+ */
+Particle *read_particle_file(MPI_Comm comm, char *particlefile, int canvas_length, int *count)
+{
+    int single_node = is_single_node(comm);
+    Particle *particles = single_node
+        ? map_particle_file(comm, particlefile, canvas_length, count)
+        : read_particle_file_mpiio(comm, particlefile, canvas_length, count);
+
+    LL_VERBOSE("Read %d particle(s) from %s (%s).", *count, particlefile, single_node ? "mapped" : "MPI-IO");
+    return particles;
+}
@@ -0,0 +1,69 @@
+#include <mpi.h>
+
+#include "types.h"
+
+/**
+ * A particle file holds the initial conditions of a simulation, which replace the particles generated from
+ * the specification file. It is meant to be written by other tools (e.g. from a snapshot of another code),
+ * so its records are fixed-size and independent of the Particle struct. All numbers are in native byte order.
+ *
+ * The file starts with a ParticleFileHeader, followed by num_particles records of PARTICLE_RECORD_SIZE bytes:
+ *   float64    x-coordinate and y-coordinate, absolute within the pool (wrapped around its edges)
+ *   float64    x-velocity and y-velocity
+ *   float64    mass
+ *   float64    radius
+ *   int32      size (0 for small, 1 for large)
+ *   int32      reserved (0)
+ *
+ * The particles may be in any order, since each process reads an equal share of the file and bins the particles
+ * into their regions, which are handed over to the processes in charge of them.
+ */
+
+#define PARTICLE_FILE_MAGIC "POOLPAR1"
+
+/**
+ * Header of a particle file.
+ */
+typedef struct particle_file_header_t {
+    // PARTICLE_FILE_MAGIC (not null-terminated).
+    char magic[8];
+
+    // Size of each record, which is PARTICLE_RECORD_SIZE.
+    int record_size;
+
+    // Reserved (0).
+    int reserved;
+
+    // Number of particles in the file, which can be at most INT_MAX (as they are numbered by their index).
+    long long num_particles;
+} ParticleFileHeader;
+
+/**
+ * Record of a single particle in a particle file.
+ */
+typedef struct particle_record_t {
+    double x;
+    double y;
+    double vx;
+    double vy;
+    double mass;
+    double radius;
+    int size;
+    int reserved;
+} ParticleRecord;
+
+#define PARTICLE_RECORD_SIZE 56
+
+/**
+ * Reads an equal share of the particles in a particle file collectively with all processes of a communicator.
+ *
+ * If all processes are on the same node, each process maps the file into memory, so that the particles are
+ * read straight from the page cache without any copies. Otherwise, they are read collectively with MPI-IO.
+ *
+ * @param comm              The communicator of all processes which read particles.
+ * @param particlefile      The path of the particle file.
+ * @param canvas_length     The length of the pool, which the coordinates are wrapped around.
+ * @param count             Resultant number of particles read by this process.
+ * @return                  Returns a new array of particles, with absolute coordinates and IDs in the order of the file.
+ */
+Particle *read_particle_file(MPI_Comm comm, char *particlefile, int canvas_length, int *count);
@@ -1,13 +1,14 @@
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "common.h"
 #include "log.h"
 #include "multiproc.h"
 #include "particles.h"
+#include "random.h"
 
 /**
  * Allocates space for a 2-D array of arrays of particles, indexed by region.
@@ -31,59 +32,193 @@ void deallocate_particles(Particle **particles, int n_regions)
 }
 
 /**
- * Generates small particles in random starting locations,
- * within the specified boundaries.
+ * Packs the particles of multiple regions into a single contiguous buffer.
+ * If there is only a single region, its array is returned directly instead of being copied,
+ * and should not be freed.
  */
-Particle *generate_small_particles(int region_id, Spec spec, int n, int grid_size, long double start_x, long double start_y)
+Particle *pack_regions(int n, int *regions, int *sizes, Particle **particles, int *count)
 {
-    // Initialize PRNG.
-    time_t t;
-    srand((unsigned)time(&t));
+    if (n == 1) {
+        *count = sizes[regions[0]];
+        return particles[regions[0]];
+    }
 
-    // Allocate space for n particles.
-    Particle *particles = malloc(sizeof(Particle) * n);
+    *count = 0;
+    for (int i = 0; i < n; i++) *count += sizes[regions[i]];
+
+    Particle *buf = malloc(*count * sizeof(Particle));
+    for (int i = 0, offset = 0; i < n; offset += sizes[regions[i]], i++)
+        memcpy(&buf[offset], particles[regions[i]], sizes[regions[i]] * sizeof(Particle));
+
+    return buf;
+}
+
+/**
+ * Copies particles from a packed buffer into the arrays of their own regions,
+ * starting from (and incrementing) the given offsets of each region.
+ */
+void unpack_regions(int count, Particle *buf, Particle **particles, int *offsets)
+{
+    for (int i = 0; i < count; i++) {
+        int region = buf[i].region;
+        particles[region][offsets[region]++] = buf[i];
+    }
+}
+
+/**
+ * Appends particles from a packed buffer to the arrays of their own regions,
+ * growing each array as needed.
+ */
+void append_regions(int count, Particle *buf, int num_regions, Particle **particles, int *sizes)
+{
+    int *counts = calloc(num_regions, sizeof(int));
+    for (int i = 0; i < count; i++) counts[buf[i].region]++;
+
+    for (int region = 0; region < num_regions; region++)
+        if (counts[region] > 0) particles[region] = realloc(particles[region], (sizes[region] + counts[region]) * sizeof(Particle));
+
+    for (int i = 0; i < count; i++) {
+        int region = buf[i].region;
+        particles[region][sizes[region]++] = buf[i];
+    }
+
+    free(counts);
+}
+
+/**
+ * Computes the initial position of a small particle within a pool of the given length, where the particle is
+ * the index-th particle of the region of the spec starting from (start_x, start_y), of length region_length.
+ * The position only depends on the seed, the region and the index of the particle within its region, so that
+ * the same particles are generated regardless of the thread or process that generates them.
+ */
+void get_small_particle_position(Spec spec, int region, int index, long double length, int region_length, long double start_x, long double start_y, long double *x, long double *y)
+{
+    long double radius = spec.DistributionRadius > 0 ? spec.DistributionRadius : length / 8;
+    long double centre_x = length / 2;
+    long double centre_y = length / 2;
+    long double r = 0;
+
+    // Count the particles of each region separately, in the upper and lower halves of the counter.
+    double u[4];
+    random_uniforms(spec.Seed, RANDOM_STREAM_PARTICLES, (long long)region << 32 | index, 0, u);
+
+    switch (spec.Distribution) {
+    case DISTRIBUTION_UNIFORM:
+        // Uniformly within the region.
+        *x = start_x + u[0] * region_length;
+        *y = start_y + u[1] * region_length;
+        return;
+    case DISTRIBUTION_PLUMMER:
+        // Invert the cumulative mass of a Plummer sphere, M(r) = r^3 / (r^2 + a^2)^(3/2),
+        // and project a random direction onto the pool.
+        r = radius / sqrtl(powl(u[0], -2.0L / 3) - 1);
+        r *= sqrtl(1 - (2 * u[2] - 1) * (2 * u[2] - 1));
+        break;
+    case DISTRIBUTION_DISK:
+        // The radius of an exponential disk (with surface density exp(-r / a)) is the sum of two exponentials.
+        r = -radius * logl(u[0] * u[2]);
+        break;
+    case DISTRIBUTION_CLUSTERED: {
+        // Pick a cluster, whose centre is random within the pool, and offset from it with a Gaussian (Box-Muller).
+        int cluster = u[0] * spec.NumberOfClusters;
+        if (cluster >= spec.NumberOfClusters) cluster = spec.NumberOfClusters - 1;
+        double c[4];
+        random_uniforms(spec.Seed, RANDOM_STREAM_CLUSTERS, cluster, 0, c);
+        centre_x = c[0] * length;
+        centre_y = c[1] * length;
+        r = radius * sqrtl(-2 * logl(u[2]));
+        break;
+    }
+    }
+
+    // The position is wrapped around the pool once the particles are binned into their regions.
+    long double angle = 2 * M_PI * u[1];
+    *x = centre_x + r * cosl(angle);
+    *y = centre_y + r * sinl(angle);
+}
+
+/**
+ * Arguments for each thread generating a range of particles.
+ */
+typedef struct generate_args_t {
+    Spec spec;
+    int pool_length;
+    int region_length;
+    int i0;
+    int i1;
+    Particle *particles;
+} GenerateArgs;
+
+void *generate_particles_thread(void *arg)
+{
+    GenerateArgs *args = arg;
+    Spec spec = args->spec;
+    long double length = (long double)args->pool_length * args->region_length;
 
-    // Generate small particles at random starting locations.
-    for (int i = 0; i < n; i++) {
-        particles[i] = (Particle){
-            .id = region_id * spec.TotalNumberOfParticles + spec.NumberOfLargeParticles + i,
-            .region = region_id,
+    for (int id = args->i0; id < args->i1; id++) {
+        // Find the region of the spec that the particle is generated for, and its index within the region.
+        int region = id / spec.TotalNumberOfParticles;
+        int index = id % spec.TotalNumberOfParticles;
+        long double start_x = (long double)(region % args->pool_length) * args->region_length;
+        long double start_y = (long double)(region / args->pool_length) * args->region_length;
+        Particle *p = &args->particles[id - args->i0];
+
+        // Copy large particles from spec, which are numbered before the small particles of the region.
+        if (index < spec.NumberOfLargeParticles) {
+            *p = spec.LargeParticles[index];
+            p->id = id;
+            p->region = region;
+            p->x += start_x;
+            p->y += start_y;
+            continue;
+        }
+
+        *p = (Particle){
+            .id = id,
+            .region = region,
             .size = SMALL,
             .mass = spec.SmallParticleMass,
             .radius = spec.SmallParticleRadius,
-            .x = start_x + rand() % grid_size,
-            .y = start_y + rand() % grid_size,
             .vx = 0.0L,
             .vy = 0.0L,
         };
+        get_small_particle_position(spec, region, index, length, args->region_length, start_x, start_y, &p->x, &p->y);
     }
 
-    return particles;
+    return NULL;
 }
 
 /**
- * Generate both small and large particles for a single region, according to the given spec.
- * The positions of the small particles will be randomized anywhere within the region.
+ * Generate the particles with IDs [first, first + n) of a pool of pool_length x pool_length regions.
  */
-Particle *generate_particles(int region_id, Spec spec)
+Particle *generate_pool_particles(Spec spec, int pool_length, int region_length, int first, int n, int num_threads)
 {
-    // The small particles should be generated for a single region, not all regions.
-    int grid_size = spec.GridSize;
-
-    // Allocate space for all particles.
-    Particle *particles = malloc(sizeof(Particle) * spec.TotalNumberOfParticles);
+    // Allocate space for n particles.
+    Particle *particles = malloc(sizeof(Particle) * n);
 
-    // Copy large particles from spec.
-    size_t large_particles_len = spec.NumberOfLargeParticles * sizeof(Particle);
-    memcpy(particles, spec.LargeParticles, large_particles_len);
+    // Generate an equal range of particles on each thread.
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > n) num_threads = n > 0 ? n : 1;
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    GenerateArgs *args = malloc(num_threads * sizeof(GenerateArgs));
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (GenerateArgs){
+            .spec = spec,
+            .pool_length = pool_length,
+            .region_length = region_length,
+            .i0 = first + (long long)n * i / num_threads,
+            .i1 = first + (long long)n * (i + 1) / num_threads,
+            .particles = &particles[(long long)n * i / num_threads],
+        };
+        pthread_create(&threads[i], NULL, generate_particles_thread, &args[i]);
+    }
+    for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
 
-    // Generate small particles and allocate to the buffer.
-    Particle *small_particles = generate_small_particles(region_id, spec, spec.NumberOfSmallParticles, grid_size, 0, 0);
-    size_t small_particles_len = spec.NumberOfSmallParticles * sizeof(Particle);
-    memcpy(&particles[spec.NumberOfLargeParticles], small_particles, small_particles_len);
+    free(threads);
+    free(args);
 
     // Debug print all particles.
-    print_particles(LOG_LEVEL_DEBUG, "Generated particles", spec.TotalNumberOfParticles, particles);
+    print_particles(LOG_LEVEL_DEBUG, "Generated particles", n, particles);
 
     return particles;
 }
@@ -12,10 +12,36 @@ Particle **allocate_particles(int *sizes, int n_regions);
 void deallocate_particles(Particle **particles, int n_regions);
 
 /**
- * Generate both small and large particles for a single region, according to the given spec.
- * The positions of the small particles will be randomized anywhere within the region.
+ * Packs the particles of multiple regions into a single contiguous buffer.
+ * If there is only a single region, its array is returned directly instead of being copied,
+ * and should not be freed.
  */
-Particle *generate_particles(int region_id, Spec spec);
+Particle *pack_regions(int n, int *regions, int *sizes, Particle **particles, int *count);
+
+/**
+ * Copies particles from a packed buffer into the arrays of their own regions,
+ * starting from (and incrementing) the given offsets of each region.
+ */
+void unpack_regions(int count, Particle *buf, Particle **particles, int *offsets);
+
+/**
+ * Appends particles from a packed buffer to the arrays of their own regions (out of num_regions),
+ * growing each array as needed.
+ */
+void append_regions(int count, Particle *buf, int num_regions, Particle **particles, int *sizes);
+
+/**
+ * Generate the particles with IDs [first, first + n) of a pool of pool_length x pool_length regions of
+ * region_length x region_length each, on multiple threads. Each region has the large particles of the spec
+ * (whose positions are relative to the region), followed by its small particles, which are numbered
+ * consecutively from the first region (i.e. the ID of a particle is its index in the whole pool).
+ *
+ * The positions of the small particles follow the distribution of the spec, within the coordinates of the pool
+ * (although they have yet to be wrapped around its edges). They only depend on the seed, the region and the
+ * index of each particle within its region, so that the same particles are generated regardless of the number
+ * of threads or processes, and of the decomposition of the pool.
+ */
+Particle *generate_pool_particles(Spec spec, int pool_length, int region_length, int first, int n, int num_threads);
 
 /**
  * Debug prints details about a particle.
@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "heatmap.h"
+#include "log.h"
+#include "pyramid.h"
+
+/**
+ * Returns the number of pixels along each side of a level of the pyramid.
+ */
+int get_pyramid_length(int length, int level)
+{
+    return (length + (1 << level) - 1) >> level;
+}
+
+/**
+ * Returns the number of levels of the pyramid for a canvas of length x length pixels.
+ */
+int get_pyramid_levels(int length)
+{
+    int levels = 1;
+    while (get_pyramid_length(length, levels - 1) > PYRAMID_TILE_SIZE) levels++;
+
+    return levels;
+}
+
+/**
+ * Returns the number of tiles along each side of a level of the pyramid.
+ */
+int get_pyramid_tiles(int length, int level)
+{
+    return (get_pyramid_length(length, level) + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+}
+
+/**
+ * Allocates an empty tile of a level of the pyramid, whose coordinates are pixels of that level.
+ */
+Canvas allocate_pyramid_tile(int length, int level, int tx, int ty)
+{
+    int level_length = get_pyramid_length(length, level);
+    int x = tx * PYRAMID_TILE_SIZE;
+    int y = ty * PYRAMID_TILE_SIZE;
+    int width = level_length - x < PYRAMID_TILE_SIZE ? level_length - x : PYRAMID_TILE_SIZE;
+    int height = level_length - y < PYRAMID_TILE_SIZE ? level_length - y : PYRAMID_TILE_SIZE;
+
+    return allocate_canvas(x, y, width, height);
+}
+
+/**
+ * Downsamples a canvas by 2x in each direction, taking the max of each 2x2 pixels.
+ */
+Canvas downsample_canvas(Canvas canvas)
+{
+    Canvas downsampled = allocate_canvas(canvas.x / 2, canvas.y / 2, (canvas.width + 1) / 2, (canvas.height + 1) / 2);
+
+    for (int y = 0; y < canvas.height; y++) {
+        int *row = &downsampled.cells[(y / 2) * downsampled.width];
+        for (int x = 0; x < canvas.width; x++) {
+            int cell = canvas.cells[y * canvas.width + x];
+            if (cell > row[x / 2]) row[x / 2] = cell;
+        }
+    }
+
+    return downsampled;
+}
+
+/**
+ * Creates a directory, unless it already exists.
+ */
+void create_directory(char *path)
+{
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        LL_ERROR("Could not create directory %s!", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Creates the directories for each level of the pyramid, and writes the layout of the pyramid.
+ */
+void create_pyramid(char *outputdir, int length)
+{
+    int levels = get_pyramid_levels(length);
+    char *path = malloc(strlen(outputdir) + 20);
+
+    create_directory(outputdir);
+    for (int level = 0; level < levels; level++) {
+        sprintf(path, "%s/%d", outputdir, level);
+        create_directory(path);
+    }
+
+    // Write the layout of the pyramid, in the same format as the spec file.
+    sprintf(path, "%s/pyramid.txt", outputdir);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        LL_ERROR("Could not open %s for writing!", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "Width: %d\nHeight: %d\nTileSize: %d\nLevels: %d\n", length, length, PYRAMID_TILE_SIZE, levels);
+    fclose(fp);
+
+    free(path);
+}
+
+/**
+ * Writes a tile of a level of the pyramid.
+ */
+void write_pyramid_tile(char *outputdir, int level, int tx, int ty, Canvas tile)
+{
+    char *path = malloc(strlen(outputdir) + 40);
+    sprintf(path, "%s/%d/%d_%d.ppm", outputdir, level, tx, ty);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        LL_ERROR("Could not open %s for writing!", path);
+        exit(EXIT_FAILURE);
+    }
+
+    char header[64];
+    int header_length = format_binary_header(header, tile.width, tile.height);
+    unsigned char *pixels = malloc(3 * tile.width * tile.height);
+    encode_pixels(tile, 0, tile.height, pixels);
+    fwrite(header, 1, header_length, fp);
+    fwrite(pixels, 3, tile.width * tile.height, fp);
+
+    LL_DEBUG("Written tile to %s.", path);
+
+    fclose(fp);
+    free(pixels);
+    free(path);
+}
+
+/**
+ * Generates a pyramid from a canvas of the entire pool.
+ */
+void generate_pyramid(Canvas canvas, char *outputdir)
+{
+    int length = canvas.width;
+    int levels = get_pyramid_levels(length);
+    create_pyramid(outputdir, length);
+
+    // Cut each level into tiles, and downsample it for the next level.
+    Canvas level_canvas = canvas;
+    for (int level = 0; level < levels; level++) {
+        int tiles = get_pyramid_tiles(length, level);
+        for (int ty = 0; ty < tiles; ty++) {
+            for (int tx = 0; tx < tiles; tx++) {
+                Canvas tile = allocate_pyramid_tile(length, level, tx, ty);
+                merge_canvas(tile, level_canvas);
+                write_pyramid_tile(outputdir, level, tx, ty, tile);
+                free_canvas(tile);
+            }
+        }
+
+        if (level + 1 < levels) {
+            Canvas downsampled = downsample_canvas(level_canvas);
+            if (level > 0) free_canvas(level_canvas);
+            level_canvas = downsampled;
+        }
+    }
+    if (levels > 1) free_canvas(level_canvas);
+
+    LL_SUCCESS("Successfully written %d level(s) of tiles to %s.", levels, outputdir);
+}
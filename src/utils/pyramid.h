@@ -0,0 +1,49 @@
+#include "types.h"
+
+/**
+ * A tiled zoom pyramid stores the heatmap as binary (P6) PPM tiles of up to PYRAMID_TILE_SIZE x
+ * PYRAMID_TILE_SIZE pixels, at successive levels of 2x downsampling. Level 0 is the full resolution,
+ * and the last level fits in a single tile. The tile at column x and row y of a level is written to
+ * <outputdir>/<level>/<x>_<y>.ppm, and the layout of the pyramid is written to <outputdir>/pyramid.txt.
+ *
+ * Each pixel of a downsampled level is the max of 2x2 pixels of the level below,
+ * so that particles remain visible (and large particles remain blue) when zoomed out.
+ */
+
+#define PYRAMID_TILE_SIZE 256
+
+/**
+ * Returns the number of levels of the pyramid for a canvas of length x length pixels.
+ */
+int get_pyramid_levels(int length);
+
+/**
+ * Returns the number of tiles along each side of a level of the pyramid.
+ */
+int get_pyramid_tiles(int length, int level);
+
+/**
+ * Allocates an empty tile of a level of the pyramid, whose coordinates are pixels of that level.
+ */
+Canvas allocate_pyramid_tile(int length, int level, int tx, int ty);
+
+/**
+ * Downsamples a canvas by 2x in each direction, taking the max of each 2x2 pixels.
+ * The coordinates of the canvas must be even.
+ */
+Canvas downsample_canvas(Canvas canvas);
+
+/**
+ * Creates the directories for each level of the pyramid, and writes the layout of the pyramid.
+ */
+void create_pyramid(char *outputdir, int length);
+
+/**
+ * Writes a tile of a level of the pyramid.
+ */
+void write_pyramid_tile(char *outputdir, int level, int tx, int ty, Canvas tile);
+
+/**
+ * Generates a pyramid from a canvas of the entire pool.
+ */
+void generate_pyramid(Canvas canvas, char *outputdir);
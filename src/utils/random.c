@@ -0,0 +1,57 @@
+#include <stdint.h>
+
+#include "random.h"
+
+#define PHILOX_M0 0xD2511F53
+#define PHILOX_M1 0xCD9E8D57
+#define PHILOX_W0 0x9E3779B9
+#define PHILOX_W1 0xBB67AE85
+#define PHILOX_ROUNDS 10
+
+/**
+ * Computes 4 random 32-bit integers for a counter and key, with 10 rounds of Philox.
+ */
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+        // Mix the high and low halves of each product with the other words and the key.
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n1 = (uint32_t)p1;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        uint32_t n3 = (uint32_t)p0;
+        c0 = n0;
+        c1 = n1;
+        c2 = n2;
+        c3 = n3;
+
+        // Bump the key for the next round.
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/**
+ * Computes 4 uniform random numbers within (0, 1), for the given seed, stream, index and draw.
+ */
+void random_uniforms(long long seed, int stream, long long index, int draw, double u[4])
+{
+    uint32_t counter[4] = { (uint32_t)index, (uint32_t)((uint64_t)index >> 32), (uint32_t)draw, (uint32_t)stream };
+    uint32_t key[2] = { (uint32_t)seed, (uint32_t)((uint64_t)seed >> 32) };
+    uint32_t out[4];
+
+    philox4x32(counter, key, out);
+
+    // Take the centre of each of the 2^32 intervals, so that 0 and 1 are never returned.
+    for (int i = 0; i < 4; i++) u[i] = (out[i] + 0.5) / 4294967296.0;
+}
@@ -0,0 +1,30 @@
+#include <stdint.h>
+
+/**
+ * Counter-based random number generation (Philox4x32-10, as described by Salmon et al., "Parallel Random
+ * Numbers: As Easy as 1, 2, 3"). Each random number is a pure function of a key (the seed) and a counter
+ * (e.g. the ID of a particle), so that the same numbers are generated regardless of the order, process
+ * or thread that they are generated on, without any state to share or seed.
+ */
+
+/**
+ * Streams of random numbers, which are independent of each other for the same seed.
+ */
+#define RANDOM_STREAM_PARTICLES 0
+#define RANDOM_STREAM_CLUSTERS 1
+
+/**
+ * Computes 4 random 32-bit integers for a counter and key, with 10 rounds of Philox.
+ */
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+/**
+ * Computes 4 uniform random numbers within (0, 1), for the given seed, stream, index and draw.
+ *
+ * @param seed      The seed, which is the key of the generator.
+ * @param stream    The stream of random numbers (e.g. to separate the numbers for different purposes).
+ * @param index     The index within the stream (e.g. the ID of a particle).
+ * @param draw      The number of sets of 4 numbers which were previously drawn for the same index.
+ * @param u         Resultant uniform random numbers.
+ */
+void random_uniforms(long long seed, int stream, long long index, int draw, double u[4]);
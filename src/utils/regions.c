@@ -90,6 +90,9 @@ int norm_region_int(int coord, Spec spec)
  */
 long double wrap_around(long double coord, int max_coord)
 {
+    // Leave corrupted coordinates for the health monitor, rather than wrapping them forever.
+    if (!isfinite(coord)) return coord;
+
     while (coord < 0 || coord >= max_coord) {
         if (coord < 0)
             coord += max_coord;
@@ -121,11 +124,40 @@ int get_horizon_dist(int pool_length, int r1, int r2)
         if ((tl < r2 && r2 < tr) || (bl < r2 && r2 < br)) return i;
 
         // Check left/right edges.
-        for (int j = tl; j <= bl; j += pool_length)
-            if (j == r2) return i;
-        for (int j = tr; j <= br; j += pool_length)
-            if (j == r2) return i;
+        if (tl <= r2 && r2 <= bl && (r2 - tl) % pool_length == 0) return i;
+        if (tr <= r2 && r2 <= br && (r2 - tr) % pool_length == 0) return i;
     }
 
     return -1;
 }
+
+/**
+ * Returns the distance between two region IDs, measured as the max number of regions
+ * apart along either axis, wrapping around the edges of the pool.
+ */
+int get_wrapped_region_dist(int r1, int r2, Spec spec)
+{
+    int dx = abs(get_region_x(r1, spec) - get_region_x(r2, spec));
+    int dy = abs(get_region_y(r1, spec) - get_region_y(r2, spec));
+
+    // Particles can wrap around the edges of the pool.
+    if (spec.PoolLength - dx < dx) dx = spec.PoolLength - dx;
+    if (spec.PoolLength - dy < dy) dy = spec.PoolLength - dy;
+
+    return dx > dy ? dx : dy;
+}
+
+/**
+ * Factors the number of processes into a grid of procs_x x procs_y processes,
+ * where procs_x >= procs_y and the grid is as close to square as possible.
+ */
+void get_process_grid(int num_procs, int *procs_x, int *procs_y)
+{
+    // Find the largest factor that does not exceed the square root.
+    int factor = 1;
+    for (int i = 1; i * i <= num_procs; i++)
+        if (num_procs % i == 0) factor = i;
+
+    *procs_x = num_procs / factor;
+    *procs_y = factor;
+}
@@ -50,3 +50,15 @@ long double wrap_around(long double coord, int max_coord);
  * relative to the number of regions (provided by pool_length).
  */
 int get_horizon_dist(int pool_length, int r1, int r2);
+
+/**
+ * Returns the distance between two region IDs, measured as the max number of regions
+ * apart along either axis, wrapping around the edges of the pool.
+ */
+int get_wrapped_region_dist(int r1, int r2, Spec spec);
+
+/**
+ * Factors the number of processes into a grid of procs_x x procs_y processes,
+ * where procs_x >= procs_y and the grid is as close to square as possible.
+ */
+void get_process_grid(int num_procs, int *procs_x, int *procs_y);
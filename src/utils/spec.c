@@ -1,6 +1,10 @@
-#include <math.h>
+#include <ctype.h>
+#include <mpi.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include "log.h"
 #include "multiproc.h"
@@ -8,84 +12,267 @@
 #include "spec.h"
 #include "types.h"
 
+#define MASTER_ID 0
+
+/**
+ * Type of the value of a field of the specification file.
+ */
+typedef enum spec_field_type_t {
+    SPEC_INT,
+    SPEC_LONG_LONG,
+    SPEC_LONG_DOUBLE,
+    SPEC_DISTRIBUTION,
+} SpecFieldType;
+
+/**
+ * Field of the specification file, which is stored at an offset within the Spec struct.
+ */
+typedef struct spec_field_t {
+    const char *key;
+    SpecFieldType type;
+    size_t offset;
+    int required;
+} SpecField;
+
+static const SpecField spec_fields[] = {
+    { "TimeSlots", SPEC_INT, offsetof(Spec, TimeSlots), 1 },
+    { "TimeStep", SPEC_LONG_DOUBLE, offsetof(Spec, TimeStep), 1 },
+    { "Horizon", SPEC_INT, offsetof(Spec, Horizon), 1 },
+    { "GridSize", SPEC_INT, offsetof(Spec, GridSize), 1 },
+    { "NumberOfSmallParticles", SPEC_INT, offsetof(Spec, NumberOfSmallParticles), 1 },
+    { "SmallParticleMass", SPEC_LONG_DOUBLE, offsetof(Spec, SmallParticleMass), 1 },
+    { "SmallParticleRadius", SPEC_LONG_DOUBLE, offsetof(Spec, SmallParticleRadius), 1 },
+    { "NumberOfLargeParticles", SPEC_INT, offsetof(Spec, NumberOfLargeParticles), 1 },
+    { "PoolLength", SPEC_INT, offsetof(Spec, PoolLength), 0 },
+    { "Seed", SPEC_LONG_LONG, offsetof(Spec, Seed), 0 },
+    { "Distribution", SPEC_DISTRIBUTION, offsetof(Spec, Distribution), 0 },
+    { "DistributionRadius", SPEC_LONG_DOUBLE, offsetof(Spec, DistributionRadius), 0 },
+    { "NumberOfClusters", SPEC_INT, offsetof(Spec, NumberOfClusters), 0 },
+};
+
+static const char *distribution_names[] = { "uniform", "plummer", "disk", "clustered" };
+
+#define SPEC_FIELD_COUNT (int)(sizeof(spec_fields) / sizeof(SpecField))
+#define SPEC_LINE_LENGTH 1024
+#define DISTRIBUTION_COUNT (int)(sizeof(distribution_names) / sizeof(char *))
+
+/**
+ * Trims leading and trailing whitespace from a string in-place.
+ */
+char *trim(char *str)
+{
+    while (isspace((unsigned char)*str)) str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return str;
+}
+
+/**
+ * Parses a "Key: value" line of the specification file into the spec.
+ * Keys are case-insensitive. Returns the index of the field, -1 if the key is unknown,
+ * or -2 if the value is invalid.
+ */
+int parse_spec_field(Spec *spec, char *key, char *value, char *specfile, int line_number)
+{
+    for (int i = 0; i < SPEC_FIELD_COUNT; i++) {
+        if (strcasecmp(key, spec_fields[i].key) != 0) continue;
+
+        char *end = value;
+        char *field = (char *)spec + spec_fields[i].offset;
+        switch (spec_fields[i].type) {
+        case SPEC_INT:
+            *(int *)field = strtol(value, &end, 10);
+            break;
+        case SPEC_LONG_LONG:
+            *(long long *)field = strtoll(value, &end, 10);
+            break;
+        case SPEC_LONG_DOUBLE:
+            *(long double *)field = strtold(value, &end);
+            break;
+        case SPEC_DISTRIBUTION:
+            for (int d = 0; d < DISTRIBUTION_COUNT; d++) {
+                if (strcasecmp(value, distribution_names[d]) == 0) {
+                    *(ParticleDistribution *)field = d;
+                    end = value + strlen(value);
+                }
+            }
+            break;
+        }
+
+        if (end == value || *end != '\0') {
+            LL_ERROR("%s:%d: Invalid value for %s: \"%s\"", specfile, line_number, spec_fields[i].key, value);
+            return -2;
+        }
+
+        return i;
+    }
+
+    return -1;
+}
+
 /**
- * Reads the specification file.
+ * Reads and parses the specification file on the current process into the given spec.
+ * Returns 1 if the specification file is valid, or 0 (after logging the error) otherwise.
  */
-Spec read_spec_file(int region_id, char *specfile)
+int load_spec_file(char *specfile, Spec *result)
 {
     // Open the specification file.
     FILE *fp = fopen(specfile, "r");
     if (fp == NULL) {
         LL_ERROR("%s not found!", specfile);
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
-    // Create SPEC struct.
+    // Create SPEC struct, with the default values of optional fields.
+    // The default PoolLength depends on the number of processes, so it is only filled in by the decomposition.
     Spec spec = {
-        .PoolLength = get_pool_length(),
+        .Distribution = DISTRIBUTION_UNIFORM,
+        .NumberOfClusters = 8,
     };
 
-    // Read specification lines.
-    // Assumes that values are in fixed format.
-    fscanf(fp,
-        "TimeSlots: %d\n"
-        "TimeStep: %Lf\n"
-        "Horizon: %d\n"
-        "GridSize: %d\n"
-        "NumberOfSmallParticles: %d\n"
-        "SmallParticleMass: %Lf\n"
-        "SmallParticleRadius: %Lf\n"
-        "NumberOfLargeParticles: %d\n",
-        &spec.TimeSlots,
-        &spec.TimeStep,
-        &spec.Horizon,
-        &spec.GridSize,
-        &spec.NumberOfSmallParticles,
-        &spec.SmallParticleMass,
-        &spec.SmallParticleRadius,
-        &spec.NumberOfLargeParticles);
+    char buf[SPEC_LINE_LENGTH];
+    int found[SPEC_FIELD_COUNT] = { 0 };
+    int capacity = 0;
+    int num_large_particles = 0;
 
-    // Calculate total number of particles.
-    spec.TotalNumberOfParticles = spec.NumberOfSmallParticles + spec.NumberOfLargeParticles;
+    for (int line_number = 1; fgets(buf, SPEC_LINE_LENGTH, fp) != NULL; line_number++) {
+        // Strip comments and whitespace.
+        char *comment = strchr(buf, '#');
+        if (comment != NULL) *comment = '\0';
+        char *line = trim(buf);
+        if (line[0] == '\0') continue;
+
+        // Parse a "Key: value" pair.
+        char *separator = strchr(line, ':');
+        if (separator != NULL) {
+            *separator = '\0';
+            char *key = trim(line);
+            int field = parse_spec_field(&spec, key, trim(separator + 1), specfile, line_number);
+            if (field == -2) {
+                fclose(fp);
+                return 0;
+            } else if (field >= 0)
+                found[field] = 1;
+            else
+                LL_NOTICE("%s:%d: Ignoring unknown key %s.", specfile, line_number, key);
+            continue;
+        }
+
+        // Otherwise, parse the values of a large particle.
+        if (num_large_particles == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 16;
+            spec.LargeParticles = realloc(spec.LargeParticles, capacity * sizeof(Particle));
+        }
+
+        Particle *p = &spec.LargeParticles[num_large_particles++];
+        char end;
+        if (sscanf(line, "%Lf %Lf %Lf %Lf %c", &p->radius, &p->mass, &p->x, &p->y, &end) != 4) {
+            LL_ERROR("%s:%d: Invalid large particle: \"%s\"", specfile, line_number, line);
+            fclose(fp);
+            return 0;
+        }
+
+        // The ID and region of each large particle are assigned when the particles of a region are generated.
+        p->size = LARGE;
+        p->vx = 0.0L;
+        p->vy = 0.0L;
+    }
+
+    // Clean up.
+    fclose(fp);
+
+    // Check that all values were given.
+    for (int i = 0; i < SPEC_FIELD_COUNT; i++) {
+        if (spec_fields[i].required && !found[i]) {
+            LL_ERROR("%s: Missing value for %s!", specfile, spec_fields[i].key);
+            return 0;
+        }
+    }
+
+    if (spec.TimeSlots < 0) {
+        LL_ERROR("%s", "TimeSlots cannot be negative!");
+        return 0;
+    }
+
+    if (spec.GridSize < 1) {
+        LL_ERROR("%s", "GridSize must be positive!");
+        return 0;
+    }
+
+    if (spec.NumberOfSmallParticles < 0) {
+        LL_ERROR("%s", "NumberOfSmallParticles cannot be negative!");
+        return 0;
+    }
 
-    // Read large particle values, according to NumberOfLargeParticles.
     if (spec.NumberOfLargeParticles < 0) {
         LL_ERROR("%s", "NumberOfLargeParticles cannot be negative!");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
-    spec.LargeParticles = malloc(sizeof(Particle) * spec.NumberOfLargeParticles);
-    for (int i = 0; i < spec.NumberOfLargeParticles; i++) {
-        fscanf(fp,
-            "%Lf %Lf %Lf %Lf\n",
-            &spec.LargeParticles[i].radius,
-            &spec.LargeParticles[i].mass,
-            &spec.LargeParticles[i].x,
-            &spec.LargeParticles[i].y);
+    if (spec.PoolLength < 0) {
+        LL_ERROR("%s", "PoolLength cannot be negative!");
+        return 0;
     }
 
-    // Fill missing values for large particles.
-    for (int i = 0; i < spec.NumberOfLargeParticles; i++) {
-        spec.LargeParticles[i].id = region_id * spec.TotalNumberOfParticles + i;
-        spec.LargeParticles[i].region = region_id;
-        spec.LargeParticles[i].size = LARGE;
-        spec.LargeParticles[i].vx = 0.0L;
-        spec.LargeParticles[i].vy = 0.0L;
+    if (spec.Distribution == DISTRIBUTION_CLUSTERED && spec.NumberOfClusters < 1) {
+        LL_ERROR("%s", "NumberOfClusters must be positive!");
+        return 0;
     }
 
-    // Clean up.
-    fclose(fp);
+    if (num_large_particles != spec.NumberOfLargeParticles) {
+        LL_ERROR("%s: Expected %d large particle(s), but found %d!", specfile, spec.NumberOfLargeParticles, num_large_particles);
+        return 0;
+    }
+
+    // Calculate total number of particles.
+    spec.TotalNumberOfParticles = spec.NumberOfSmallParticles + spec.NumberOfLargeParticles;
+    *result = spec;
+
+    return 1;
+}
+
+/**
+ * Reads and parses the specification file on the current process, and exits if it is invalid.
+ */
+Spec parse_spec_file(char *specfile)
+{
+    Spec spec;
+    if (!load_spec_file(specfile, &spec)) exit(EXIT_FAILURE);
 
     return spec;
 }
 
 /**
- * Returns the length of the size of the pool.
+ * Reads the specification file on the first process of a communicator only, and broadcasts it to all other
+ * processes, so that the file is only opened once regardless of the number of processes.
  */
-int get_pool_length()
+Spec read_spec_file(char *specfile, MPI_Comm comm)
 {
-    // Return the square root of the number of cores as the pool length.
-    return (int)sqrt(get_num_cores());
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // Let every process fail together if the file is invalid, rather than waiting for the spec forever.
+    Spec spec;
+    int valid = rank == MASTER_ID ? load_spec_file(specfile, &spec) : 0;
+    MPI_Bcast(&valid, 1, MPI_INT, MASTER_ID, comm);
+    if (!valid) exit(EXIT_FAILURE);
+
+    // Broadcast all values, followed by the large particles.
+    MPI_Datatype spec_type, particle_type;
+    mpi_init_spec(&spec_type);
+    mpi_init_particle(&particle_type);
+
+    MPI_Bcast(&spec, 1, spec_type, MASTER_ID, comm);
+    if (rank != MASTER_ID) spec.LargeParticles = malloc(spec.NumberOfLargeParticles * sizeof(Particle));
+    MPI_Bcast(spec.LargeParticles, spec.NumberOfLargeParticles, particle_type, MASTER_ID, comm);
+
+    MPI_Type_free(&spec_type);
+    MPI_Type_free(&particle_type);
+
+    return spec;
 }
 
 /**
@@ -102,6 +289,11 @@ void print_spec(Spec spec)
     LL_VERBOSE("- SmallParticleMass: %Lf", spec.SmallParticleMass);
     LL_VERBOSE("- SmallParticleRadius: %Lf", spec.SmallParticleRadius);
     LL_VERBOSE("- NumberOfLargeParticles: %d", spec.NumberOfLargeParticles);
+    if (spec.PoolLength > 0) LL_VERBOSE("- PoolLength: %d", spec.PoolLength);
+    LL_VERBOSE("- Seed: %lld", spec.Seed);
+    LL_VERBOSE("- Distribution: %s", distribution_names[spec.Distribution]);
+    LL_VERBOSE("- DistributionRadius: %Lf", spec.DistributionRadius);
+    if (spec.Distribution == DISTRIBUTION_CLUSTERED) LL_VERBOSE("- NumberOfClusters: %d", spec.NumberOfClusters);
     LL_VERBOSE("%s: ", "Large particle data");
 
     for (int i = 0; i < spec.NumberOfLargeParticles; i++)
@@ -111,13 +303,19 @@ void print_spec(Spec spec)
 /**
  * Prints info about the canvas.
  */
-void print_canvas_info(Spec spec)
+void print_canvas_info(Spec spec, Decomposition decomp)
 {
     // Print info about canvas size.
     int total_particles = spec.TotalNumberOfParticles;
-    int num_grids = spec.PoolLength * spec.PoolLength;
-    int grid_size = spec.GridSize;
+    int num_grids = decomp.pool_length * decomp.pool_length;
+    int grid_size = decomp.sub_regions * spec.GridSize;
     int canvas_size = spec.GridSize * spec.PoolLength;
-    LL_NOTICE("Generated %d particle(s) in %d region(s) of size %dx%d each; Total canvas size is %dx%d; Total number of particles is %d.",
-        total_particles, num_grids, grid_size, grid_size, canvas_size, canvas_size, total_particles * num_grids);
+    LL_NOTICE("Generated %d particle(s) in %d region(s) of size %dx%d each; Total canvas size is %dx%d; Total number of particles is %lld.",
+        total_particles, num_grids, grid_size, grid_size, canvas_size, canvas_size, (long long)total_particles * num_grids);
+
+    // Point out how the regions are shared if there is not a region for each process.
+    LogLevel level = num_grids == decomp.num_procs ? LOG_LEVEL_VERBOSE : LOG_LEVEL_NOTICE;
+    LOG(level,
+        "Regions were split into %dx%d sub-region(s) of size %dx%d, between a grid of %dx%d process(es).",
+        spec.PoolLength, spec.PoolLength, spec.GridSize, spec.GridSize, decomp.procs_x, decomp.procs_y);
 }
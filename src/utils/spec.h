@@ -1,21 +1,37 @@
+#include <mpi.h>
+
 #include "types.h"
 
 /**
- * Reads the specification file.
+ * Reads and parses the specification file on the current process into the given spec.
+ *
+ * Each line is either a "Key: value" pair (in any order, with any whitespace), or the radius, mass,
+ * x-coordinate and y-coordinate of a large particle. Blank lines and comments (starting with #) are ignored.
+ * PoolLength, Seed, Distribution, DistributionRadius and NumberOfClusters are optional.
+ *
+ * @return  Returns 1 if the specification file is valid, or 0 (after logging the error) otherwise.
  */
-Spec read_spec_file(int region_id, char *specfile);
+int load_spec_file(char *specfile, Spec *spec);
 
 /**
- * Debug prints the Spec.
+ * Reads and parses the specification file on the current process (see load_spec_file),
+ * and exits if it is invalid.
  */
-void print_spec(Spec spec);
+Spec parse_spec_file(char *specfile);
+
+/**
+ * Reads the specification file on the first process of a communicator only, and broadcasts it to all other
+ * processes, so that the file is only opened once regardless of the number of processes.
+ * This must be called collectively by all processes of the communicator, which all exit if the file is invalid.
+ */
+Spec read_spec_file(char *specfile, MPI_Comm comm);
 
 /**
- * Prints info about the canvas.
+ * Debug prints the Spec.
  */
-void print_canvas_info(Spec spec);
+void print_spec(Spec spec);
 
 /**
- * Returns the length of the size of the pool.
+ * Prints info about the canvas, after the regions have been decomposed.
  */
-int get_pool_length();
+void print_canvas_info(Spec spec, Decomposition decomp);
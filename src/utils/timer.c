@@ -1,22 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <time.h>
 
 /** 
- * Determines the current time.
+ * Determines the current time, in nanoseconds since an arbitrary point.
+ * The clock is monotonic, so that durations are not affected by adjustments of the system time.
  */
 long long wall_clock_time()
 {
-#ifdef LINUX
     struct timespec tp;
-    clock_gettime(CLOCK_REALTIME, &tp);
+    clock_gettime(CLOCK_MONOTONIC, &tp);
     return (long long)(tp.tv_nsec + (long long)tp.tv_sec * 1000000000ll);
-#else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (long long)(tv.tv_usec * 1000 + (long long)tv.tv_sec * 1000000000ll);
-#endif
 }
 
 /**
@@ -1,5 +1,6 @@
 /** 
- * Determines the current time.
+ * Determines the current time, in nanoseconds since an arbitrary point.
+ * The clock is monotonic, so that it is only meaningful for measuring durations.
  */
 long long wall_clock_time();
 
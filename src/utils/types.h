@@ -1,6 +1,8 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stdio.h>
+
 /**
  * Enum for particle size.
  */
@@ -37,6 +39,182 @@ typedef struct particle_t {
     long double vy;
 } Particle;
 
+/**
+ * Data structure for the multipole summary of a region.
+ *
+ * Moments are taken about the origin of the pool (i.e. using denormalized
+ * coordinates), so that summaries computed by different processes can
+ * simply be summed together.
+ */
+typedef struct multipole_t {
+    // Total mass of all particles in the region.
+    long double mass;
+
+    // First moments of mass (sum of m * x and m * y).
+    long double mx;
+    long double my;
+
+    // Second moments of mass (sum of m * x * x, m * x * y and m * y * y).
+    long double mxx;
+    long double mxy;
+    long double myy;
+} Multipole;
+
+/**
+ * Data structure for a 2-D canvas of pixels, covering a rectangle of the pool.
+ */
+typedef struct canvas_t {
+    // Coordinates of the top-left pixel of the canvas within the pool.
+    int x;
+    int y;
+
+    // Size of the canvas.
+    int width;
+    int height;
+
+    // Value of each pixel, in row-major order.
+    int *cells;
+} Canvas;
+
+/**
+ * Particle that was drawn onto an incremental canvas, at its rasterised position.
+ */
+typedef struct drawn_particle_t {
+    int used;
+    int seen;
+    int id;
+    int x;
+    int y;
+    ParticleSize size;
+    long double radius;
+} DrawnParticle;
+
+/**
+ * Canvas which is kept across frames, and only redraws the particles which have moved.
+ */
+typedef struct incremental_canvas_t {
+    // Value of each pixel, in the same way as a canvas which was drawn from scratch.
+    Canvas canvas;
+
+    // Exact number of small and large particles covering each pixel, in row-major order.
+    int *small_counts;
+    int *large_counts;
+
+    // Hash table of the drawn particles by ID (with linear probing), with a power-of-2 capacity.
+    DrawnParticle *drawn;
+    int capacity;
+} IncrementalCanvas;
+
+/**
+ * Format of the heatmap image file.
+ */
+typedef enum output_format_t {
+    OUTPUT_FORMAT_P3,
+    OUTPUT_FORMAT_P6,
+    OUTPUT_FORMAT_TILES,
+} OutputFormat;
+
+/**
+ * Format of the debug frames.
+ */
+typedef enum frame_format_t {
+    FRAME_FORMAT_PPM,
+    FRAME_FORMAT_STREAM,
+} FrameFormat;
+
+/**
+ * Format of the benchmark file.
+ */
+typedef enum benchmark_format_t {
+    BENCHMARK_FORMAT_JSON,
+    BENCHMARK_FORMAT_CSV,
+} BenchmarkFormat;
+
+/**
+ * Append-only stream of compressed debug frames, which is indexed once closed.
+ */
+typedef struct frame_stream_t {
+    FILE *fp;
+    int width;
+    int height;
+    int downsample;
+    int decimation;
+    int num_frames;
+    long long offset;
+
+    // Pixels of the current and previous frames, and a buffer for the encoded frame.
+    unsigned char *pixels;
+    unsigned char *previous;
+    unsigned char *buf;
+
+    // Index of the offset, length and time slot of each frame.
+    long long *offsets;
+    int *lengths;
+    int *time_slots;
+    int capacity;
+} FrameStream;
+
+/**
+ * Order in which the blocks of the process grid are assigned to processes.
+ */
+typedef enum region_order_t {
+    REGION_ORDER_ROW_MAJOR,
+    REGION_ORDER_HILBERT,
+    REGION_ORDER_CART,
+} RegionOrder;
+
+/**
+ * Data structure for the decomposition of regions amongst processes.
+ *
+ * Processes are laid out in a grid of procs_x x procs_y processes, over a square grid of regions.
+ * Each process is initially assigned a rectangular block of sub-regions,
+ * which can be migrated to other processes to even out computation time.
+ */
+typedef struct decomposition_t {
+    // Number of processes.
+    int num_procs;
+
+    // Number of regions of the specification file along each side of the pool.
+    int pool_length;
+
+    // Number of sub-regions that each region of the specification file is split into, along each side.
+    int sub_regions;
+
+    // Total number of regions (i.e. sub-regions) across all processes.
+    int num_regions;
+
+    // Number of processes along the x-axis and y-axis of the process grid.
+    int procs_x;
+    int procs_y;
+
+    // Max distance of adjacent regions to factor in, as given by Horizon in the specification file.
+    int horizon;
+
+    // Process that each block of the process grid is initially assigned to,
+    // indexed by block ID (i.e. the row-major position of the block in the process grid).
+    int *block_ranks;
+
+    // Process that each region is assigned to, indexed by region ID.
+    int *owners;
+} Decomposition;
+
+/**
+ * Distribution of the initial positions of small particles.
+ */
+typedef enum particle_distribution_t {
+    // Uniformly within the region of each process.
+    DISTRIBUTION_UNIFORM,
+
+    // Plummer sphere (projected onto the pool) around the centre of the pool.
+    DISTRIBUTION_PLUMMER,
+
+    // Exponential disk around the centre of the pool.
+    DISTRIBUTION_DISK,
+
+    // Gaussian clusters around random centres within the pool.
+    DISTRIBUTION_CLUSTERED,
+} ParticleDistribution;
+
 /**
  * Data structure for the specification file.
  */
@@ -70,11 +248,25 @@ typedef struct spec_t {
     Particle *LargeParticles;
 
     // Length of the 2-D grid of all regions.
-    // If there are 9 regions, PoolLength is 3.
+    // If there are 9 regions, PoolLength is 3. If it is not given, there is a region for each process
+    // (rounded to the nearest square number of regions).
     int PoolLength;
 
     // Total number of particles.
     int TotalNumberOfParticles;
+
+    // Seed for the initial positions of small particles.
+    long long Seed;
+
+    // Distribution of the initial positions of small particles.
+    ParticleDistribution Distribution;
+
+    // Scale of the distribution (i.e. the Plummer radius, scale length of the disk, or standard deviation
+    // of each cluster). If 0, it defaults to an eighth of the length of the pool.
+    long double DistributionRadius;
+
+    // Number of clusters, for a clustered distribution.
+    int NumberOfClusters;
 } Spec;
 
 #endif
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+# Checks that the horizon is applied to each region, regardless of how many regions each process computes,
+# by comparing the heatmaps of each Horizon on 1, 3 and 4 processes (where 3 processes and SUB_REGIONS=2 split
+# each region into sub-regions). Without collisions, the runs must match exactly, and Horizon 0, 1 and 3
+# (i.e. the whole pool) must differ from each other. Likewise, the multipole
+# summaries must only replace the regions beyond MULTIPOLE_HORIZON, so that the far field of a region is not
+# counted twice: MULTIPOLE_HORIZON=1 (whose summaries are accurate enough for this pool) must match the
+# exact run, and MULTIPOLE_HORIZON=0 must match on 1 and 4 processes.
+#
+# Run from the root of the repository after building pool (e.g. with make test), or pass MPIRUN to change
+# how the processes are started.
+
+MPIRUN=${MPIRUN:-mpirun --oversubscribe}
+TESTDIR=$(dirname "$0")
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# Runs pool with a name, number of processes, spec and environment variables, and fails the test on any error.
+run() {
+    name=$1
+    np=$2
+    spec=$3
+    shift 3
+    if ! env LOG_LEVEL=1 "$@" $MPIRUN -np "$np" ./pool "$spec" "$OUT/$name.ppm" > "$OUT/$name.log" 2>&1; then
+        echo "FAIL: $name exited with an error:"
+        cat "$OUT/$name.log"
+        exit 1
+    fi
+}
+
+# Compares the heatmaps of two runs.
+compare() {
+    if ! cmp -s "$OUT/$1.ppm" "$OUT/$2.ppm"; then
+        echo "FAIL: $1 does not match $2."
+        exit 1
+    fi
+}
+
+# Checks that the heatmaps of two runs differ.
+differ() {
+    if cmp -s "$OUT/$1.ppm" "$OUT/$2.ppm"; then
+        echo "FAIL: $1 matches $2, so the horizon was not applied."
+        exit 1
+    fi
+}
+
+for horizon in 0 1 3; do
+    sed -e "s/^Horizon:.*/Horizon: $horizon/" "$TESTDIR/horizon.txt" > "$OUT/h$horizon.txt"
+    run h$horizon-np1 1 "$OUT/h$horizon.txt"
+    run h$horizon-np3 3 "$OUT/h$horizon.txt"
+    run h$horizon-np4 4 "$OUT/h$horizon.txt"
+    run h$horizon-np4-sub 4 "$OUT/h$horizon.txt" SUB_REGIONS=2
+    compare h$horizon-np3 h$horizon-np1
+    compare h$horizon-np4 h$horizon-np1
+    compare h$horizon-np4-sub h$horizon-np1
+done
+
+differ h0-np1 h1-np1
+differ h1-np1 h3-np1
+
+for multipole_horizon in 0 1; do
+    run h3-m$multipole_horizon-np1 1 "$OUT/h3.txt" MULTIPOLE_HORIZON=$multipole_horizon
+    run h3-m$multipole_horizon-np4 4 "$OUT/h3.txt" MULTIPOLE_HORIZON=$multipole_horizon
+    compare h3-m$multipole_horizon-np4 h3-m$multipole_horizon-np1
+done
+
+compare h3-m1-np1 h3-np1
+
+echo "PASS: horizon"
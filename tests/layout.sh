@@ -0,0 +1,51 @@
+#!/bin/sh
+
+# Checks that the initial particles do not depend on the decomposition of the pool, by comparing the heatmaps
+# of a time slot which does not move any particle, on 1, 3 and 4 processes (in row-major and Hilbert order).
+#
+# Run from the root of the repository after building pool (e.g. with make test), or pass MPIRUN to change
+# how the processes are started.
+
+MPIRUN=${MPIRUN:-mpirun --oversubscribe}
+TESTDIR=$(dirname "$0")
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# Runs pool with a name, number of processes and environment variables, and fails the test on any error.
+run() {
+    name=$1
+    np=$2
+    shift 2
+    if ! env LOG_LEVEL=1 "$@" $MPIRUN -np "$np" ./pool "$OUT/spec.txt" "$OUT/$name.ppm" > "$OUT/$name.log" 2>&1; then
+        echo "FAIL: $name exited with an error:"
+        cat "$OUT/$name.log"
+        exit 1
+    fi
+}
+
+# Compares the heatmap of a run against the run on a single process.
+compare() {
+    if ! cmp -s "$OUT/np1.ppm" "$OUT/$1.ppm"; then
+        echo "FAIL: $1 generated different particles than np1 ($2)."
+        exit 1
+    fi
+}
+
+for distribution in uniform clustered; do
+    # A single time slot of zero length does not move any particle.
+    sed -e 's/^TimeSlots:.*/TimeSlots: 1/' -e 's/^TimeStep:.*/TimeStep: 0/' "$TESTDIR/spec.txt" > "$OUT/spec.txt"
+    echo "Distribution: $distribution" >> "$OUT/spec.txt"
+
+    run np1 1
+    run np3 3
+    run np4 4
+    run np4-hilbert 4 REGION_ORDER=hilbert
+    run np4-sub 4 SUB_REGIONS=3
+
+    compare np3 "$distribution"
+    compare np4 "$distribution"
+    compare np4-hilbert "$distribution"
+    compare np4-sub "$distribution"
+done
+
+echo "PASS: layout"
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+# Checks that a checkpoint written on 4 processes can be restarted on 4, 2 and 1 processes. Restarting it
+# without any time slot left must reproduce the heatmap of the time slot it was written at exactly, and
+# carrying on on 4 processes must reproduce the run which was not stopped. A pool whose length depends on
+# the number of processes (without PoolLength) must be rejected instead.
+#
+# Run from the root of the repository after building pool (e.g. with make test), or pass MPIRUN to change
+# how the processes are started.
+
+MPIRUN=${MPIRUN:-mpirun --oversubscribe}
+TESTDIR=$(dirname "$0")
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# Runs pool with a name, number of processes, spec and environment variables, and fails the test on any error.
+run() {
+    name=$1
+    np=$2
+    spec=$3
+    shift 3
+    if ! env LOG_LEVEL=1 "$@" $MPIRUN -np "$np" ./pool "$spec" "$OUT/$name.ppm" > "$OUT/$name.log" 2>&1; then
+        echo "FAIL: $name exited with an error:"
+        cat "$OUT/$name.log"
+        exit 1
+    fi
+}
+
+# Compares the heatmaps of two runs.
+compare() {
+    if ! cmp -s "$OUT/$1.ppm" "$OUT/$2.ppm"; then
+        echo "FAIL: $1 does not match $2."
+        exit 1
+    fi
+}
+
+# The checkpoint is written at time slot 2 of 4.
+sed -e 's/^TimeSlots:.*/TimeSlots: 2/' "$TESTDIR/spec.txt" > "$OUT/stop.txt"
+run full 4 "$TESTDIR/spec.txt" CHECKPOINT_FILE="$OUT/pool.ckpt" CHECKPOINT_INTERVAL=2
+run stop 4 "$OUT/stop.txt"
+
+run restart-np4 4 "$TESTDIR/spec.txt" RESTART_FILE="$OUT/pool.ckpt"
+compare restart-np4 full
+
+for np in 4 2 1; do
+    run resume-np$np $np "$OUT/stop.txt" RESTART_FILE="$OUT/pool.ckpt"
+    compare resume-np$np stop
+done
+run restart-np2 2 "$TESTDIR/spec.txt" RESTART_FILE="$OUT/pool.ckpt"
+run restart-np1 1 "$TESTDIR/spec.txt" RESTART_FILE="$OUT/pool.ckpt"
+
+# Without PoolLength, a single process has a pool of a single region.
+grep -v "^PoolLength:" "$TESTDIR/spec.txt" > "$OUT/default.txt"
+if env LOG_LEVEL=1 RESTART_FILE="$OUT/pool.ckpt" $MPIRUN -np 1 ./pool "$OUT/default.txt" "$OUT/default.ppm" > "$OUT/default.log" 2>&1 ||
+    ! grep -q "PoolLength" "$OUT/default.log"; then
+    echo "FAIL: a checkpoint of a different pool was not rejected:"
+    cat "$OUT/default.log"
+    exit 1
+fi
+
+echo "PASS: restart"